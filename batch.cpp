@@ -0,0 +1,87 @@
+#include "Batch.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Parses manifest at path, one job per line: path of the image, frames and
+ * optionally path of a file of inputs, one byte of buttons held on controller
+ * 0 per frame. Empty lines and lines starting with # are skipped.
+ * @return false if the manifest or an input file can not be read, or a line
+ * is malformed.
+ */
+static bool parse(const char *path, std::vector<Batch::Job> &jobs) {
+  std::ifstream manifest(path);
+  if (!manifest) {
+    std::fprintf(stderr, "can not read %s\n", path);
+    return false;
+  }
+
+  std::string line;
+  for (size_t number = 1; std::getline(manifest, line); number++) {
+    std::istringstream fields(line);
+    Batch::Job job;
+    std::string inputs;
+    if (!(fields >> job.path) || job.path[0] == '#')
+      continue;
+    if (!(fields >> job.frames)) {
+      std::fprintf(stderr, "%s:%zu: expected frames\n", path, number);
+      return false;
+    }
+    if (fields >> inputs) {
+      std::ifstream file(inputs, std::ios::binary);
+      if (!file) {
+        std::fprintf(stderr, "%s:%zu: can not read %s\n", path, number,
+                     inputs.c_str());
+        return false;
+      }
+      job.buttons.assign(std::istreambuf_iterator<char>(file),
+                         std::istreambuf_iterator<char>());
+    }
+    jobs.push_back(std::move(job));
+  }
+  return true;
+}
+
+/**
+ * Runs the jobs of a manifest on every core and prints the result of each
+ * job followed by the aggregate emulation speed.
+ */
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "usage: %s manifest [threads]\n", argv[0]);
+    return 1;
+  }
+  std::vector<Batch::Job> jobs;
+  if (!parse(argv[1], jobs))
+    return 1;
+
+  Batch batch(std::move(jobs));
+  size_t threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 0;
+  batch.run(threads);
+
+  int status = 0;
+  for (size_t i = 0; i < batch.jobs().size(); i++) {
+    const Batch::Job &job = batch.jobs()[i];
+    const Batch::Result &result = batch.results()[i];
+    if (!result.ok) {
+      std::printf("job %zu %s failed\n", i, job.path.c_str());
+      status = 1;
+      continue;
+    }
+    std::printf("job %zu %s frames %llu cycles %llu hash %016llx ms %.3f\n", i,
+                job.path.c_str(), (unsigned long long)result.frames,
+                (unsigned long long)result.cycles,
+                (unsigned long long)result.hash, result.seconds * 1e3);
+  }
+  std::printf("jobs %zu frames %llu seconds %.3f frames/s %.1f\n",
+              batch.jobs().size(), (unsigned long long)batch.frames(),
+              batch.seconds(),
+              batch.seconds() > 0 ? batch.frames() / batch.seconds() : 0.0);
+  return status;
+}
@@ -0,0 +1,199 @@
+#include "Bus.hpp"
+#include "Cpu.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+#if defined(NES_JIT)
+const char *const core = "jit";
+#elif defined(NES_FUSED_CORE)
+const char *const core = "fused";
+#else
+const char *const core = "table";
+#endif
+
+/**
+ * Synthetic program looping forever from $8000.
+ */
+struct Workload {
+  const char *name;
+  std::vector<uint8_t> code;
+};
+
+const Workload workloads[] = {
+    {"alu",
+     {
+         0x18,             // $8000 CLC
+         0xA9, 0x01,       // $8001 LDA #$01
+         0x65, 0x10,       // $8003 ADC $10
+         0x85, 0x10,       // $8005 STA $10
+         0x49, 0x55,       // $8007 EOR #$55
+         0x29, 0xF0,       // $8009 AND #$F0
+         0x05, 0x11,       // $800B ORA $11
+         0x0A,             // $800D ASL A
+         0x66, 0x12,       // $800E ROR $12
+         0xE8,             // $8010 INX
+         0x88,             // $8011 DEY
+         0xE9, 0x03,       // $8012 SBC #$03
+         0xC9, 0x40,       // $8014 CMP #$40
+         0x4C, 0x00, 0x80, // $8016 JMP $8000
+     }},
+    {"branch",
+     {
+         0xA2, 0x00, // $8000 LDX #$00
+         0xE8,       // $8002 INX
+         0x8A,       // $8003 TXA
+         0x4A,       // $8004 LSR A
+         0x90, 0x01, // $8005 BCC $8008
+         0xC8,       // $8007 INY
+         0x4A,       // $8008 LSR A
+         0xB0, 0x01, // $8009 BCS $800C
+         0x88,       // $800B DEY
+         0xE0, 0xA0, // $800C CPX #$A0
+         0xD0, 0xF2, // $800E BNE $8002
+         0xF0, 0xEE, // $8010 BEQ $8000
+     }},
+    // walks $0280-$077F through the pointer at $20, crossing a page every
+    // other read.
+    {"indirect",
+     {
+         0xA9, 0x80, // $8000 LDA #$80
+         0x85, 0x20, // $8002 STA $20
+         0xA9, 0x02, // $8004 LDA #$02
+         0x85, 0x21, // $8006 STA $21
+         0xA0, 0x00, // $8008 LDY #$00
+         0xB1, 0x20, // $800A LDA ($20),Y
+         0x18,       // $800C CLC
+         0x69, 0x01, // $800D ADC #$01
+         0x91, 0x20, // $800F STA ($20),Y
+         0xC8,       // $8011 INY
+         0xD0, 0xF6, // $8012 BNE $800A
+         0xE6, 0x21, // $8014 INC $21
+         0xA5, 0x21, // $8016 LDA $21
+         0xC9, 0x07, // $8018 CMP #$07
+         0xD0, 0xEE, // $801A BNE $800A
+         0xF0, 0xE6, // $801C BEQ $8004
+     }},
+    {"stack",
+     {
+         0x20, 0x06, 0x80, // $8000 JSR $8006
+         0x4C, 0x00, 0x80, // $8003 JMP $8000
+         0x48,             // $8006 PHA
+         0x20, 0x0C, 0x80, // $8007 JSR $800C
+         0x68,             // $800A PLA
+         0x60,             // $800B RTS
+         0x08,             // $800C PHP
+         0x8A,             // $800D TXA
+         0x48,             // $800E PHA
+         0x20, 0x16, 0x80, // $800F JSR $8016
+         0x68,             // $8012 PLA
+         0xAA,             // $8013 TAX
+         0x28,             // $8014 PLP
+         0x60,             // $8015 RTS
+         0xE8,             // $8016 INX
+         0x60,             // $8017 RTS
+     }},
+};
+
+/// Instructions stepped to measure instructions per cycle of a workload.
+constexpr uint64_t calibration_instructions = 100000;
+
+struct Options {
+  /// Timed runs of each workload, after one warmup run.
+  unsigned runs = 5;
+
+  /// Cpu cycles of each run.
+  uint64_t cycles = 20000000;
+};
+
+/**
+ * Runs workload on a fresh cpu and prints a JSON line of its throughput.
+ * @return false if the cpu halts.
+ */
+bool bench(const Workload &workload, bool block_cache,
+           const Options &options) {
+  using Clock = std::chrono::steady_clock;
+
+  Bus bus;
+  Cpu cpu(&bus);
+  std::vector<uint8_t> prg(0x8000);
+  std::memcpy(prg.data(), workload.code.data(), workload.code.size());
+  prg[0x7FFC] = 0x00;
+  prg[0x7FFD] = 0x80;
+  bus.map(0x8000, 0xFFFF, prg.data(), prg.size(), false);
+  cpu.reset();
+  cpu.set_block_cache(block_cache);
+
+  // workloads are periodic, so instructions per cycle of the interpreter
+  // holds for every core.
+  uint64_t start_clock = cpu.clock();
+  for (uint64_t i = 0; i < calibration_instructions; i++)
+    cpu.step();
+  double instructions_per_cycle =
+      (double)calibration_instructions / (cpu.clock() - start_clock);
+
+  // run() may overshoot the budget by an instruction or a block, rates are
+  // taken from the cycles it ran.
+  struct Run {
+    uint64_t cycles;
+    double seconds;
+    double mhz() const { return cycles / seconds / 1e6; }
+  };
+  std::vector<Run> runs;
+  for (unsigned run = 0; run <= options.runs; run++) {
+    auto start = Clock::now();
+    uint64_t cycles = cpu.run(options.cycles);
+    if (run)
+      runs.push_back(
+          {cycles,
+           std::chrono::duration<double>(Clock::now() - start).count()});
+  }
+  if (cpu.halted()) {
+    std::fprintf(stderr, "%s halted at $%04X\n", workload.name, cpu.pc());
+    return false;
+  }
+
+  std::sort(runs.begin(), runs.end(), [](const Run &a, const Run &b) {
+    return a.mhz() < b.mhz();
+  });
+  const Run &median = runs[runs.size() / 2];
+  double instructions = median.cycles * instructions_per_cycle;
+  std::printf("{\"workload\": \"%s\", \"core\": \"%s\", \"block_cache\": %s, "
+              "\"runs\": %u, \"cycles\": %llu, \"instructions\": %.0f, "
+              "\"mhz\": %.2f, \"mhz_min\": %.2f, \"mhz_max\": %.2f, "
+              "\"instructions_per_second\": %.0f, "
+              "\"ns_per_instruction\": %.3f}\n",
+              workload.name, core, block_cache ? "true" : "false",
+              options.runs, (unsigned long long)median.cycles, instructions,
+              median.mhz(), runs.front().mhz(), runs.back().mhz(),
+              instructions / median.seconds,
+              median.seconds / instructions * 1e9);
+  return true;
+}
+
+} // namespace
+
+/**
+ * Runs every synthetic workload with the block cache disabled and enabled
+ * and prints one JSON object per line with the median throughput of the
+ * runs, so results can be compared between builds.
+ */
+int main(int argc, char **argv) {
+  Options options;
+  if (argc > 1)
+    options.runs = std::max(1ul, std::strtoul(argv[1], nullptr, 10));
+  if (argc > 2)
+    options.cycles = std::max(1ull, std::strtoull(argv[2], nullptr, 10));
+
+  for (const Workload &workload : workloads)
+    for (bool block_cache : {false, true})
+      if (!bench(workload, block_cache, options))
+        return 1;
+  return 0;
+}
@@ -0,0 +1,229 @@
+#pragma once
+
+#include "Blip.hpp"
+#include "Bus.hpp"
+#include "Cpu.hpp"
+#include "SampleRing.hpp"
+#include "Scheduler.hpp"
+#include "State.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Apu class emulates the audio processing unit of the 2A03: two pulse
+ * channels, triangle, noise, delta modulation channel and the frame counter.
+ *
+ * Like the PPU, the APU is not stepped with the cpu. It catches up to the
+ * master clock when its registers are accessed and at every step of the frame
+ * counter, which it schedules. Channels are advanced from one change of their
+ * output to the next and each change is added to a Blip buffer as a band
+ * limited step. At each frame counter step, about 240 times per second, and
+ * when the caller asks for it, the completed batch of samples moves to a ring
+ * buffer.
+ *
+ * Channels are mixed linearly, with the usual approximation of the mixer of
+ * the 2A03. Cycles stolen by fetches of the delta modulation channel are not
+ * emulated.
+ */
+class Apu : public Device, private Scheduler::Handler {
+public:
+  /**
+   * @param sample_rate Rate of samples produced, e.g. 44100 or 48000.
+   */
+  Apu(Bus *bus, Cpu *cpu, uint32_t sample_rate = 48000);
+
+  ~Apu() override;
+
+  Apu(const Apu &) = delete;
+  Apu &operator=(const Apu &) = delete;
+
+  /// Reads $4015 status, other registers are write only.
+  uint8_t read(uint16_t address) override;
+
+  /// Writes register at $4000-$4017.
+  void write(uint16_t address, uint8_t data) override;
+
+  /**
+   * Advances channels to the current master clock of the cpu.
+   */
+  void catch_up();
+
+  /**
+   * Catches up and moves every completed sample to samples().
+   */
+  void end_batch();
+
+  /**
+   * Saves channels, frame counter and samples of the current batch. Samples
+   * already in samples() belong to the consumer and are not saved.
+   */
+  void save(state::Writer &state) const;
+
+  void load(state::Reader &state);
+
+  /// @return Samples produced so far, read by the consumer.
+  SampleRing &samples() { return m_ring; }
+
+  uint32_t sample_rate() const { return m_sample_rate; }
+
+  /// Rate of the master clock of the NTSC 2A03.
+  static constexpr double clock_rate = 1789773.0;
+
+private:
+  /// Volume envelope of pulse and noise channels.
+  struct Envelope {
+    bool start, loop, constant;
+    uint8_t period, divider, decay;
+
+    /// Clocked by quarter frames.
+    void clock();
+
+    uint8_t volume() const { return constant ? period : decay; }
+  };
+
+  struct Pulse {
+    Envelope envelope;
+    uint8_t duty, step, length;
+    uint16_t period;
+    bool sweep_enabled, negate, reload;
+    uint8_t sweep_period, shift, sweep_divider;
+    /// Pulse 1 negates sweep changes in ones' complement.
+    bool ones_complement;
+    /// Clock of the next step of the sequencer.
+    uint64_t next;
+    uint8_t level;
+
+    /// @return Period the sweep unit moves to.
+    uint16_t target() const;
+
+    bool muted() const { return period < 8 || target() > 0x7FF; }
+
+    /// @return Output at the current step.
+    uint8_t output() const;
+
+    /// Clocked by half frames.
+    void sweep();
+  };
+
+  struct Triangle {
+    uint8_t step, length, linear, linear_reload;
+    bool control, reload;
+    uint16_t period;
+    uint64_t next;
+    uint8_t level;
+
+    uint8_t output() const;
+  };
+
+  struct Noise {
+    Envelope envelope;
+    bool mode;
+    uint8_t length;
+    uint16_t period, shift;
+    uint64_t next;
+    uint8_t level;
+
+    uint8_t output() const;
+  };
+
+  struct Dmc {
+    bool irq_enabled, loop, silence, full;
+    uint8_t level, buffer, shift, bits;
+    uint16_t period, start, address, size, remaining;
+    uint64_t next;
+  };
+
+  /**
+   * Handles the apu event by catching up.
+   */
+  void handle(Scheduler::Event event, uint64_t time) override;
+
+  /**
+   * Advances channels and frame counter to clock target, ending a batch at
+   * each step of the frame counter.
+   */
+  void run(uint64_t target);
+
+  /**
+   * Advances channels to clock until.
+   */
+  void advance(uint64_t until);
+
+  /**
+   * Ends the batch at m_time and moves completed samples to the ring.
+   */
+  void flush();
+
+  /// Advances channel through every step at or before until.
+  void run_pulse(Pulse &pulse, uint64_t until, int32_t weight);
+  void run_triangle(uint64_t until);
+  void run_noise(uint64_t until);
+  void run_dmc(uint64_t until);
+
+  /**
+   * Executes the step of the frame counter due at m_frame_next.
+   */
+  void frame_step();
+
+  void quarter_frame();
+  void half_frame();
+
+  /**
+   * Fetches the next byte of the sample into the buffer of the delta
+   * modulation channel if it is empty.
+   */
+  void fetch();
+
+  /**
+   * Sets level of a channel at time, adding the change to the buffer.
+   */
+  void set_level(uint8_t &level, uint8_t value, int32_t weight, uint64_t time);
+
+  /**
+   * Recomputes levels of channels changed by registers or frame counter at
+   * time.
+   */
+  void update(uint64_t time);
+
+  /**
+   * Schedules catch up at the next step of the frame counter or interrupt of
+   * the delta modulation channel.
+   */
+  void schedule();
+
+  /// Bus samples of the delta modulation channel are fetched from.
+  Bus *m_bus;
+
+  /// Cpu receiving interrupt requests and supplying master clock.
+  Cpu *m_cpu;
+
+  uint32_t m_sample_rate;
+
+  /// Clock the channels caught up to.
+  uint64_t m_time;
+
+  /// Clock the current batch of the buffer started at.
+  uint64_t m_batch;
+
+  Pulse m_pulse[2];
+  Triangle m_triangle;
+  Noise m_noise;
+  Dmc m_dmc;
+
+  /// Channels enabled by $4015.
+  uint8_t m_enabled;
+
+  /// 5 step mode, interrupt inhibit and interrupt flag of the frame counter.
+  bool m_five_step, m_inhibit, m_frame_irq;
+
+  /// Interrupt flag of the delta modulation channel.
+  bool m_dmc_irq;
+
+  /// Step of the frame counter due at m_frame_next.
+  uint8_t m_frame_step;
+  uint64_t m_frame_next;
+
+  Blip m_blip;
+  SampleRing m_ring;
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "Nes.hpp"
+#include "Rom.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Batch class runs many independent jobs, each an image run headless for a
+ * number of frames with a sequence of controller inputs, on a pool of
+ * threads.
+ *
+ * Jobs are sorted by image and dealt in contiguous runs to one queue per
+ * worker. A worker takes jobs from the front of its own queue and, once it is
+ * empty, steals from the back of the others, so every worker stays busy
+ * however long each job runs. Each worker has its own arena holding the
+ * console of the last image it ran and its frame buffers: a following job of
+ * the same image loads the power on state instead of creating a console.
+ * Images are opened once and shared by the consoles of every worker.
+ */
+class Batch {
+public:
+  struct Job {
+    /// Path of the image.
+    std::string path;
+
+    /// Frames run, fewer if the cpu halts.
+    uint64_t frames;
+
+    /// Buttons held on controller 0 in each frame, a mask of Io::Button.
+    /// None are held in frames past the end.
+    std::vector<uint8_t> buttons;
+  };
+
+  struct Result {
+    /// false if the image can not be opened or its mapper is not supported.
+    bool ok;
+
+    /// Frames completed and cpu cycles since power on.
+    uint64_t frames;
+    uint64_t cycles;
+
+    /// FNV-1a hash of the last frame in index format, 0 without frames.
+    uint64_t hash;
+
+    /// Seconds the job took on its worker.
+    double seconds;
+  };
+
+  explicit Batch(std::vector<Job> jobs);
+
+  Batch(const Batch &) = delete;
+  Batch &operator=(const Batch &) = delete;
+
+  /**
+   * Runs every job and waits for them to complete.
+   * @param threads Workers, 0 for one per core. The calling thread is one of
+   * them.
+   */
+  void run(size_t threads = 0);
+
+  const std::vector<Job> &jobs() const { return m_jobs; }
+
+  /// @return Result of each job of the last run, in the order of jobs().
+  const std::vector<Result> &results() const { return m_results; }
+
+  /// @return Frames completed by every job of the last run.
+  uint64_t frames() const;
+
+  /// @return Seconds the last run took.
+  double seconds() const { return m_seconds; }
+
+private:
+  /// Jobs dealt to a worker, as indices into m_jobs.
+  struct Queue {
+    std::mutex mutex;
+    std::deque<size_t> jobs;
+  };
+
+  /// Memory of a worker reused by its consecutive jobs.
+  struct Arena {
+    /// Image of nes, nullptr before the first job.
+    const Rom *rom = nullptr;
+    std::unique_ptr<Nes> nes;
+
+    /// State of nes at power on, loaded before each following job.
+    std::vector<uint8_t> power_on;
+
+    /// Double buffered frames in index format.
+    std::vector<uint8_t> frames;
+  };
+
+  /// Runs jobs of worker and jobs stolen from others until none are left.
+  void work(size_t worker);
+
+  /**
+   * Takes the next job of worker, or steals one from another worker.
+   * @return false if every queue is empty.
+   */
+  bool take(size_t worker, size_t &job);
+
+  /// Runs job on the console of arena, storing its result.
+  void run_job(Arena &arena, size_t job);
+
+  std::vector<Job> m_jobs;
+  std::vector<Result> m_results;
+
+  /// Image of each path of jobs, opened before workers start and only read
+  /// while they run.
+  std::map<std::string, std::shared_ptr<Rom>> m_roms;
+
+  std::vector<std::unique_ptr<Queue>> m_queues;
+
+  double m_seconds;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "State.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Band-limited step synthesis, resampling amplitude changes on a clock to
+ * samples at a lower rate.
+ *
+ * Instead of being evaluated at every clock, a waveform is described by the
+ * deltas of its amplitude. Each delta adds a windowed sinc step at its exact
+ * fractional sample position, so output has no aliasing from the hard edges
+ * of square waves. Samples are completed in batches by end_batch().
+ */
+class Blip {
+public:
+  /**
+   * @param clock_rate Rate of the clock times of deltas are counted in.
+   * @param sample_rate Rate of samples produced.
+   * @param capacity Number of samples one batch may span.
+   */
+  Blip(double clock_rate, double sample_rate, size_t capacity);
+
+  /**
+   * Adds delta to the amplitude at time, clocks since the start of the
+   * current batch.
+   */
+  void add_delta(uint64_t time, int32_t delta) {
+    uint64_t position = m_offset + time * m_factor;
+    const int16_t *kernel =
+        m_kernels[(position >> (fraction_bits - phase_bits)) & (phases - 1)];
+    int64_t *out = &m_buffer[position >> fraction_bits];
+    for (size_t i = 0; i < taps; i++)
+      out[i] += kernel[i] * delta;
+  }
+
+  /**
+   * Ends the current batch time clocks after its start, completing every
+   * sample before it. The next batch starts at time.
+   */
+  void end_batch(uint64_t time);
+
+  /// @return Number of completed samples.
+  size_t available() const { return m_offset >> fraction_bits; }
+
+  /**
+   * Moves up to count completed samples to out.
+   * @return Number of samples moved.
+   */
+  size_t read(int16_t *out, size_t count);
+
+  /**
+   * Saves position of the batch, running sum and deltas of samples not read
+   * yet, so output continues seamlessly after load().
+   */
+  void save(state::Writer &state) const;
+
+  void load(state::Reader &state);
+
+  /// Number of samples a step is spread over, output is delayed by half.
+  static constexpr size_t taps = 16;
+
+private:
+  static constexpr unsigned phase_bits = 6;
+  static constexpr size_t phases = 1 << phase_bits;
+  static constexpr unsigned fraction_bits = 32;
+
+  /// Sample positions per clock in 32.32 fixed point.
+  uint64_t m_factor;
+
+  /// Position of the start of the current batch in 32.32 fixed point.
+  uint64_t m_offset;
+
+  /// Running sum of deltas, in 1.15 fixed point.
+  int64_t m_sum;
+
+  /// Step response of each phase, taps of each sum to 1 << 15.
+  using Kernels = int16_t[phases][taps];
+
+  /// @return Kernels shared by every buffer, computed on first use.
+  static const Kernels &kernels();
+
+  const Kernels &m_kernels;
+
+  /// Deltas of samples not read yet, spread by the kernels.
+  std::vector<int64_t> m_buffer;
+};
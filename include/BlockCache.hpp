@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Bus.hpp"
+#include "Cpu.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Cache of pre-decoded basic blocks keyed by address of their first
+ * instruction.
+ *
+ * A block never spans more than one page and ends at the first instruction
+ * which changes the program counter. Blocks are revalidated against version
+ * of their page, so they are dropped when the page is remapped (bank switch)
+ * or when RAM holding the code is written.
+ */
+class BlockCache {
+public:
+  BlockCache(Bus *bus);
+
+  /**
+   * @return Decoded instruction at pc, nullptr if instruction at pc can not be
+   * cached, e.g. it is in a device page or crosses page boundary.
+   */
+  const Cpu::Decoded *find(uint16_t pc);
+
+  /// Maximum number of instructions in one block.
+  static constexpr size_t max_block_length = 16;
+
+  /// Number of blocks held by the cache.
+  static constexpr size_t block_count = 1024;
+
+private:
+  struct Block {
+    /// Address of the first instruction.
+    uint16_t pc;
+    /// Page holding the block.
+    uint8_t page;
+    /// Number of decoded instructions, 0 if block is empty.
+    uint8_t length;
+    /// Version of the page when block was decoded.
+    uint32_t version;
+    Cpu::Decoded instructions[max_block_length];
+  };
+
+  /**
+   * Decodes block starting at pc.
+   * @return false if no instruction could be decoded.
+   */
+  bool decode(Block &block, uint16_t pc);
+
+  /// Context of bus.
+  Bus *m_bus;
+
+  Block m_blocks[block_count];
+
+  /// Block being executed, nullptr if none.
+  Block *m_current;
+
+  /// Index of the next instruction in m_current.
+  uint8_t m_next;
+
+  /// Address of the next instruction in m_current.
+  uint16_t m_next_pc;
+};
@@ -1,11 +1,41 @@
 #pragma once
 
+#include "Memory.hpp"
+
+#include <cstddef>
 #include <cstdint>
 
+/**
+ * Interface of the devices whose registers are mapped in address space of the
+ * bus, e.g. PPU and APU.
+ */
+class Device {
+public:
+  virtual ~Device() = default;
+
+  /// Read 1 byte of data from register at address.
+  virtual uint8_t read(uint16_t address) = 0;
+
+  /// Write 1 byte of data to register at address.
+  virtual void write(uint16_t address, uint8_t data) = 0;
+
+  /**
+   * @return Master clock before which reading register at address returns
+   * what a read returns now and leaves the device unchanged, as long as no
+   * other register is accessed. 0 if a read may change the device.
+   */
+  virtual uint64_t stable_until(uint16_t address) {
+    (void)address;
+    return 0;
+  }
+};
+
 /**
  * Class emulates behaviour of the bus.
  *
  * Bus can be used to transfer 1 byte data from 2 byte addressable memory.
+ * Address space is split in 256 pages of 256 bytes. Each page either points
+ * directly into backing memory or routes accesses to a Device.
  */
 class Bus {
 public:
@@ -18,6 +48,151 @@ public:
   /// Write 1 byte of data from address.
   void write(uint16_t address, uint8_t data);
 
+  /**
+   * Map pages in range [first, last] directly to memory. If the range is
+   * larger than memory then memory is mirrored through it.
+   * @param first Address of the first mapped byte, must be page aligned.
+   * @param last Address of the last mapped byte, must end a page.
+   * @param memory Backing memory, must outlive the mapping.
+   * @param size Size of memory, must be multiple of page size.
+   * @param writable If false writes to the range are ignored.
+   * @param device Receives writes to the range if it is not writable, e.g.
+   * registers of a cartridge mapper overlaying PRG-ROM.
+   */
+  void map(uint16_t first, uint16_t last, uint8_t *memory, size_t size,
+           bool writable, Device *device = nullptr);
+
+  /**
+   * Map pages in range [first, last] to pages of memory, mirrored if the
+   * range is larger. Pages of memory shared with a fork are written through
+   * the slow path, which copies them first.
+   */
+  void map(uint16_t first, uint16_t last, Memory *memory);
+
+  /**
+   * Maps pages of every Memory mapped on the bus again, after pages were
+   * replaced by Memory::load() or shared by a fork.
+   */
+  void remap();
+
+  /**
+   * Route accesses to pages in range [first, last] to the device.
+   */
+  void map(uint16_t first, uint16_t last, Device *device);
+
+  /**
+   * Remove mapping of pages in range [first, last]. Reads from unmapped
+   * pages return 0 and writes are ignored.
+   */
+  void unmap(uint16_t first, uint16_t last);
+
+  /**
+   * @return Memory backing page for reads, nullptr if page is not memory.
+   */
+  const uint8_t *memory(uint8_t page) const { return m_read_pages[page]; }
+
+  /**
+   * @return Master clock before which reads of address return the same value
+   * without side effects, see Device::stable_until(). Memory only changes when
+   * written, so it is stable forever.
+   */
+  uint64_t stable_until(uint16_t address) const;
+
+  /**
+   * @return Version of page. It changes whenever page is remapped or its
+   * memory is written while watched.
+   */
+  uint32_t version(uint8_t page) const { return m_versions[page]; }
+
+  /**
+   * @return true if page is backed by writable memory.
+   */
+  bool writable(uint8_t page) const {
+    return m_write_pages[page] || m_watched[page];
+  }
+
+  /**
+   * Route next write to writable memory behind page through the slow path,
+   * which bumps version of every page mapping that memory. Used to detect
+   * writes to code decoded from RAM.
+   */
+  void watch(uint8_t page);
+
+  /// @return 2KB internal RAM.
+  Memory &ram() { return m_ram; }
+  const Memory &ram() const { return m_ram; }
+
+  /// Page table for reads, used by the recompiler.
+  uint8_t *const *read_pages() const { return m_read_pages; }
+
+  /// Page table for writes, used by the recompiler.
+  uint8_t *const *write_pages() const { return m_write_pages; }
+
+  /// Versions of all pages, used by the recompiler.
+  const uint32_t *versions() const { return m_versions; }
+
+  /// Number of bytes in one page.
+  static constexpr size_t page_size = 0x100;
+
+  /// Number of pages in address space.
+  static constexpr size_t page_count = 0x100;
+
+  static_assert(page_size == Memory::page_size,
+                "pages of Memory are pages of the bus");
+
 private:
-  uint8_t m_ram[0xffff];
+  /// Backing memory of each page for reads, nullptr if page is not memory.
+  uint8_t *m_read_pages[page_count];
+
+  /// Backing memory of each page for writes, nullptr if page is read only or
+  /// not memory.
+  uint8_t *m_write_pages[page_count];
+
+  /// Device handling the page, nullptr if page is not a device. Read only
+  /// memory pages may route writes to a device too.
+  Device *m_devices[page_count];
+
+  /// Version of each page, see version().
+  uint32_t m_versions[page_count];
+
+  /// true if writes to memory of the page are routed through the slow path.
+  bool m_watched[page_count];
+
+  /// Memory mapped to each page and index of its page mapped, nullptr if the
+  /// page is not mapped to a Memory.
+  Memory *m_memories[page_count];
+  uint8_t m_memory_pages[page_count];
+
+  /// 2KB internal RAM, mirrored to $0000-$1FFF.
+  Memory m_ram;
+
+  /**
+   * Points page at its page of Memory, writable unless it is shared.
+   */
+  void map_memory(size_t page);
+
+  /// Slow path of read() for pages which are not backed by memory.
+  uint8_t read_device(uint16_t address) const;
+
+  /// Slow path of write() for pages which are not writable memory or are
+  /// watched.
+  void write_device(uint16_t address, uint8_t data);
 };
+
+// read() and write() are defined here so that page table lookup is inlined
+// into the cpu, only device accesses leave the fast path.
+
+inline uint8_t Bus::read(uint16_t address) const {
+  const uint8_t *page = m_read_pages[address >> 8];
+  if (page)
+    return page[address & 0xff];
+  return read_device(address);
+}
+
+inline void Bus::write(uint16_t address, uint8_t data) {
+  uint8_t *page = m_write_pages[address >> 8];
+  if (page)
+    page[address & 0xff] = data;
+  else
+    write_device(address, data);
+}
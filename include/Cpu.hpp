@@ -1,21 +1,40 @@
 #pragma once
 
 #include "Bus.hpp"
+#include "HotSpots.hpp"
+#include "Scheduler.hpp"
 
+#ifdef NES_PROFILE
+#include "Profiler.hpp"
+#endif
+
+#include <bitset>
+#include <cstddef>
 #include <cstdint>
-#include <string>
-#include <vector>
+#include <limits>
+#include <memory>
+
+class BlockCache;
+class IdleLoop;
+class Jit;
+class Trace;
 
 /**
  * Cpu class emulates behaviour of 6502 processor used in NES.
  */
-class Cpu {
+class Cpu : private Scheduler::Handler {
 public:
   Cpu(Bus *bus);
+  ~Cpu();
 
   void log() const;
 
-  static void test();
+  /**
+   * Runs a few instructions, logging the registers, then the checks of the
+   * stack frames of interrupts.
+   * @return false if a check failed.
+   */
+  static bool test();
 
   /**
    * Falg bit in processor status register.
@@ -31,21 +50,315 @@ public:
     negative = (1 << 7)
   };
 
+  /**
+   * Source driving the interrupt request line, the line is asserted while
+   * any source asserts it.
+   */
+  enum IrqSource : uint8_t {
+    irq_event = (1 << 0),
+    irq_mapper = (1 << 1),
+    irq_frame_counter = (1 << 2),
+    irq_dmc = (1 << 3)
+  };
+
+  /**
+   * Operation performed by an instruction, indexes s_operations.
+   */
+  enum class Operation : uint8_t {
+    KIL, AND, ORA, EOR, ADC, SBC, CMP, CPX, CPY, DEC, DEX, DEY,
+    INC, INX, INY, ASL, ROL, LSR, ROR, LDA, STA, LDX, STX, LDY,
+    STY, TAX, TXA, TAY, TYA, TSX, TXS, PLA, PHA, PLP, PHP, BPL,
+    BMI, BVC, BVS, BCC, BCS, BNE, BEQ, BRK, RTI, JSR, RTS, JMP,
+    BIT, CLC, SEC, CLD, SED, CLI, SEI, CLV, NOP, ASL_A, ROL_A, LSR_A,
+    ROR_A,
+    count
+  };
+
+  /**
+   * Addressing mode used by an instruction, indexes s_addressing_modes.
+   */
+  enum class Addressing : uint8_t {
+    implicit,
+    immediate,
+    absolute,
+    zero_page,
+    relative,
+    absolute_x,
+    absolute_y,
+    zero_page_x,
+    zero_page_y,
+    indirect,
+    indexed_indirect,
+    indirect_indexed,
+    count
+  };
+
+  /**
+   * Entry of the opcode table. Handlers are stored as indices so the whole
+   * table is plain data built at compile time and shared by every instance.
+   */
   struct Instruction {
-    std::string opcode;
-    uint8_t (Cpu::*exec)(void) = nullptr;
-    uint8_t (Cpu::*addressing)(void) = nullptr;
+    Operation operation;
+    Addressing addressing;
+    uint8_t cycles;
+  };
+
+  /**
+   * Instruction decoded ahead of execution, see BlockCache.
+   */
+  struct Decoded {
+    uint8_t opcode;
+    Operation operation;
+    Addressing addressing;
+    /// Length of instruction in bytes including the opcode.
+    uint8_t length;
+    /// Cycles taken without page crossing penalties.
     uint8_t cycles;
+    /// Operand assembled from instruction bytes. Holds address of the operand
+    /// for immediate addressing and sign extended offset for relative
+    /// addressing.
+    uint16_t operand;
   };
 
+  /// Set of program counter values run_until() stops at.
+  using Breakpoints = std::bitset<0x10000>;
+
   /**
    * Function executes instruction pointed by the program counter.
    */
   void tick();
 
-private:
+  /**
+   * Executes one whole instruction pointed by the program counter.
+   * @return Number of cycles taken by the instruction.
+   */
+  uint8_t step();
+
+  /**
+   * Executes whole instructions until at least cycles have elapsed.
+   * Cycles left over from an instruction started by tick() are counted first.
+   * With NES_JIT hot blocks are executed as translated host code.
+   * @return Number of cycles consumed, overshoots cycles by at most the length
+   * of the last instruction.
+   */
+  uint64_t run(uint64_t cycles);
+
+  /**
+   * Executes whole instructions until the master clock reaches time or the
+   * cpu halts. Instructions run back to back up to the next deadline of the
+   * scheduler, then due events are dispatched and pending interrupts are
+   * taken.
+   * @return Number of cycles consumed, overshoots time by at most the length
+   * of the last instruction or interrupt.
+   */
+  uint64_t run_to(uint64_t time);
+
+  /**
+   * Resets the cpu: continues at address in reset vector $FFFC with interrupts
+   * disabled.
+   */
+  void reset();
+
+  /**
+   * Signals non maskable interrupt, taken before the next instruction executed
+   * by run_to().
+   */
+  void nmi();
+
+  /**
+   * Sets level source drives the interrupt request line with. While any source
+   * asserts it the interrupt is taken before the next instruction executed by
+   * run_to() unless interrupt disable flag is set.
+   */
+  void irq(bool asserted, IrqSource source = irq_event);
+
+  /**
+   * @return Master clock, number of cycles of all instructions and
+   * interrupts started since power on.
+   */
+  uint64_t clock() const { return m_clock; }
+
+  /**
+   * Suspends the cpu for cycles by advancing the master clock, called by
+   * devices during an instruction, e.g. while OAM DMA takes over the bus.
+   */
+  void stall(uint64_t cycles) { m_clock += cycles; }
+
+  /// @return Scheduler of events on the master clock.
+  Scheduler &scheduler() { return m_scheduler; }
+
+  /**
+   * Saves registers, master clock, pending interrupts and deadlines of the
+   * scheduler.
+   */
+  void save(state::Writer &state) const;
+
+  /**
+   * Loads state saved by save(). Cached and translated code stays valid, it
+   * is checked against versions of the pages of the bus.
+   */
+  void load(state::Reader &state);
+
+  /**
+   * Executes whole instructions until done(*this) returns true after an
+   * instruction, the cpu halts or at least cycles have elapsed.
+   * @return Number of cycles consumed.
+   */
+  template <typename Predicate>
+  uint64_t run_until(Predicate done,
+                     uint64_t cycles = std::numeric_limits<uint64_t>::max());
+
+  /**
+   * Executes whole instructions until program counter reaches one of the
+   * breakpoints, the cpu halts or at least cycles have elapsed.
+   * @return Number of cycles consumed.
+   */
+  uint64_t run_until(const Breakpoints &breakpoints,
+                     uint64_t cycles = std::numeric_limits<uint64_t>::max());
+
+  /**
+   * Enables or disables cache of pre-decoded blocks. While enabled
+   * instructions in memory pages are fetched and decoded once per block
+   * instead of once per execution.
+   */
+  void set_block_cache(bool enabled);
+
+  /**
+   * Enables or disables skipping of loops waiting for an event, see IdleLoop.
+   * Enabled by default, run_to() gives the same results either way.
+   */
+  void set_idle_loops(bool enabled);
+
+  /// @return Current value of the program counter.
+  uint16_t pc() const { return m_pc; }
+
+  /// @return Current value of the stack pointer.
+  uint8_t stack_pointer() const { return m_s; }
+
+  /**
+   * Sets profiler the cpu reports calls and returns to, nullptr to stop, see
+   * HotSpots.
+   */
+  void set_hot_spots(HotSpots *hot_spots) { m_hot_spots = hot_spots; }
+
+  /**
+   * Sets trace every instruction is recorded to before it executes, nullptr
+   * to stop. While tracing, instructions run in the interpreter and idle
+   * loops are not skipped, so none is missing from the trace.
+   */
+  void set_trace(Trace *trace) { m_trace = trace; }
+
+  /// @return true if the cpu executed KIL.
+  bool halted() const { return m_halt; }
+
+  /**
+   * @return Mnemonic of the instruction encoded by opcode.
+   */
+  static const char *mnemonic(uint8_t opcode);
+
+  /**
+   * @return Name of addressing mode, e.g. indirect_indexed.
+   */
+  static const char *addressing_name(Addressing addressing);
+
+#ifdef NES_PROFILE
+  /// @return Counters of instructions executed by the interpreter.
+  Profiler &profiler() { return m_profiler; }
+  const Profiler &profiler() const { return m_profiler; }
+#endif
+
   /// Array contains mapping of intruction and addressing mode.
-  std::vector<Instruction> m_lookup;
+  static const Instruction s_lookup[256];
+
+private:
+  /// Handlers indexed by Operation.
+  static uint8_t (Cpu::*const s_operations[(size_t)Operation::count])(void);
+
+  /// Handlers indexed by Addressing.
+  static uint8_t (Cpu::*const s_addressing_modes[(size_t)Addressing::count])(
+      void);
+
+  /**
+   * Checks that BRK and interrupts push their frame on page 1, high order
+   * byte of program counter first, and that RTI returns through it.
+   * @return false if a check failed.
+   */
+  static bool test_interrupts();
+
+#ifdef NES_JIT
+  /**
+   * Runs a self modifying program through the interpreter and through the
+   * recompiler with budgets ending mid block, comparing registers, memory and
+   * clock after each run.
+   * @return false if they differ.
+   */
+  static bool test_jit();
+#endif
+
+  /**
+   * Executes instruction m_opcode.
+   * With NES_FUSED_CORE every opcode is dispatched through a switch to its own
+   * specialised handler, otherwise handlers are called through the tables.
+   * @return Number of cycles taken by the instruction.
+   */
+  uint8_t execute();
+
+  /**
+   * Handler specialised for single opcode, used by NES_FUSED_CORE.
+   */
+  template <uint8_t opcode> uint8_t execute();
+
+  /**
+   * Handler specialised for single pre-decoded opcode, used by
+   * NES_FUSED_CORE.
+   */
+  template <uint8_t opcode> uint8_t execute(uint16_t operand);
+
+  /**
+   * Executes pre-decoded instruction.
+   * @return Number of cycles taken by the instruction.
+   */
+  uint8_t execute(const Decoded &instruction);
+
+  /**
+   * Records the instruction about to execute to m_trace.
+   */
+  void trace();
+
+  /**
+   * Computes effective address of pre-decoded operand.
+   * @return Number of extra cycles.
+   */
+  uint8_t resolve(Addressing addressing, uint16_t operand);
+
+  /**
+   * Adds index to effective address.
+   * @return 1 if page is crossed.
+   */
+  uint8_t index_address(uint8_t index);
+
+  /**
+   * @return Little endian pointer stored at zero page address, wraps around
+   * page 0.
+   */
+  uint16_t read_pointer(uint8_t address);
+
+  /// Cache of pre-decoded blocks, nullptr if disabled.
+  std::unique_ptr<BlockCache> m_block_cache;
+
+  /// Detector of idle loops used by run_to(), nullptr if disabled.
+  std::unique_ptr<IdleLoop> m_idle_loop;
+
+#ifdef NES_JIT
+  friend class Jit;
+
+  /// Recompiler used by run(), created on first use.
+  std::unique_ptr<Jit> m_jit;
+#endif
+
+#ifdef NES_PROFILE
+  Profiler m_profiler;
+#endif
 
   /// Context of bus.
   Bus *m_bus;
@@ -62,9 +375,26 @@ private:
   /// Program counter.
   uint16_t m_pc;
 
-  /// Processor status register.
+  /**
+   * Processor status register. Only interrupt disable, decimal mode, break
+   * command and unused bits are kept here, N, Z, C and V live in m_nz, m_carry
+   * and m_overflow until status() merges them back.
+   */
   uint8_t m_p;
 
+  /**
+   * Last result which N and Z are derived from: Z is set if the low byte is 0,
+   * N if bit 7 or bit 8 is set. Bit 8 allows both flags to be restored from a
+   * pulled status register.
+   */
+  uint16_t m_nz;
+
+  /// Carry flag, 0 or 1.
+  uint8_t m_carry;
+
+  /// Overflow flag.
+  bool m_overflow;
+
   /// holds effective address of the data, simulates behaviour of ADH and ADL.
   uint16_t m_effective_address;
 
@@ -79,6 +409,36 @@ private:
 
   uint8_t m_cycles;
 
+  /// Master clock.
+  uint64_t m_clock;
+
+  /// Deadline run_to() executes instructions up to.
+  uint64_t m_deadline;
+
+  Scheduler m_scheduler;
+
+  /// Pending non maskable interrupt.
+  bool m_nmi;
+
+  /// Sources asserting interrupt request line, a mask of IrqSource.
+  uint8_t m_irq;
+
+  /// Profiler of calls, nullptr if none.
+  HotSpots *m_hot_spots;
+
+  /// Trace of instructions, nullptr if none.
+  Trace *m_trace;
+
+  /**
+   * Takes pending interrupt, if any.
+   */
+  void interrupt();
+
+  /**
+   * Handles nmi and irq events of the scheduler.
+   */
+  void handle(Scheduler::Event event, uint64_t time) override;
+
   /**
    * Function to set flag value to value in processor status register.
    * @param flag Specify flag to modify.
@@ -91,6 +451,21 @@ private:
    */
   uint8_t get_flag(Flag flag) const;
 
+  /**
+   * Sets N and Z from result.
+   */
+  void set_nz(uint8_t result) { m_nz = result; }
+
+  /**
+   * @return Processor status register with N, Z, C and V evaluated.
+   */
+  uint8_t status() const;
+
+  /**
+   * Loads the processor status register, e.g. when pulled from the stack.
+   */
+  void set_status(uint8_t p);
+
   /**
    * Push one byte of data onto the stack.
    */
@@ -292,27 +667,42 @@ private:
    */
   uint8_t INY();
 
+  /**
+   * Source and destination of read-modify-write shift and rotate operations.
+   */
+  enum class Operand { accumulator, memory };
+
+  /**
+   * @return Operand of shift or rotate instruction.
+   */
+  template <Operand operand> uint8_t load_operand();
+
+  /**
+   * Write back result of shift or rotate instruction.
+   */
+  template <Operand operand> void store_operand(uint8_t data);
+
   /**
    * Shift the contnet of accumulator or memory location to left by one bit. 7th
    * bit is stored in carry flag.
    *
    */
-  uint8_t ASL();
+  template <Operand operand> uint8_t ASL();
 
   /**
    * Rotate content of accumulator or memory to left.
    */
-  uint8_t ROL();
+  template <Operand operand> uint8_t ROL();
 
   /**
    * Shit content of accumulator or memory to right.
    */
-  uint8_t LSR();
+  template <Operand operand> uint8_t LSR();
 
   /**
    * Rotate content of accumulator or memory to right.
    */
-  uint8_t ROR();
+  template <Operand operand> uint8_t ROR();
 
   /**
    * Load data from memory to accumulator.
@@ -512,3 +902,17 @@ private:
    */
   uint8_t NOP();
 };
+
+template <typename Predicate>
+uint64_t Cpu::run_until(Predicate done, uint64_t cycles) {
+  // finish the instruction started by tick() first.
+  uint64_t elapsed = m_cycles;
+  m_cycles = 0;
+
+  while (elapsed < cycles && !m_halt) {
+    elapsed += step();
+    if (done(*this))
+      break;
+  }
+  return elapsed;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Receives frames rendered by the PPU in buffers owned by the caller.
+ *
+ * The PPU renders every scanline straight into the back buffer, so frames are
+ * never copied: in index format palette indices are composed in place, in
+ * RGBA format each line is expanded through the RGB palette once. Buffers
+ * rotate when vertical blank starts. With two buffers the front buffer may be
+ * read between calls running the emulator, with three buffers acquire() may
+ * be called from another thread while the emulator runs.
+ */
+class FrameSink {
+public:
+  enum class Format : uint8_t {
+    /// 1 byte per pixel, index into the 64 colors of the NES palette.
+    index,
+    /// 4 bytes per pixel, red, green, blue and alpha.
+    rgba
+  };
+
+  static constexpr size_t width = 256;
+  static constexpr size_t height = 240;
+
+  /**
+   * @param buffers count buffers of frame_size(format) bytes, owned by the
+   * caller and must outlive the sink.
+   * @param count 2 for double buffering or 3 for triple buffering.
+   */
+  FrameSink(Format format, uint8_t *const *buffers, size_t count);
+
+  FrameSink(const FrameSink &) = delete;
+  FrameSink &operator=(const FrameSink &) = delete;
+
+  /// @return Bytes per pixel of format.
+  static size_t pixel_size(Format format) {
+    return format == Format::rgba ? 4 : 1;
+  }
+
+  /// @return Bytes of a frame in format.
+  static size_t frame_size(Format format) {
+    return width * height * pixel_size(format);
+  }
+
+  Format format() const { return m_format; }
+
+  /**
+   * Sets the colors RGBA frames are rendered with, 64 entries of red, green
+   * and blue in bits 16-23, 8-15 and 0-7.
+   */
+  void set_palette(const uint32_t *palette);
+
+  /**
+   * @return Latest completed frame, it stays valid until the next call with
+   * triple buffering or until the next frame completes with double buffering.
+   */
+  const uint8_t *acquire();
+
+  /// @return Number of frames completed.
+  uint64_t frame_count() const { return m_frame_count; }
+
+  /**
+   * @return Memory the PPU renders palette indices of line y into, passed to
+   * end_line() when done.
+   */
+  uint8_t *begin_line(size_t y) {
+    if (m_format == Format::index)
+      return m_buffers[m_back] + y * width;
+    return m_line;
+  }
+
+  /**
+   * Completes line y rendered into memory returned by begin_line().
+   */
+  void end_line(size_t y) {
+    if (m_format == Format::rgba)
+      expand(y);
+  }
+
+  /**
+   * Completes the back buffer, making it the latest frame.
+   */
+  void end_frame();
+
+private:
+  /**
+   * Expands palette indices in m_line to RGBA colors of line y.
+   */
+  void expand(size_t y);
+
+  Format m_format;
+
+  uint8_t *m_buffers[3];
+  size_t m_count;
+
+  /// Buffers being rendered and being read.
+  size_t m_back, m_front;
+
+  /// Latest completed buffer of triple buffering, fresh is set until it is
+  /// acquired.
+  std::atomic<uint8_t> m_ready;
+  static constexpr uint8_t fresh = 0x80;
+
+  std::atomic<uint64_t> m_frame_count;
+
+  /// RGBA of each palette index, in memory order.
+  uint32_t m_colors[64];
+
+  /// Palette indices of the line being rendered in RGBA format.
+  uint8_t m_line[width];
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "Scheduler.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <vector>
+
+class Cpu;
+
+/**
+ * HotSpots class profiles where the emulated program spends its time: it
+ * samples the program counter of the cpu and the call stack leading to it.
+ *
+ * Samples are taken by an event of the scheduler of the cpu, at random
+ * intervals averaging interval cycles, so instructions run at full speed
+ * between samples. The cpu reports JSR, BRK and interrupts as calls, a
+ * frame returns once the stack pointer rises above the return address it
+ * pushed. Frames left by code unwinding the stack on its own, e.g. with TXS
+ * or by pulling the return address, are dropped the same way.
+ *
+ * Samples are appended to a buffer and only folded into counts per call
+ * stack once it is full, so a sample touches little memory the emulator
+ * evicted from the cache. Stacks are written as folded stacks, one line per
+ * distinct stack with its sample count, the input of flamegraph tools. Only
+ * run_to() dispatches the sampling event.
+ */
+class HotSpots : private Scheduler::Handler {
+public:
+  /// Kind of a frame of the call stack.
+  enum class Call : uint8_t { subroutine, nmi, irq, brk };
+
+  /**
+   * Starts profiling cpu.
+   * @param interval Mean cycles between samples.
+   */
+  explicit HotSpots(Cpu *cpu, uint64_t interval = 2000);
+
+  /**
+   * Stops profiling.
+   */
+  ~HotSpots() override;
+
+  HotSpots(const HotSpots &) = delete;
+  HotSpots &operator=(const HotSpots &) = delete;
+
+  /**
+   * Called by the cpu after it entered code at address, s is the stack
+   * pointer below the return address.
+   */
+  void call(Call call, uint16_t address, uint8_t s) {
+    if (m_stack.size() < max_depth)
+      m_stack.push_back({address, s, call});
+  }
+
+  /**
+   * Called by the cpu after it moved the stack pointer up to s, returning
+   * from the frames whose return address is above it.
+   */
+  void unwind(uint8_t s) {
+    while (!m_stack.empty() && m_stack.back().s < s)
+      m_stack.pop_back();
+  }
+
+  /// @return Number of samples taken.
+  uint64_t samples() const { return m_samples; }
+
+  /// @return Samples taken with the program counter at address.
+  uint64_t count(uint16_t address) const {
+    fold();
+    return m_counts[address];
+  }
+
+  /**
+   * Drops every sample.
+   */
+  void clear();
+
+  /**
+   * Writes a line per distinct call stack sampled: frames from the outermost
+   * separated by semicolons, ending with the program counter sampled, then
+   * the number of samples.
+   */
+  void write_folded(std::FILE *out) const;
+
+  /// Frames kept, deeper calls are attributed to the deepest frame kept.
+  static constexpr size_t max_depth = 64;
+
+private:
+  struct Frame {
+    /// Address the call entered.
+    uint16_t address;
+
+    /// Stack pointer below the return address.
+    uint8_t s;
+
+    Call call;
+  };
+
+  /**
+   * Takes a sample and schedules the next one.
+   */
+  void handle(Scheduler::Event event, uint64_t time) override;
+
+  /**
+   * Adds buffered samples to the counts.
+   */
+  void fold() const;
+
+  /**
+   * @return Cycles until the next sample, uniform in [interval / 2,
+   * interval * 3 / 2] so that samples do not alias with loops or frames.
+   */
+  uint64_t next_interval();
+
+  Cpu *m_cpu;
+  uint64_t m_interval;
+  uint32_t m_random;
+
+  /// Calls the cpu is in, from the outermost.
+  std::vector<Frame> m_stack;
+
+  uint64_t m_samples;
+
+  /// Samples not folded yet, each the number of its frames, the frames and
+  /// the program counter, encoded as in the keys of m_stacks.
+  mutable std::vector<uint32_t> m_pending;
+
+  /// Entries of m_pending folded at once.
+  static constexpr size_t pending_capacity = 1 << 14;
+
+  /// Samples per program counter.
+  mutable std::vector<uint64_t> m_counts;
+
+  /// Samples per call stack, keyed by kinds and addresses of its frames and
+  /// the program counter.
+  mutable std::map<std::vector<uint32_t>, uint64_t> m_stacks;
+
+  /// Key of the stack being folded, reused to avoid allocations.
+  mutable std::vector<uint32_t> m_key;
+};
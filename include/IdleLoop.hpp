@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Bus.hpp"
+#include "Cpu.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Detects loops polling memory or registers for a change that only comes
+ * with a later event, e.g. LDA $2002 / BPL waiting for vertical blank, and
+ * skips their iterations.
+ *
+ * A loop qualifies when its body, at most max_length instructions in one
+ * page, is straight line code ending with a branch or JMP back to its first
+ * instruction, reads memory only at fixed addresses and writes neither
+ * memory nor the stack. Conditional branches leaving the body are allowed. No
+ * register or flag may be read before it is written if the body writes it,
+ * so every iteration leaves the cpu in the state determined by the values it
+ * read alone.
+ *
+ * When an iteration ends with every value it reads stable, see
+ * Bus::stable_until(), the next iteration reads the same values and leaves
+ * the cpu in a state no later iteration changes. Iterations after it up to
+ * the next deadline of the scheduler or the next change of a value read are
+ * skipped by advancing the master clock only, which is all they would have
+ * done.
+ */
+class IdleLoop {
+public:
+  explicit IdleLoop(Bus *bus);
+
+  /**
+   * Called after the cpu jumped back to pc, ending an iteration at clock if
+   * pc starts a loop.
+   * @param deadline Time of the next event, which the loop waits for.
+   * @return Cycles of whole iterations ending by deadline the cpu can skip, 0
+   * if pc does not start an idle loop or it has not settled yet.
+   */
+  uint64_t skip(uint16_t pc, uint64_t clock, uint64_t deadline) {
+    // most jumps go back to loops doing work, rejected without a call, as
+    // are jumps with an interrupt pending.
+    const Loop &loop = m_loops[pc % loop_count];
+    if (clock >= deadline || (loop.decoded && !loop.idle && loop.pc == pc &&
+                              loop.version == m_bus->version(pc >> 8))) {
+      m_settling = false;
+      return 0;
+    }
+    return settle(pc, clock, deadline);
+  }
+
+  /**
+   * Forgets the last iteration, called when the cpu is interrupted or its
+   * state is replaced.
+   */
+  void reset() { m_settling = false; }
+
+  /// Maximum number of instructions in the body of a loop.
+  static constexpr size_t max_length = 8;
+
+  /// Number of loops held by the cache.
+  static constexpr size_t loop_count = 64;
+
+private:
+  struct Loop {
+    /// Address of the first instruction.
+    uint16_t pc;
+    /// Page holding the loop.
+    uint8_t page;
+    /// true once the code at pc was analyzed.
+    bool decoded;
+    /// true if the code at pc is an idle loop.
+    bool idle;
+    /// Number of addresses in reads.
+    uint8_t read_count;
+    /// Version of the page when the loop was analyzed.
+    uint32_t version;
+    /// Cycles of one iteration.
+    uint32_t period;
+    /// Addresses read by an iteration.
+    uint16_t reads[max_length];
+  };
+
+  /**
+   * Slow path of skip(), analyzes the code at pc first if needed.
+   */
+  uint64_t settle(uint16_t pc, uint64_t clock, uint64_t deadline);
+
+  /**
+   * Analyzes code at pc into loop.
+   */
+  void analyze(Loop &loop, uint16_t pc);
+
+  /// @return Master clock before which every value read by loop is stable.
+  uint64_t stable_until(const Loop &loop) const;
+
+  /// Context of bus.
+  Bus *m_bus;
+
+  Loop m_loops[loop_count];
+
+  /// Set when an iteration of the loop at m_pc ended at m_clock with every
+  /// value it reads stable before m_until.
+  bool m_settling;
+  uint16_t m_pc;
+  uint64_t m_clock;
+  uint64_t m_until;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Apu.hpp"
+#include "Bus.hpp"
+#include "Cpu.hpp"
+#include "Ppu.hpp"
+#include "State.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Registers of the 2A03 at $4000-$401F: OAM DMA and the two standard
+ * controllers, registers of the APU are passed on to it.
+ */
+class Io : public Device {
+public:
+  /// Buttons of a standard controller, in the order they are shifted out.
+  enum Button : uint8_t {
+    a = 1 << 0,
+    b = 1 << 1,
+    select = 1 << 2,
+    start = 1 << 3,
+    up = 1 << 4,
+    down = 1 << 5,
+    left = 1 << 6,
+    right = 1 << 7
+  };
+
+  /**
+   * Maps the registers at $4000-$40FF.
+   */
+  Io(Bus *bus, Cpu *cpu, Ppu *ppu, Apu *apu);
+
+  /**
+   * Unmaps the registers.
+   */
+  ~Io() override;
+
+  Io(const Io &) = delete;
+  Io &operator=(const Io &) = delete;
+
+  uint8_t read(uint16_t address) override;
+
+  void write(uint16_t address, uint8_t data) override;
+
+  /**
+   * Sets buttons held on controller in port 0 or 1, a mask of Button.
+   */
+  void set_buttons(size_t port, uint8_t buttons) { m_buttons[port] = buttons; }
+
+  /// Saves buttons held and shift registers of the controllers.
+  void save(state::Writer &state) const;
+
+  void load(state::Reader &state);
+
+  /// Cycles the cpu is stalled by OAM DMA, one more on odd cycles.
+  static constexpr uint64_t dma_cycles = 513;
+
+private:
+  /**
+   * Copies page of cpu address space to OAM, stalling the cpu.
+   */
+  void dma(uint8_t page);
+
+  /// Context of bus.
+  Bus *m_bus;
+
+  /// Cpu stalled by OAM DMA.
+  Cpu *m_cpu;
+
+  /// PPU receiving OAM DMA.
+  Ppu *m_ppu;
+
+  /// APU handling its own registers.
+  Apu *m_apu;
+
+  /// Buttons held on each controller.
+  uint8_t m_buttons[2];
+
+  /// Shift register of each controller, reloaded from m_buttons while strobe
+  /// is set.
+  uint8_t m_shift[2];
+
+  /// Bit 0 of the last write to $4016.
+  bool m_strobe;
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "Bus.hpp"
+#include "Cpu.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Dynamic recompiler translating basic blocks of 6502 code to x86-64.
+ *
+ * Blocks are translated on first execution, never span more than one page and
+ * end at the first instruction which changes the program counter or is not
+ * supported by the recompiler. Translated code keeps A, X, Y and P in host
+ * registers and accesses memory pages through the page table of the bus, only
+ * device and watched pages call back into Bus.
+ *
+ * Blocks are revalidated against version of their page like BlockCache. A
+ * block whose page keeps being written is left to the interpreter.
+ */
+class Jit {
+public:
+  Jit(Bus *bus);
+  ~Jit();
+
+  Jit(const Jit &) = delete;
+  Jit &operator=(const Jit &) = delete;
+
+  /**
+   * Executes translated block at program counter of the cpu if it can not take
+   * more than cycles.
+   * @return Number of cycles consumed, 0 if no block was executed.
+   */
+  uint64_t execute(Cpu &cpu, uint64_t cycles);
+
+  /**
+   * State of the cpu shared with translated code.
+   */
+  struct State {
+    uint8_t a, x, y, s, p;
+    /// Last executed opcode.
+    uint8_t opcode;
+    uint16_t pc;
+    /// Cycles taken by the block.
+    uint32_t cycles;
+    /// Cycles taken by the block before the instruction accessing memory.
+    uint32_t start;
+    /// Master clock of the cpu when block was entered.
+    uint64_t clock;
+    /// Master clock of the cpu, kept current while devices are accessed.
+    uint64_t *cpu_clock;
+    uint8_t *const *read_pages;
+    uint8_t *const *write_pages;
+    const uint32_t *versions;
+    Bus *bus;
+    /// Deadline of the cpu, lowered by events scheduled while devices are
+    /// accessed.
+    const uint64_t *deadline;
+  };
+
+  /// Size of memory reserved for translated code.
+  static constexpr size_t code_size = 1 << 20;
+
+  /// Number of blocks held by the recompiler.
+  static constexpr size_t block_count = 4096;
+
+  /// Maximum number of instructions in one block.
+  static constexpr size_t max_block_length = 32;
+
+private:
+  struct Block {
+    /// Address of the first instruction.
+    uint16_t pc;
+    /// Page holding the block.
+    uint8_t page;
+    /// Number of times translation was invalidated by writes to the page.
+    uint8_t invalidations;
+    /// Version of the page when block was translated.
+    uint32_t version;
+    /// Worst case number of cycles taken by the block.
+    uint32_t cycles;
+    /// Translated code, nullptr if block is left to the interpreter.
+    void (*code)(State *);
+  };
+
+  /**
+   * Translates block starting at pc into block.
+   */
+  void translate(Block &block, uint16_t pc);
+
+  /// Context of bus.
+  Bus *m_bus;
+
+  /// Executable memory holding translated code.
+  uint8_t *m_code;
+
+  /// Number of bytes of m_code in use.
+  size_t m_code_used;
+
+  Block m_blocks[block_count];
+};
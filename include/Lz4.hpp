@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Compressor of the LZ4 block format: sequences of literals followed by a
+ * match of at least 4 bytes within the previous 64KB. Compression is greedy
+ * with a single hash table probe per position, fast enough to keep up with
+ * data produced at emulation speed rather than compressing best.
+ */
+namespace lz4 {
+
+/// @return Maximum compressed size of size bytes.
+constexpr size_t bound(size_t size) { return size + size / 255 + 16; }
+
+/**
+ * Compresses size bytes of in into out, which holds at least bound(size)
+ * bytes.
+ * @return Compressed size.
+ */
+size_t compress(const uint8_t *in, size_t size, uint8_t *out);
+
+/**
+ * Decompresses size bytes of in into out, which holds capacity bytes.
+ * @return Decompressed size, or capacity + 1 if in is malformed or does not
+ * fit.
+ */
+size_t decompress(const uint8_t *in, size_t size, uint8_t *out,
+                  size_t capacity);
+
+/**
+ * Checks that inputs shorter than a match, incompressible and matched at
+ * offsets shorter than the match decompress to themselves, and that
+ * truncated blocks are rejected.
+ * @return false if a check failed.
+ */
+bool test();
+
+} // namespace lz4
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "Bus.hpp"
+#include "Memory.hpp"
+#include "Rom.hpp"
+#include "State.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class Cpu;
+
+/**
+ * Cartridge hardware selecting which banks of PRG and CHR memory the console
+ * sees.
+ *
+ * Banks are selected by pointing pages of the bus at $6000-$FFFF and 1KB
+ * pages of the pattern tables straight into ROM or RAM. A bank switch never
+ * copies data and reads never go through the mapper, only writes to its
+ * registers overlaying PRG-ROM reach it as a Device.
+ *
+ * CHR memory is also kept decoded into rows of pixels, updated by writes to
+ * CHR-RAM, so switching banks switches decoded rows along with the memory.
+ */
+class Mapper : public Device {
+public:
+  /**
+   * Creates mapper of the cartridge and maps its memory on bus. rom must
+   * outlive the mapper.
+   * @param cpu Receives interrupt requests of the mapper.
+   * @param parent Mapper of the console forked from, if any. PRG-RAM is
+   * shared with it copy on write and decoded CHR-ROM is shared.
+   * @return nullptr if mapper of the cartridge is not supported.
+   */
+  static std::unique_ptr<Mapper> create(const Rom &rom, Bus *bus, Cpu *cpu,
+                                        const Mapper *parent = nullptr);
+
+  /**
+   * Unmaps memory of the cartridge from the bus.
+   */
+  ~Mapper() override;
+
+  Mapper(const Mapper &) = delete;
+  Mapper &operator=(const Mapper &) = delete;
+
+  /// PRG-ROM is never read through the mapper, open bus reads as 0.
+  uint8_t read(uint16_t address) override;
+
+  /// Writes to registers, ignored by mappers without registers.
+  void write(uint16_t address, uint8_t data) override;
+
+  /**
+   * Clocks scanline counter, called by the PPU once per rendered scanline.
+   */
+  virtual void scanline() {}
+
+  /**
+   * Saves CHR-RAM, selected banks and registers. Banks are saved as offsets,
+   * so no memory of the image is copied. PRG-RAM is saved separately.
+   */
+  virtual void save(state::Writer &state) const;
+
+  /**
+   * Loads state saved by save() and maps the saved banks again.
+   */
+  virtual void load(state::Reader &state);
+
+  /// @return true if the mapper counts scanlines, so the PPU has to clock
+  /// them on time.
+  virtual bool counts_scanlines() const { return false; }
+
+  /// @return Byte of pattern tables at address $0000-$1FFF.
+  uint8_t read_chr(uint16_t address) const {
+    return m_chr_pages[(address >> 10) & 7][address & 0x3FF];
+  }
+
+  /**
+   * Writes byte of pattern tables at address, ignored unless the cartridge
+   * has CHR-RAM.
+   */
+  void write_chr(uint16_t address, uint8_t data);
+
+  /**
+   * @return Row of 8 pixels of the tile at address of pattern tables, decoded
+   * by pixels::decode. Bit 3 of address is ignored.
+   */
+  uint64_t chr_row(uint16_t address) const {
+    return m_chr_row_pages[(address >> 10) & 7]
+                          [((address & 0x3F0) >> 1) | (address & 7)];
+  }
+
+  /// @return 1KB page of pattern tables holding address.
+  const uint8_t *chr_page(uint16_t address) const {
+    return m_chr_pages[(address >> 10) & 7];
+  }
+
+  /**
+   * @return Version of pattern tables. It changes whenever CHR banks are
+   * switched or CHR-RAM is written.
+   */
+  uint32_t chr_version() const { return m_chr_version; }
+
+  /// @return PRG-RAM mapped at $6000-$7FFF, empty if the cartridge has none.
+  Memory &prg_ram() { return m_prg_ram; }
+  const Memory &prg_ram() const { return m_prg_ram; }
+
+  /// @return Current nametable mirroring.
+  Rom::Mirroring mirroring() const { return m_mirroring; }
+
+  /// Size of a page of pattern tables.
+  static constexpr size_t chr_page_size = 0x400;
+
+protected:
+  Mapper(const Rom &rom, Bus *bus, Cpu *cpu, const Mapper *parent);
+
+  /**
+   * Maps PRG bank of size bytes at address. Negative banks count from the
+   * last bank.
+   */
+  void map_prg(uint16_t address, size_t size, int bank);
+
+  /**
+   * Maps CHR bank of size bytes at address of pattern tables. Negative banks
+   * count from the last bank.
+   */
+  void map_chr(uint16_t address, size_t size, int bank);
+
+  void set_mirroring(Rom::Mirroring mirroring) { m_mirroring = mirroring; }
+
+  const Rom &m_rom;
+
+  /// Context of bus.
+  Bus *m_bus;
+
+  /// Receives interrupt requests.
+  Cpu *m_cpu;
+
+private:
+  Memory m_prg_ram;
+
+  /// CHR-RAM, empty if the cartridge has CHR-ROM.
+  std::vector<uint8_t> m_chr_ram;
+
+  /// CHR-ROM or CHR-RAM.
+  uint8_t *m_chr;
+  size_t m_chr_size;
+
+  /// Memory of each 1KB page of pattern tables.
+  uint8_t *m_chr_pages[8];
+
+  /// Rows of pixels of m_chr, 8 per tile, shared by forks for CHR-ROM.
+  std::shared_ptr<std::vector<uint64_t>> m_chr_rows;
+
+  /// Decoded rows of each 1KB page of pattern tables.
+  const uint64_t *m_chr_row_pages[8];
+
+  uint32_t m_chr_version;
+
+  Rom::Mirroring m_mirroring;
+};
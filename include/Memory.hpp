@@ -0,0 +1,61 @@
+#pragma once
+
+#include "State.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * Writable memory made of pages of 256 bytes, the pages of the address space
+ * of the cpu, shared copy on write between forked consoles.
+ *
+ * Copying a Memory shares every page with the copy instead of copying the
+ * bytes. A page stays shared until either side is about to write it: own()
+ * gives the writer its own copy of that page only. The bus routes writes to
+ * shared pages through its slow path, which calls own().
+ */
+class Memory {
+public:
+  static constexpr size_t page_size = 0x100;
+
+  /// Creates size bytes of zeroed memory, size is a multiple of page_size.
+  explicit Memory(size_t size = 0);
+
+  /// Shares pages of other.
+  Memory(const Memory &other) = default;
+  Memory &operator=(const Memory &other) = default;
+
+  size_t size() const { return m_pages.size() * page_size; }
+
+  size_t page_count() const { return m_pages.size(); }
+
+  /// @return Bytes of page index for reads.
+  const uint8_t *page(size_t index) const { return m_pages[index]->data(); }
+
+  /// @return true if page index is shared with a fork, so it must not be
+  /// written in place.
+  bool shared(size_t index) const { return m_pages[index].use_count() > 1; }
+
+  /**
+   * Copies page index first if it is shared.
+   * @return Bytes of page index for writes.
+   */
+  uint8_t *own(size_t index);
+
+  /// Saves contents of every page.
+  void save(state::Writer &state) const;
+
+  /**
+   * Loads contents saved by save(). Shared pages are replaced by own copies,
+   * so mappings of the memory have to be updated, see Bus::remap().
+   */
+  void load(state::Reader &state);
+
+private:
+  using Page = std::array<uint8_t, page_size>;
+
+  std::vector<std::shared_ptr<Page>> m_pages;
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "Apu.hpp"
+#include "Bus.hpp"
+#include "Cpu.hpp"
+#include "FrameSink.hpp"
+#include "Io.hpp"
+#include "Mapper.hpp"
+#include "Ppu.hpp"
+#include "Rom.hpp"
+#include "State.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * Nes class wires the console together: cartridge, bus, cpu, PPU, APU and
+ * I/O registers.
+ *
+ * It runs headless, frames are only rendered into a FrameSink attached by the
+ * caller and samples are left in the ring buffer of the APU.
+ */
+class Nes {
+public:
+  /**
+   * Loads cartridge image at path and powers the console on.
+   * @param sample_rate Rate of audio samples produced by the APU.
+   * @return nullptr if the image can not be opened or its mapper is not
+   * supported.
+   */
+  static std::unique_ptr<Nes> open(const char *path,
+                                   uint32_t sample_rate = 48000);
+
+  /**
+   * Powers a console on with rom, an open image that may be shared by other
+   * consoles, so images are mapped once when running many of them.
+   * @return nullptr if the mapper of the image is not supported.
+   */
+  static std::unique_ptr<Nes> open(std::shared_ptr<Rom> rom,
+                                   uint32_t sample_rate = 48000);
+
+  Nes(const Nes &) = delete;
+  Nes &operator=(const Nes &) = delete;
+
+  /**
+   * Checks the console on small images written to temporary files: MMC3
+   * scanline interrupts, save states, rewind, forks and idle loops.
+   * @return false if a check failed.
+   */
+  static bool test();
+
+  /**
+   * Creates a console in the same state, for exploring another branch of
+   * execution. Internal RAM and PRG-RAM are shared page by page copy on
+   * write, the image and its decoded CHR-ROM are shared too. Only registers
+   * and memory of the PPU and APU are copied, so a fork costs about as much
+   * as the pages either side writes afterwards.
+   *
+   * The fork has no frame sink and an empty sample ring. The console must
+   * not run while it is forked, forks may then run on other threads.
+   * @return nullptr if the components of the fork can not be created.
+   */
+  std::unique_ptr<Nes> fork();
+
+  /**
+   * Presses the reset button.
+   */
+  void reset();
+
+  /**
+   * Runs until the PPU completes the current frame or the cpu halts. Audio
+   * samples up to there are moved to the ring buffer of the APU.
+   */
+  void run_frame();
+
+  /**
+   * Sets sink receiving rendered frames, nullptr to skip rendering output.
+   * The sink must outlive the console or be detached.
+   */
+  void set_frame_sink(FrameSink *sink) { m_ppu->set_sink(sink); }
+
+  /**
+   * Sets buttons held on controller in port 0 or 1, a mask of Io::Button.
+   */
+  void set_buttons(size_t port, uint8_t buttons) {
+    m_io->set_buttons(port, buttons);
+  }
+
+  /**
+   * Saves the state of the console into state, replacing its contents. The
+   * capacity of state is reused, so saving repeatedly into the same vector
+   * does not allocate. Memory of the image is not saved.
+   */
+  void save_state(std::vector<uint8_t> &state) const;
+
+  /**
+   * Restores state of size bytes saved by save_state().
+   * @return false, leaving the console unchanged, if state has another
+   * version, was saved with another image or is truncated.
+   */
+  bool load_state(const uint8_t *state, size_t size);
+
+  const Rom &rom() const { return *m_rom; }
+  Bus &bus() { return m_bus; }
+  Cpu &cpu() { return m_cpu; }
+  Mapper &mapper() { return *m_mapper; }
+  Ppu &ppu() { return *m_ppu; }
+  Apu &apu() { return *m_apu; }
+
+private:
+  Nes();
+
+  /**
+   * Creates components around m_rom.
+   * @param parent Mapper of the console forked from, if any.
+   * @return false if the mapper of the image is not supported.
+   */
+  bool create(uint32_t sample_rate, const Mapper *parent);
+
+  /// Saves state of every component except memory shared by forks.
+  void save_components(state::Writer &state) const;
+  void load_components(state::Reader &state);
+
+  // components are destroyed in reverse order, each unmapping itself from the
+  // bus and scheduler it was created with.
+  std::shared_ptr<Rom> m_rom;
+  Bus m_bus;
+  Cpu m_cpu;
+  std::unique_ptr<Mapper> m_mapper;
+  std::unique_ptr<Ppu> m_ppu;
+  std::unique_ptr<Apu> m_apu;
+  std::unique_ptr<Io> m_io;
+
+  /// Hash of the image, identifies the image states are saved with.
+  uint64_t m_image;
+};
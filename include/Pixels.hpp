@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Kernels of the pixel pipeline of the PPU.
+ *
+ * Every kernel has a scalar implementation and, on x86-64, SSE2 and AVX2
+ * implementations. The fastest one supported by the host is picked at run
+ * time.
+ */
+namespace pixels {
+
+/// Instruction sets kernels are implemented with.
+enum class Isa : uint8_t { scalar, sse2, avx2 };
+
+/**
+ * Decodes count tiles of 16 bytes, 8 bytes of low bit plane followed by 8
+ * bytes of high bit plane, into 8 rows per tile. Byte n of a row is the 2 bit
+ * color of pixel n from the left.
+ */
+extern void (*decode)(const uint8_t *tiles, size_t count, uint64_t *rows);
+
+/**
+ * Merges count sprite pixels over background pixels and looks the result up
+ * in palette.
+ * @param background Palette entries 0-15, color 0 is transparent.
+ * @param sprites Palette entries 16-31 in bits 0-4, 0 if transparent, bit 7
+ * set for sprites behind background.
+ * @param palette 32 entries of palette RAM.
+ * @param mask Applied to looked up colors, $30 for grayscale.
+ * @param out Color of each pixel.
+ */
+extern void (*compose)(const uint8_t *background, const uint8_t *sprites,
+                       const uint8_t *palette, uint8_t mask, uint8_t *out,
+                       size_t count);
+
+/**
+ * Selects kernels implemented with isa, or the best one below it if the host
+ * does not support isa.
+ * @return Instruction set selected.
+ */
+Isa select(Isa isa);
+
+/// @return Best instruction set supported by the host.
+Isa best();
+
+} // namespace pixels
@@ -0,0 +1,216 @@
+#pragma once
+
+#include "Bus.hpp"
+#include "Cpu.hpp"
+#include "FrameSink.hpp"
+#include "Mapper.hpp"
+#include "Scheduler.hpp"
+#include "State.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Ppu class emulates the 2C02 picture processing unit.
+ *
+ * The PPU is not stepped with the cpu. It catches up to the master clock of
+ * the cpu only when the cpu accesses its registers or when an event it
+ * scheduled is due: start of vertical blank and, for mappers counting
+ * scanlines, each rendered scanline. Between those points whole scanlines are
+ * rendered at once when the catch up passes dot 256 of a visible scanline.
+ */
+class Ppu : public Device, private Scheduler::Handler {
+public:
+  /**
+   * Maps registers of the PPU at $2000-$3FFF.
+   */
+  Ppu(Bus *bus, Cpu *cpu, Mapper *mapper);
+
+  /**
+   * Unmaps registers of the PPU.
+   */
+  ~Ppu() override;
+
+  Ppu(const Ppu &) = delete;
+  Ppu &operator=(const Ppu &) = delete;
+
+  /// Read register at address.
+  uint8_t read(uint16_t address) override;
+
+  /// Write register at address.
+  void write(uint16_t address, uint8_t data) override;
+
+  /**
+   * Only PPUSTATUS is stable: once a read found vertical blank and the write
+   * toggle clear, it keeps its value until the next point of the frame which
+   * may change the status.
+   */
+  uint64_t stable_until(uint16_t address) override;
+
+  /**
+   * Copies 256 bytes to object attribute memory, as done by OAM DMA.
+   */
+  void write_oam(const uint8_t *data);
+
+  /**
+   * Renders up to the current master clock of the cpu.
+   */
+  void catch_up();
+
+  /// @return Number of frames whose rendering completed.
+  uint64_t frame_count() const { return m_frame_count; }
+
+  /**
+   * @return Master clock at which the next vertical blank starts, rounded up
+   * to whole cycles.
+   */
+  uint64_t next_vblank() const;
+
+  /**
+   * Sets sink receiving rendered frames, nullptr to render none. Without a
+   * sink scanlines are only evaluated for sprite 0 hit and sprite overflow.
+   */
+  void set_sink(FrameSink *sink) { m_sink = sink; }
+
+  /// Saves registers, position in the frame and memory of the PPU.
+  void save(state::Writer &state) const;
+
+  /**
+   * Loads state saved by save(). The sink is kept, rendering continues into
+   * it from the loaded scanline.
+   */
+  void load(state::Reader &state);
+
+  static constexpr size_t width = FrameSink::width;
+  static constexpr size_t height = FrameSink::height;
+
+  /// Dots of the PPU per cycle of the cpu.
+  static constexpr uint64_t dots_per_cycle = 3;
+
+  /// Dots in one scanline.
+  static constexpr uint16_t dots_per_scanline = 341;
+
+  /// Scanlines in one frame, including vertical blank and pre-render line.
+  static constexpr uint16_t scanlines = 262;
+
+private:
+  /**
+   * Handles the ppu event of the scheduler by catching up.
+   */
+  void handle(Scheduler::Event event, uint64_t time) override;
+
+  /**
+   * Advances to dot target, handling every point of the frame which changes
+   * the state of the PPU on the way.
+   */
+  void advance(uint64_t target);
+
+  /// @return Next dot of m_scanline which changes the state of the PPU.
+  uint16_t next_point() const;
+
+  /**
+   * Changes the state of the PPU at dot m_cycle of m_scanline.
+   */
+  void point();
+
+  /// @return Number of dots in m_scanline.
+  uint16_t scanline_length() const;
+
+  /**
+   * Schedules catch up at the next point the cpu must observe, start of
+   * vertical blank or scanline clocking the mapper.
+   */
+  void schedule();
+
+  /**
+   * Renders visible scanline m_scanline into the sink.
+   */
+  void render_scanline();
+
+  /**
+   * Evaluates sprites on m_scanline and renders them into sprites: palette
+   * entry in bits 0-4, 0 if transparent, bit 6 set for sprite 0 and bit 7 for
+   * pixels behind background. sprites has 8 bytes of padding past the line.
+   * @return true if sprite 0 is on m_scanline.
+   */
+  bool render_sprites(uint8_t *sprites);
+
+  /// @return true if background or sprites are rendered.
+  bool rendering() const { return m_mask & 0x18; }
+
+  /// Read byte of PPU address space at address.
+  uint8_t read_vram(uint16_t address);
+
+  /// Write byte of PPU address space at address.
+  void write_vram(uint16_t address, uint8_t data);
+
+  /// @return Nametable memory backing address $2000-$2FFF.
+  uint8_t &nametable(uint16_t address);
+
+  /// @return Palette entry backing address $3F00-$3FFF.
+  uint8_t &palette(uint16_t address);
+
+  /// Increment coarse Y and fine Y of m_v, done at the end of each scanline.
+  void increment_y();
+
+  /// Context of bus.
+  Bus *m_bus;
+
+  /// Cpu receiving NMI and supplying master clock.
+  Cpu *m_cpu;
+
+  /// Mapper supplying pattern tables and mirroring.
+  Mapper *m_mapper;
+
+  /// Dot reached by the PPU, counted since power on.
+  uint64_t m_dot;
+
+  /// Dot at which sprite 0 hit is set, Scheduler::never if not pending.
+  uint64_t m_sprite_zero_dot;
+
+  uint64_t m_frame_count;
+
+  /// Current scanline, 0-239 visible, 241 starts vertical blank and 261 is the
+  /// pre-render line.
+  uint16_t m_scanline;
+
+  /// Current dot in m_scanline.
+  uint16_t m_cycle;
+
+  /// true on odd frames, they skip one dot when rendering.
+  bool m_odd;
+
+  /// $2000 PPUCTRL.
+  uint8_t m_ctrl;
+
+  /// $2001 PPUMASK.
+  uint8_t m_mask;
+
+  /// $2002 PPUSTATUS.
+  uint8_t m_status;
+
+  /// $2003 OAMADDR.
+  uint8_t m_oam_address;
+
+  /// Last value written to a register, returned by write only bits.
+  uint8_t m_latch;
+
+  /// Buffer of $2007 reads.
+  uint8_t m_read_buffer;
+
+  /// Current VRAM address, temporary VRAM address, fine X scroll and write
+  /// toggle.
+  uint16_t m_v, m_t;
+  uint8_t m_x;
+  bool m_w;
+
+  uint8_t m_oam[256];
+
+  /// Nametables, 4 for cartridges with four screen mirroring.
+  uint8_t m_vram[0x1000];
+
+  uint8_t m_palette[0x20];
+
+  /// Receives rendered frames, nullptr if nothing is rendered.
+  FrameSink *m_sink;
+};
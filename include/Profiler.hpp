@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+/**
+ * Profiler class counts instructions executed by the interpreter per opcode:
+ * executions, cycles including page crossing and branch penalties, and host
+ * time of a sample of executions.
+ *
+ * Only built with NES_PROFILE, Cpu::step() then reports every instruction to
+ * it. Reading the clock costs more than most instructions, so only about one
+ * in sample_interval instructions is timed, at random intervals so that loops
+ * do not alias with the sampling. Host time of an opcode is estimated from
+ * the mean of its samples. Blocks run by the recompiler are not counted.
+ */
+class Profiler {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  /// Mean number of instructions between timed ones.
+  static constexpr uint32_t sample_interval = 64;
+
+  /// Counters of an opcode.
+  struct Entry {
+    uint64_t count;
+    uint64_t cycles;
+
+    /// Executions timed and their host time.
+    uint64_t samples;
+    uint64_t nanoseconds;
+  };
+
+  /// Instruction being executed, returned by begin().
+  struct Sample {
+    bool timed;
+    Clock::time_point start;
+  };
+
+  Profiler() { clear(); }
+
+  /**
+   * Called before an instruction is fetched.
+   */
+  Sample begin() {
+    if (--m_countdown)
+      return {false, {}};
+    // xorshift, intervals are uniform in [1, 2 * sample_interval - 1].
+    m_random ^= m_random << 13;
+    m_random ^= m_random >> 17;
+    m_random ^= m_random << 5;
+    m_countdown = 1 + m_random % (2 * sample_interval - 1);
+    return {true, Clock::now()};
+  }
+
+  /**
+   * Called after instruction opcode begun by sample took cycles.
+   */
+  void end(const Sample &sample, uint8_t opcode, uint8_t cycles) {
+    Entry &entry = m_entries[opcode];
+    entry.count++;
+    entry.cycles += cycles;
+    if (sample.timed) {
+      int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            Clock::now() - sample.start)
+                            .count();
+      entry.samples++;
+      entry.nanoseconds += std::max<int64_t>(elapsed - m_overhead, 0);
+    }
+  }
+
+  const Entry &entry(uint8_t opcode) const { return m_entries[opcode]; }
+
+  /**
+   * Resets every counter.
+   */
+  void clear();
+
+  /**
+   * Prints opcodes and addressing modes executed, sorted by estimated host
+   * time.
+   */
+  void report(std::FILE *out) const;
+
+private:
+  Entry m_entries[256];
+
+  /// Nanoseconds between two consecutive readings of the clock, subtracted
+  /// from every sample.
+  int64_t m_overhead;
+
+  /// Instructions left until the next timed one.
+  uint32_t m_countdown;
+
+  uint32_t m_random;
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "Nes.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+/**
+ * Rewind class keeps a history of save states of a console and steps it back
+ * through them.
+ *
+ * Every interval frames a state is saved and stored as the XOR of it with the
+ * last keyframe, run length encoded. Most of the state, internal RAM and
+ * memory of the PPU, barely changes between frames, so a snapshot takes a
+ * few hundred bytes instead of a whole state. Every keyframe_interval
+ * snapshots a new keyframe is stored, encoded against an empty state.
+ *
+ * Snapshots are kept in a ring of capacity bytes, the oldest are dropped
+ * when it is full. Restoring one decodes its keyframe and itself only, so
+ * stepping back costs about as much as loading a state.
+ */
+class Rewind {
+public:
+  /**
+   * @param nes Console recorded and rewound, must outlive the history.
+   * @param interval Frames between snapshots.
+   * @param capacity Bytes of encoded snapshots kept.
+   * @param keyframe_interval Snapshots between keyframes.
+   */
+  Rewind(Nes *nes, size_t interval = 2, size_t capacity = 4 << 20,
+         size_t keyframe_interval = 60);
+
+  Rewind(const Rewind &) = delete;
+  Rewind &operator=(const Rewind &) = delete;
+
+  /**
+   * Called after each frame, saves a snapshot every interval frames.
+   */
+  void record();
+
+  /**
+   * Restores the newest snapshot and drops it from the history.
+   * @return false if the history is empty.
+   */
+  bool step_back();
+
+  /**
+   * Drops every snapshot.
+   */
+  void clear();
+
+  /// @return Number of snapshots in the history.
+  size_t size() const { return m_entries.size(); }
+
+  /// @return Bytes taken by encoded snapshots in the history.
+  size_t bytes() const { return m_bytes; }
+
+private:
+  /// Encoded snapshot in m_buffer.
+  struct Entry {
+    size_t offset;
+    size_t size;
+    bool keyframe;
+  };
+
+  /**
+   * Encodes XOR of state with base as runs of zeros and literal bytes into
+   * out. base is taken as padded with zeros to the size of state.
+   */
+  static void encode(const std::vector<uint8_t> &state,
+                     const std::vector<uint8_t> &base,
+                     std::vector<uint8_t> &out);
+
+  /**
+   * Decodes entry encoded by encode() into state, applied over base.
+   */
+  static void decode(const uint8_t *data, const std::vector<uint8_t> &base,
+                     std::vector<uint8_t> &state);
+
+  /**
+   * Stores encoded snapshot in the ring, dropping the oldest snapshots it
+   * overwrites.
+   * @return false if the snapshot is not stored: it is larger than the ring,
+   * or it is a delta and its keyframe was dropped.
+   */
+  bool push(const std::vector<uint8_t> &encoded, bool keyframe);
+
+  /// Drops the oldest snapshot and the snapshots encoded against it.
+  void pop_front();
+
+  Nes *m_nes;
+  size_t m_interval;
+  size_t m_keyframe_interval;
+
+  /// Frames recorded since the last snapshot.
+  size_t m_frames;
+
+  /// Snapshots encoded against m_keyframe, a keyframe is due when it reaches
+  /// m_keyframe_interval.
+  size_t m_deltas;
+
+  /// Ring of encoded snapshots.
+  std::vector<uint8_t> m_buffer;
+
+  /// Offset in m_buffer the next snapshot is stored at.
+  size_t m_head;
+
+  /// Snapshots from oldest to newest.
+  std::deque<Entry> m_entries;
+  size_t m_bytes;
+
+  /// State of the last keyframe, deltas are encoded against it.
+  std::vector<uint8_t> m_keyframe;
+
+  /// Buffers reused by every snapshot, so recording does not allocate.
+  std::vector<uint8_t> m_state, m_encoded;
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Cartridge image in iNES or NES 2.0 format.
+ *
+ * The file is mapped read only into memory instead of being read, PRG and CHR
+ * point straight into the mapping. Images shared by several emulator
+ * instances therefore cost one copy in the page cache.
+ */
+class Rom {
+public:
+  /**
+   * Nametable mirroring wired on the cartridge. Single screen mirroring is
+   * only selected at run time by mappers.
+   */
+  enum class Mirroring : uint8_t {
+    horizontal,
+    vertical,
+    four_screen,
+    single_screen_lower,
+    single_screen_upper
+  };
+
+  Rom();
+  ~Rom();
+
+  Rom(const Rom &) = delete;
+  Rom &operator=(const Rom &) = delete;
+
+  /**
+   * Maps the image at path and parses its header, closing any image opened
+   * before.
+   * @return false if the file can not be mapped or is not a valid image.
+   */
+  bool open(const char *path);
+
+  /**
+   * Unmaps the image.
+   */
+  void close();
+
+  /// @return true if an image is open.
+  bool is_open() const { return m_data != nullptr; }
+
+  /// @return true if header is in NES 2.0 format.
+  bool nes2() const { return m_nes2; }
+
+  /// @return iNES mapper number.
+  uint16_t mapper() const { return m_mapper; }
+
+  /// @return NES 2.0 submapper number, 0 for iNES images.
+  uint8_t submapper() const { return m_submapper; }
+
+  Mirroring mirroring() const { return m_mirroring; }
+
+  /// @return true if the cartridge has battery backed memory.
+  bool battery() const { return m_battery; }
+
+  /// @return PRG-ROM, points into the mapped file.
+  const uint8_t *prg() const { return m_prg; }
+
+  size_t prg_size() const { return m_prg_size; }
+
+  /// @return CHR-ROM, points into the mapped file, nullptr if cartridge has
+  /// CHR-RAM instead.
+  const uint8_t *chr() const { return m_chr; }
+
+  size_t chr_size() const { return m_chr_size; }
+
+  /// @return 512 byte trainer loaded at $7000, nullptr if there is none.
+  const uint8_t *trainer() const { return m_trainer; }
+
+  /// @return Size of PRG-RAM including battery backed memory.
+  size_t prg_ram_size() const { return m_prg_ram_size; }
+
+  /// @return Size of CHR-RAM including battery backed memory.
+  size_t chr_ram_size() const { return m_chr_ram_size; }
+
+  /// Size of the file header.
+  static constexpr size_t header_size = 16;
+
+  /// Size of the trainer.
+  static constexpr size_t trainer_size = 512;
+
+private:
+  /**
+   * Parses header of the mapped file.
+   * @return false if it is not a valid image.
+   */
+  bool parse();
+
+  /// Mapped file, nullptr if no image is open.
+  uint8_t *m_data;
+  size_t m_size;
+
+  bool m_nes2;
+  uint16_t m_mapper;
+  uint8_t m_submapper;
+  Mirroring m_mirroring;
+  bool m_battery;
+
+  const uint8_t *m_prg;
+  size_t m_prg_size;
+  const uint8_t *m_chr;
+  size_t m_chr_size;
+  const uint8_t *m_trainer;
+  size_t m_prg_ram_size;
+  size_t m_chr_ram_size;
+};
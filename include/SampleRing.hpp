@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Ring buffer of audio samples passed from the emulator to one consumer,
+ * e.g. an audio callback on another thread. Neither side ever blocks, when
+ * the ring is full newer samples are dropped.
+ */
+class SampleRing {
+public:
+  /**
+   * @param capacity Number of samples held, rounded up to a power of two.
+   */
+  explicit SampleRing(size_t capacity);
+
+  SampleRing(const SampleRing &) = delete;
+  SampleRing &operator=(const SampleRing &) = delete;
+
+  /**
+   * Appends up to count samples, called by the producer only.
+   * @return Number of samples appended.
+   */
+  size_t write(const int16_t *samples, size_t count);
+
+  /**
+   * Removes up to count oldest samples into out, called by the consumer only.
+   * @return Number of samples removed.
+   */
+  size_t read(int16_t *out, size_t count);
+
+  /// @return Number of samples held.
+  size_t size() const {
+    return m_write.load(std::memory_order_acquire) -
+           m_read.load(std::memory_order_acquire);
+  }
+
+  size_t capacity() const { return m_samples.size(); }
+
+private:
+  std::vector<int16_t> m_samples;
+
+  /// Positions of next write and read, counted since creation.
+  std::atomic<size_t> m_write, m_read;
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "State.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+/**
+ * Deadlines of timed events on the master clock.
+ *
+ * Every event kind has at most one pending deadline. Cpu::run_to() executes
+ * instructions without looking at other components until the earliest
+ * deadline is reached and then dispatches the events which are due.
+ */
+class Scheduler {
+public:
+  enum class Event : uint8_t {
+    /// Non maskable interrupt, e.g. start of vertical blank.
+    nmi,
+    /// Interrupt request, e.g. frame counter or mapper scanline counter.
+    irq,
+    /// Point where the picture processing unit has to catch up.
+    ppu,
+    /// Point where the audio processing unit has to catch up.
+    apu,
+    /// Sample of the program counter taken by a profiler, see HotSpots. Must
+    /// stay last, it is not part of the state.
+    sample,
+    count
+  };
+
+  /**
+   * Interface of components handling events.
+   */
+  class Handler {
+  public:
+    virtual ~Handler() = default;
+
+    /**
+     * Called when event is due, time is its deadline.
+     */
+    virtual void handle(Event event, uint64_t time) = 0;
+  };
+
+  /// Deadline of events which are not scheduled.
+  static constexpr uint64_t never = std::numeric_limits<uint64_t>::max();
+
+  Scheduler();
+
+  /**
+   * Sets handler called when event is due, nullptr to drop the event.
+   */
+  void set_handler(Event event, Handler *handler);
+
+  /**
+   * Sets deadline of the run in progress, lowered whenever an event is
+   * scheduled before it, so events scheduled while running fire on time.
+   */
+  void set_deadline(uint64_t *deadline) { m_deadline = deadline; }
+
+  /**
+   * Schedules event at time, replacing its pending deadline.
+   */
+  void schedule(Event event, uint64_t time);
+
+  /**
+   * Removes pending deadline of event.
+   */
+  void cancel(Event event) { schedule(event, never); }
+
+  /// @return Deadline of event, never if it is not scheduled.
+  uint64_t deadline(Event event) const {
+    return m_deadlines[(size_t)event];
+  }
+
+  /// @return Earliest deadline of all events.
+  uint64_t next() const { return m_next; }
+
+  /**
+   * Calls handlers of all events due at time in order of their deadlines.
+   * Events are unscheduled before their handler is called, so the handler
+   * may schedule them again.
+   */
+  void dispatch(uint64_t time);
+
+  /// Saves deadlines of events but sample, handlers are not part of the
+  /// state.
+  void save(state::Writer &state) const;
+
+  void load(state::Reader &state);
+
+private:
+  uint64_t m_deadlines[(size_t)Event::count];
+
+  Handler *m_handlers[(size_t)Event::count];
+
+  /// Earliest of m_deadlines.
+  uint64_t m_next;
+
+  /// Deadline of the run in progress, nullptr if none.
+  uint64_t *m_deadline;
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Save states of the console.
+ *
+ * A state is a header followed by the fields of every component in a fixed
+ * order, each stored as its bytes in host byte order. Fields are not tagged:
+ * the layout is identified by the version in the header and by the image the
+ * state was saved with, so states are compact and saving and loading are
+ * plain copies. Memory of the cartridge image is never part of a state.
+ */
+namespace state {
+
+/// Version of the layout, bumped whenever a component changes its fields.
+constexpr uint32_t version = 3;
+
+/**
+ * Appends fields of components to a state.
+ */
+class Writer {
+public:
+  /**
+   * Starts a state of the image identified by image in data, replacing its
+   * contents but keeping its capacity.
+   */
+  Writer(std::vector<uint8_t> &data, uint64_t image);
+
+  /**
+   * Completes the header, must be called after the last field.
+   */
+  void finish();
+
+  void write(const void *data, size_t size) {
+    size_t offset = m_data.size();
+    m_data.resize(offset + size);
+    std::memcpy(m_data.data() + offset, data, size);
+  }
+
+  template <typename T> void write(const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "fields are stored as their bytes");
+    write(&value, sizeof(value));
+  }
+
+private:
+  std::vector<uint8_t> &m_data;
+};
+
+/**
+ * Reads fields of components back from a state in the order they were
+ * written.
+ */
+class Reader {
+public:
+  /**
+   * Checks the header of the state of size bytes at data.
+   * @param image Identifies the image of the console loading the state.
+   */
+  Reader(const uint8_t *data, size_t size, uint64_t image);
+
+  /**
+   * @return true if the state has the current version, was saved with the
+   * same image and is complete.
+   */
+  bool valid() const { return m_valid; }
+
+  /// Reads size bytes, bytes past the end of the state read as 0.
+  void read(void *data, size_t size) {
+    size_t count = m_offset < m_size ? std::min(size, m_size - m_offset) : 0;
+    std::memcpy(data, m_data + m_offset, count);
+    std::memset(static_cast<uint8_t *>(data) + count, 0, size - count);
+    m_offset += size;
+  }
+
+  template <typename T> void read(T &value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "fields are stored as their bytes");
+    read(&value, sizeof(value));
+  }
+
+private:
+  const uint8_t *m_data;
+  size_t m_size;
+  size_t m_offset;
+  bool m_valid;
+};
+
+} // namespace state
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Trace class records every instruction the cpu executes, see
+ * Cpu::set_trace().
+ *
+ * The cpu appends fixed size records to the current block of a ring of
+ * blocks owned by the trace, so recording an instruction is a few stores.
+ * Full blocks are handed to a writer thread which compresses and appends
+ * them to the file while the cpu fills the next one, the cpu only waits
+ * when every block of the ring is queued.
+ *
+ * The file starts with a header: the magic "NESTRACE" and the version of
+ * the format, 32 bits. Chunks follow, each the number of records and the
+ * size of the compressed data, 32 bits each, then the data: records as
+ * planes of their fields, clocks as differences to the previous record,
+ * compressed with lz4::compress(). Numbers are stored in host byte order.
+ */
+class Trace {
+public:
+  /**
+   * State of the cpu before it executed an instruction.
+   */
+  struct Record {
+    /// Master clock.
+    uint64_t clock;
+    uint16_t pc;
+    /// Opcode and the two bytes after it, 0 where they are not memory.
+    uint8_t bytes[3];
+    uint8_t a, x, y, s, p;
+  };
+
+  class Reader;
+
+  /**
+   * Creates the file at path and starts the writer thread.
+   * @return nullptr if the file can not be created.
+   */
+  static std::unique_ptr<Trace> open(const char *path);
+
+  /**
+   * Finishes the file.
+   */
+  ~Trace();
+
+  Trace(const Trace &) = delete;
+  Trace &operator=(const Trace &) = delete;
+
+  /**
+   * Checks that records written to a temporary file are read back unchanged
+   * and that chunks larger than a block are rejected.
+   * @return false if a check failed.
+   */
+  static bool test();
+
+  /**
+   * Appends record, called by the cpu.
+   */
+  void write(const Record &record) {
+    if (m_count == block_records)
+      submit();
+    m_records[m_count++] = record;
+  }
+
+  /**
+   * Writes every record appended, stops the writer thread and closes the
+   * file. Records appended after are dropped.
+   * @return false if a write failed.
+   */
+  bool close();
+
+  /// @return Number of records appended.
+  uint64_t records() const { return m_submitted + m_count; }
+
+  /// Records per block, the unit compressed.
+  static constexpr size_t block_records = 1 << 14;
+
+  /// Blocks in the ring.
+  static constexpr size_t block_count = 8;
+
+  /// Version of the format.
+  static constexpr uint32_t version = 1;
+
+private:
+  explicit Trace(std::FILE *file);
+
+  /**
+   * Queues the current block for the writer thread and takes a free one.
+   */
+  void submit();
+
+  /**
+   * Body of the writer thread.
+   */
+  void drain();
+
+  std::FILE *m_file;
+
+  std::vector<std::vector<Record>> m_blocks;
+
+  /// Records of the block being filled.
+  Record *m_records;
+  size_t m_block;
+  size_t m_count;
+  uint64_t m_submitted;
+
+  std::mutex m_mutex;
+  std::condition_variable m_changed;
+
+  /// Blocks queued for the writer thread, with their number of records.
+  std::deque<std::pair<size_t, size_t>> m_full;
+
+  /// Blocks the cpu may fill.
+  std::vector<size_t> m_free;
+  bool m_closing;
+  bool m_failed;
+
+  std::thread m_writer;
+};
+
+/**
+ * Reads records back from a trace file.
+ */
+class Trace::Reader {
+public:
+  /**
+   * Opens the file at path and checks its header.
+   * @return nullptr if it can not be read or is not a trace.
+   */
+  static std::unique_ptr<Reader> open(const char *path);
+
+  ~Reader();
+
+  Reader(const Reader &) = delete;
+  Reader &operator=(const Reader &) = delete;
+
+  /**
+   * Replaces records with those of the next chunk.
+   * @return false at the end of the file or if the chunk is malformed, see
+   * failed().
+   */
+  bool read(std::vector<Record> &records);
+
+  /// @return true if the file was truncated or malformed.
+  bool failed() const { return m_failed; }
+
+private:
+  explicit Reader(std::FILE *file);
+
+  std::FILE *m_file;
+  uint64_t m_clock;
+  bool m_failed;
+  std::vector<uint8_t> m_compressed;
+  std::vector<uint8_t> m_planes;
+};
@@ -1,8 +1,73 @@
 #include "Bus.hpp"
 #include "Cpu.hpp"
+#include "HotSpots.hpp"
+#include "Lz4.hpp"
+#include "Nes.hpp"
+#include "Trace.hpp"
 
-int main() {
-  Cpu::test();
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
 
+/**
+ * Runs the image at path headless for frames and prints a hash of the last
+ * frame, so runs can be compared without a display. With NES_PROFILE the
+ * instructions executed are reported to stderr.
+ * @param folded Path folded call stacks sampled while running are written
+ * to, nullptr to not profile.
+ */
+static int run(const char *path, unsigned long frames, const char *folded) {
+  auto nes = Nes::open(path);
+  if (!nes) {
+    std::fprintf(stderr, "can not load %s\n", path);
+    return 1;
+  }
+
+  using Format = FrameSink::Format;
+  std::vector<uint8_t> memory(2 * FrameSink::frame_size(Format::index));
+  uint8_t *buffers[] = {memory.data(),
+                        memory.data() + FrameSink::frame_size(Format::index)};
+  FrameSink sink(Format::index, buffers, 2);
+  nes->set_frame_sink(&sink);
+  std::unique_ptr<HotSpots> hot_spots;
+  if (folded)
+    hot_spots = std::make_unique<HotSpots>(&nes->cpu());
+  for (unsigned long i = 0; i < frames && !nes->cpu().halted(); i++)
+    nes->run_frame();
+
+  if (hot_spots) {
+    std::FILE *out = std::fopen(folded, "w");
+    if (!out) {
+      std::fprintf(stderr, "can not write %s\n", folded);
+      return 1;
+    }
+    hot_spots->write_folded(out);
+    std::fclose(out);
+  }
+
+  // FNV-1a.
+  uint64_t hash = 0xCBF29CE484222325;
+  const uint8_t *frame = sink.acquire();
+  for (size_t i = 0; i < FrameSink::frame_size(Format::index); i++)
+    hash = (hash ^ frame[i]) * 0x100000001B3;
+  std::printf("frames %llu cycles %llu hash %016llx\n",
+              (unsigned long long)sink.frame_count(),
+              (unsigned long long)nes->cpu().clock(),
+              (unsigned long long)hash);
+#ifdef NES_PROFILE
+  nes->cpu().profiler().report(stderr);
+#endif
   return 0;
 }
+
+int main(int argc, char **argv) {
+  if (argc > 1)
+    return run(argv[1], argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 60,
+               argc > 3 ? argv[3] : nullptr);
+
+  bool ok = Cpu::test();
+  ok = Nes::test() && ok;
+  ok = lz4::test() && ok;
+  ok = Trace::test() && ok;
+  return ok ? 0 : 1;
+}
@@ -6,18 +6,18 @@ import re
 
 
 addressing_modes = {
-    "imp": "implicit_addressing",
-    "imm": "immediate_addressing",
-    "zp": "zero_page_addressing",
-    "zpx": "zero_page_x_indexed",
-    "zpy": "zero_page_y_indexed",
+    "imp": "implicit",
+    "imm": "immediate",
+    "zp": "zero_page",
+    "zpx": "zero_page_x",
+    "zpy": "zero_page_y",
     "izx": "indexed_indirect",
     "izy": "indirect_indexed",
-    "abs": "absolute_addressing",
-    "abx": "absolute_x_indexed",
-    "aby": "absolute_y_indexed",
-    "ind": "indirect_addressing",
-    "rel": "relative_addressing",
+    "abs": "absolute",
+    "abx": "absolute_x",
+    "aby": "absolute_y",
+    "ind": "indirect",
+    "rel": "relative",
 }
 
 unofficial_instructions = []
@@ -41,8 +41,12 @@ def get_init(instruction):
     if len(instruction) == 3:
         addressing = instruction[1]
 
+    if addressing == "imp" and name in ("ASL", "ROL", "LSR", "ROR"):
+        # shifts and rotates on the accumulator have their own operation.
+        name += "_A"
+
     addressing = addressing_modes[addressing]
-    init = "{" + f'"{name}", &Cpu::{name}, &Cpu::{addressing}, {cycles}' + "}"
+    init = "{" + f"Op::{name}, Mode::{addressing}, {cycles}" + "}"
     return init
 
 
@@ -0,0 +1,537 @@
+#include "Apu.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+using Event = Scheduler::Event;
+
+namespace {
+
+/// Weights of one step of output of each channel in the linear mix.
+constexpr int32_t pulse_weight = 246;
+constexpr int32_t triangle_weight = 279;
+constexpr int32_t noise_weight = 162;
+constexpr int32_t dmc_weight = 110;
+
+/// Values loaded into length counters, indexed by bits 3-7 of writes.
+constexpr uint8_t length_table[32] = {
+    10, 254, 20, 2,  40, 4,  80, 6,  160, 8,  60, 10, 14, 12, 26, 14,
+    12, 16,  24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30};
+
+/// Output of the pulse sequencer at each step, for each duty cycle.
+constexpr uint8_t duty_table[4] = {0x02, 0x06, 0x1E, 0xF9};
+
+/// Periods of the noise timer in cycles.
+constexpr uint16_t noise_periods[16] = {4,   8,   16,  32,  64,  96,
+                                        128, 160, 202, 254, 380, 508,
+                                        762, 1016, 2034, 4068};
+
+/// Periods of the delta modulation timer in cycles.
+constexpr uint16_t dmc_periods[16] = {428, 380, 340, 320, 286, 254,
+                                      226, 214, 190, 160, 142, 128,
+                                      106, 84,  72,  54};
+
+/// Clocks of the steps of the frame counter since the start of its sequence,
+/// a sequence lasts one clock more than its last step.
+constexpr uint16_t four_steps[4] = {7457, 14913, 22371, 29829};
+constexpr uint16_t five_steps[5] = {7457, 14913, 22371, 29829, 37281};
+
+/// Clocks after which a batch ends even without a frame counter step.
+constexpr uint64_t max_batch = 8192;
+
+} // namespace
+
+Apu::Apu(Bus *bus, Cpu *cpu, uint32_t sample_rate)
+    : m_bus(bus), m_cpu(cpu), m_sample_rate(sample_rate),
+      m_time(cpu->clock()), m_batch(m_time), m_pulse(), m_triangle(),
+      m_noise(), m_dmc(), m_enabled(0), m_five_step(false), m_inhibit(false),
+      m_frame_irq(false), m_dmc_irq(false), m_frame_step(0),
+      m_frame_next(m_time + four_steps[0]),
+      // batches span less than 1/100 of a second.
+      m_blip(clock_rate, sample_rate, sample_rate / 40 + Blip::taps),
+      m_ring(sample_rate / 4) {
+  m_pulse[0].ones_complement = true;
+  for (Pulse &pulse : m_pulse)
+    pulse.next = m_time;
+  m_triangle.next = m_time;
+  m_noise.period = noise_periods[0];
+  m_noise.shift = 1;
+  m_noise.next = m_time;
+  m_dmc.period = dmc_periods[0];
+  m_dmc.silence = true;
+  m_dmc.bits = 8;
+  m_dmc.next = m_time;
+
+  m_cpu->scheduler().set_handler(Event::apu, this);
+  schedule();
+}
+
+Apu::~Apu() {
+  m_cpu->scheduler().cancel(Event::apu);
+  m_cpu->scheduler().set_handler(Event::apu, nullptr);
+}
+
+void Apu::save(state::Writer &state) const {
+  state.write(m_time);
+  state.write(m_batch);
+  state.write(m_pulse);
+  state.write(m_triangle);
+  state.write(m_noise);
+  state.write(m_dmc);
+  state.write(m_enabled);
+  state.write(m_five_step);
+  state.write(m_inhibit);
+  state.write(m_frame_irq);
+  state.write(m_dmc_irq);
+  state.write(m_frame_step);
+  state.write(m_frame_next);
+  m_blip.save(state);
+}
+
+void Apu::load(state::Reader &state) {
+  state.read(m_time);
+  state.read(m_batch);
+  state.read(m_pulse);
+  state.read(m_triangle);
+  state.read(m_noise);
+  state.read(m_dmc);
+  state.read(m_enabled);
+  state.read(m_five_step);
+  state.read(m_inhibit);
+  state.read(m_frame_irq);
+  state.read(m_dmc_irq);
+  state.read(m_frame_step);
+  state.read(m_frame_next);
+  m_blip.load(state);
+}
+
+uint8_t Apu::read(uint16_t address) {
+  if (address != 0x4015)
+    return 0;
+
+  catch_up();
+  uint8_t status = (m_pulse[0].length ? 0x01 : 0) |
+                   (m_pulse[1].length ? 0x02 : 0) |
+                   (m_triangle.length ? 0x04 : 0) |
+                   (m_noise.length ? 0x08 : 0) |
+                   (m_dmc.remaining ? 0x10 : 0) | (m_frame_irq ? 0x40 : 0) |
+                   (m_dmc_irq ? 0x80 : 0);
+  m_frame_irq = false;
+  m_cpu->irq(false, Cpu::irq_frame_counter);
+  return status;
+}
+
+void Apu::write(uint16_t address, uint8_t data) {
+  catch_up();
+
+  switch (address) {
+  case 0x4000:
+  case 0x4004: {
+    Pulse &pulse = m_pulse[(address >> 2) & 1];
+    pulse.duty = data >> 6;
+    pulse.envelope.loop = data & 0x20;
+    pulse.envelope.constant = data & 0x10;
+    pulse.envelope.period = data & 0x0F;
+    break;
+  }
+  case 0x4001:
+  case 0x4005: {
+    Pulse &pulse = m_pulse[(address >> 2) & 1];
+    pulse.sweep_enabled = data & 0x80;
+    pulse.sweep_period = (data >> 4) & 7;
+    pulse.negate = data & 0x08;
+    pulse.shift = data & 7;
+    pulse.reload = true;
+    break;
+  }
+  case 0x4002:
+  case 0x4006: {
+    Pulse &pulse = m_pulse[(address >> 2) & 1];
+    pulse.period = (pulse.period & 0x0700) | data;
+    break;
+  }
+  case 0x4003:
+  case 0x4007: {
+    size_t channel = (address >> 2) & 1;
+    Pulse &pulse = m_pulse[channel];
+    pulse.period = (pulse.period & 0x00FF) | ((data & 7) << 8);
+    if (m_enabled & (1 << channel))
+      pulse.length = length_table[data >> 3];
+    pulse.step = 0;
+    pulse.envelope.start = true;
+    break;
+  }
+  case 0x4008:
+    m_triangle.control = data & 0x80;
+    m_triangle.linear_reload = data & 0x7F;
+    break;
+  case 0x400A:
+    m_triangle.period = (m_triangle.period & 0x0700) | data;
+    break;
+  case 0x400B:
+    m_triangle.period = (m_triangle.period & 0x00FF) | ((data & 7) << 8);
+    if (m_enabled & 0x04)
+      m_triangle.length = length_table[data >> 3];
+    m_triangle.reload = true;
+    break;
+  case 0x400C:
+    m_noise.envelope.loop = data & 0x20;
+    m_noise.envelope.constant = data & 0x10;
+    m_noise.envelope.period = data & 0x0F;
+    break;
+  case 0x400E:
+    m_noise.mode = data & 0x80;
+    m_noise.period = noise_periods[data & 0x0F];
+    break;
+  case 0x400F:
+    if (m_enabled & 0x08)
+      m_noise.length = length_table[data >> 3];
+    m_noise.envelope.start = true;
+    break;
+  case 0x4010:
+    m_dmc.irq_enabled = data & 0x80;
+    m_dmc.loop = data & 0x40;
+    m_dmc.period = dmc_periods[data & 0x0F];
+    if (!m_dmc.irq_enabled) {
+      m_dmc_irq = false;
+      m_cpu->irq(false, Cpu::irq_dmc);
+    }
+    break;
+  case 0x4011:
+    set_level(m_dmc.level, data & 0x7F, dmc_weight, m_time);
+    break;
+  case 0x4012:
+    m_dmc.start = 0xC000 | (data << 6);
+    break;
+  case 0x4013:
+    m_dmc.size = (data << 4) | 1;
+    break;
+  case 0x4015:
+    m_enabled = data & 0x1F;
+    // disabled channels are silenced through their length counters.
+    if (!(data & 0x01))
+      m_pulse[0].length = 0;
+    if (!(data & 0x02))
+      m_pulse[1].length = 0;
+    if (!(data & 0x04))
+      m_triangle.length = 0;
+    if (!(data & 0x08))
+      m_noise.length = 0;
+    if (!(data & 0x10)) {
+      m_dmc.remaining = 0;
+    } else if (!m_dmc.remaining) {
+      m_dmc.address = m_dmc.start;
+      m_dmc.remaining = m_dmc.size;
+      fetch();
+    }
+    m_dmc_irq = false;
+    m_cpu->irq(false, Cpu::irq_dmc);
+    break;
+  case 0x4017:
+    m_five_step = data & 0x80;
+    m_inhibit = data & 0x40;
+    if (m_inhibit) {
+      m_frame_irq = false;
+      m_cpu->irq(false, Cpu::irq_frame_counter);
+    }
+    // the sequence restarts, 5 step mode clocks all units at once.
+    m_frame_step = 0;
+    m_frame_next = m_time + four_steps[0];
+    if (m_five_step) {
+      quarter_frame();
+      half_frame();
+    }
+    break;
+  }
+
+  update(m_time);
+  schedule();
+}
+
+void Apu::catch_up() { run(m_cpu->clock()); }
+
+void Apu::end_batch() {
+  catch_up();
+  flush();
+}
+
+void Apu::handle(Scheduler::Event, uint64_t) {
+  catch_up();
+  schedule();
+}
+
+void Apu::run(uint64_t target) {
+  while (m_frame_next <= target) {
+    advance(m_frame_next);
+    frame_step();
+    flush();
+  }
+  advance(target);
+  // $4017 writes may postpone frame counter steps indefinitely.
+  if (m_time - m_batch >= max_batch)
+    flush();
+}
+
+void Apu::advance(uint64_t until) {
+  run_pulse(m_pulse[0], until, pulse_weight);
+  run_pulse(m_pulse[1], until, pulse_weight);
+  run_triangle(until);
+  run_noise(until);
+  run_dmc(until);
+  m_time = std::max(m_time, until);
+}
+
+void Apu::flush() {
+  m_blip.end_batch(m_time - m_batch);
+  m_batch = m_time;
+
+  int16_t samples[512];
+  while (size_t count = m_blip.read(samples, std::size(samples)))
+    m_ring.write(samples, count);
+}
+
+void Apu::run_pulse(Pulse &pulse, uint64_t until, int32_t weight) {
+  if (pulse.next > until)
+    return;
+  // the timer counts APU cycles of 2 cpu cycles.
+  uint64_t cycles = (pulse.period + 1) * 2;
+  if (pulse.muted() || !pulse.length || !pulse.envelope.volume()) {
+    // output stays 0, only the sequencer moves.
+    uint64_t steps = (until - pulse.next) / cycles + 1;
+    pulse.step = (pulse.step + steps) & 7;
+    pulse.next += steps * cycles;
+    return;
+  }
+  for (; pulse.next <= until; pulse.next += cycles) {
+    pulse.step = (pulse.step + 1) & 7;
+    set_level(pulse.level, pulse.output(), weight, pulse.next);
+  }
+}
+
+void Apu::run_triangle(uint64_t until) {
+  Triangle &triangle = m_triangle;
+  if (triangle.next > until)
+    return;
+  uint64_t cycles = triangle.period + 1;
+  if (!triangle.linear || !triangle.length || triangle.period < 2) {
+    // the sequencer halts with the counters, ultrasonic periods hold the level
+    // instead of aliasing.
+    uint64_t steps = (until - triangle.next) / cycles + 1;
+    if (triangle.linear && triangle.length)
+      triangle.step = (triangle.step + steps) & 31;
+    triangle.next += steps * cycles;
+    return;
+  }
+  for (; triangle.next <= until; triangle.next += cycles) {
+    triangle.step = (triangle.step + 1) & 31;
+    set_level(triangle.level, triangle.output(), triangle_weight,
+              triangle.next);
+  }
+}
+
+void Apu::run_noise(uint64_t until) {
+  Noise &noise = m_noise;
+  for (; noise.next <= until; noise.next += noise.period) {
+    uint16_t feedback =
+        (noise.shift ^ (noise.shift >> (noise.mode ? 6 : 1))) & 1;
+    noise.shift = (noise.shift >> 1) | (feedback << 14);
+    set_level(noise.level, noise.output(), noise_weight, noise.next);
+  }
+}
+
+void Apu::run_dmc(uint64_t until) {
+  Dmc &dmc = m_dmc;
+  if (dmc.next > until)
+    return;
+  if (dmc.silence && !dmc.full && !dmc.remaining) {
+    // nothing to play until a sample starts, only the bit counter moves.
+    uint64_t steps = (until - dmc.next) / dmc.period + 1;
+    dmc.bits = (dmc.bits + 7 - steps % 8) % 8 + 1;
+    dmc.next += steps * dmc.period;
+    return;
+  }
+  for (; dmc.next <= until; dmc.next += dmc.period) {
+    if (!dmc.silence) {
+      uint8_t level = dmc.level;
+      if (dmc.shift & 1) {
+        if (level <= 125)
+          level += 2;
+      } else if (level >= 2) {
+        level -= 2;
+      }
+      set_level(dmc.level, level, dmc_weight, dmc.next);
+    }
+    dmc.shift >>= 1;
+    if (--dmc.bits)
+      continue;
+
+    dmc.bits = 8;
+    dmc.silence = !dmc.full;
+    if (dmc.full) {
+      dmc.shift = dmc.buffer;
+      dmc.full = false;
+      fetch();
+    }
+  }
+}
+
+void Apu::frame_step() {
+  uint64_t time = m_frame_next;
+  const uint16_t *steps = m_five_step ? five_steps : four_steps;
+  size_t count = m_five_step ? std::size(five_steps) : std::size(four_steps);
+
+  switch (m_frame_step) {
+  case 0:
+  case 2:
+    quarter_frame();
+    break;
+  case 1:
+    quarter_frame();
+    half_frame();
+    break;
+  case 3:
+    // 5 step mode does nothing on the fourth step.
+    if (m_five_step)
+      break;
+    quarter_frame();
+    half_frame();
+    if (!m_inhibit) {
+      m_frame_irq = true;
+      m_cpu->irq(true, Cpu::irq_frame_counter);
+    }
+    break;
+  case 4:
+    quarter_frame();
+    half_frame();
+    break;
+  }
+  update(time);
+
+  uint64_t start = time - steps[m_frame_step];
+  if (++m_frame_step == count) {
+    m_frame_step = 0;
+    start += steps[count - 1] + 1;
+  }
+  m_frame_next = start + steps[m_frame_step];
+}
+
+void Apu::quarter_frame() {
+  m_pulse[0].envelope.clock();
+  m_pulse[1].envelope.clock();
+  m_noise.envelope.clock();
+
+  if (m_triangle.reload)
+    m_triangle.linear = m_triangle.linear_reload;
+  else if (m_triangle.linear)
+    m_triangle.linear--;
+  if (!m_triangle.control)
+    m_triangle.reload = false;
+}
+
+void Apu::half_frame() {
+  for (Pulse &pulse : m_pulse) {
+    if (!pulse.envelope.loop && pulse.length)
+      pulse.length--;
+    pulse.sweep();
+  }
+  if (!m_triangle.control && m_triangle.length)
+    m_triangle.length--;
+  if (!m_noise.envelope.loop && m_noise.length)
+    m_noise.length--;
+}
+
+void Apu::fetch() {
+  Dmc &dmc = m_dmc;
+  if (dmc.full || !dmc.remaining)
+    return;
+  dmc.buffer = m_bus->read(dmc.address);
+  dmc.full = true;
+  dmc.address = dmc.address == 0xFFFF ? 0x8000 : dmc.address + 1;
+  if (--dmc.remaining)
+    return;
+
+  if (dmc.loop) {
+    dmc.address = dmc.start;
+    dmc.remaining = dmc.size;
+  } else if (dmc.irq_enabled) {
+    m_dmc_irq = true;
+    m_cpu->irq(true, Cpu::irq_dmc);
+  }
+}
+
+void Apu::set_level(uint8_t &level, uint8_t value, int32_t weight,
+                    uint64_t time) {
+  if (value == level)
+    return;
+  m_blip.add_delta(time - m_batch, (value - level) * weight);
+  level = value;
+}
+
+void Apu::update(uint64_t time) {
+  set_level(m_pulse[0].level, m_pulse[0].output(), pulse_weight, time);
+  set_level(m_pulse[1].level, m_pulse[1].output(), pulse_weight, time);
+  set_level(m_triangle.level, m_triangle.output(), triangle_weight, time);
+  set_level(m_noise.level, m_noise.output(), noise_weight, time);
+}
+
+void Apu::schedule() {
+  uint64_t time = m_frame_next;
+  const Dmc &dmc = m_dmc;
+  if (dmc.irq_enabled && !dmc.loop && dmc.remaining && dmc.full) {
+    // the last byte is fetched when the shift register takes the byte
+    // before it.
+    uint64_t steps = dmc.bits - 1 + 8 * (dmc.remaining - 1);
+    time = std::min(time, dmc.next + steps * dmc.period);
+  }
+  m_cpu->scheduler().schedule(Event::apu, time);
+}
+
+void Apu::Envelope::clock() {
+  if (start) {
+    start = false;
+    decay = 15;
+    divider = period;
+  } else if (divider) {
+    divider--;
+  } else {
+    divider = period;
+    if (decay)
+      decay--;
+    else if (loop)
+      decay = 15;
+  }
+}
+
+uint16_t Apu::Pulse::target() const {
+  uint16_t change = period >> shift;
+  if (!negate)
+    return period + change;
+  return std::max(period - change - ones_complement, 0);
+}
+
+uint8_t Apu::Pulse::output() const {
+  if (muted() || !length || !((duty_table[duty] >> step) & 1))
+    return 0;
+  return envelope.volume();
+}
+
+void Apu::Pulse::sweep() {
+  if (!sweep_divider && sweep_enabled && shift && !muted())
+    period = target();
+  if (!sweep_divider || reload) {
+    sweep_divider = sweep_period;
+    reload = false;
+  } else {
+    sweep_divider--;
+  }
+}
+
+uint8_t Apu::Triangle::output() const {
+  return step < 16 ? 15 - step : step - 16;
+}
+
+uint8_t Apu::Noise::output() const {
+  if ((shift & 1) || !length)
+    return 0;
+  return envelope.volume();
+}
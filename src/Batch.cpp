@@ -0,0 +1,144 @@
+#include "Batch.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <thread>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // namespace
+
+Batch::Batch(std::vector<Job> jobs)
+    : m_jobs(std::move(jobs)), m_results(m_jobs.size()), m_seconds(0) {}
+
+void Batch::run(size_t threads) {
+  if (!threads)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::max<size_t>(std::min(threads, m_jobs.size()), 1);
+
+  auto start = Clock::now();
+  for (const Job &job : m_jobs) {
+    std::shared_ptr<Rom> &rom = m_roms[job.path];
+    if (!rom) {
+      rom = std::make_shared<Rom>();
+      rom->open(job.path.c_str());
+    }
+  }
+
+  // contiguous runs of the same image let workers reuse their consoles.
+  std::vector<size_t> order(m_jobs.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return m_jobs[a].path < m_jobs[b].path;
+  });
+  m_queues.clear();
+  for (size_t i = 0; i < threads; i++) {
+    m_queues.push_back(std::make_unique<Queue>());
+    m_queues.back()->jobs.assign(order.begin() + order.size() * i / threads,
+                                 order.begin() +
+                                     order.size() * (i + 1) / threads);
+  }
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < threads; i++)
+    workers.emplace_back(&Batch::work, this, i);
+  work(0);
+  for (std::thread &worker : workers)
+    worker.join();
+  m_seconds = since(start);
+}
+
+uint64_t Batch::frames() const {
+  uint64_t frames = 0;
+  for (const Result &result : m_results)
+    frames += result.frames;
+  return frames;
+}
+
+void Batch::work(size_t worker) {
+  Arena arena;
+  size_t job;
+  while (take(worker, job))
+    run_job(arena, job);
+}
+
+bool Batch::take(size_t worker, size_t &job) {
+  {
+    Queue &queue = *m_queues[worker];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.jobs.empty()) {
+      job = queue.jobs.front();
+      queue.jobs.pop_front();
+      return true;
+    }
+  }
+
+  // jobs are never added, so once every queue is empty the run is over.
+  for (size_t i = 1; i < m_queues.size(); i++) {
+    Queue &victim = *m_queues[(worker + i) % m_queues.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.jobs.empty()) {
+      job = victim.jobs.back();
+      victim.jobs.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void Batch::run_job(Arena &arena, size_t index) {
+  auto start = Clock::now();
+  const Job &job = m_jobs[index];
+  Result &result = m_results[index];
+  result = {};
+
+  const std::shared_ptr<Rom> &rom = m_roms.at(job.path);
+  if (arena.rom != rom.get()) {
+    arena.nes.reset();
+    arena.rom = rom.get();
+    if (rom->is_open())
+      arena.nes = Nes::open(rom);
+    if (arena.nes)
+      arena.nes->save_state(arena.power_on);
+  } else if (arena.nes) {
+    arena.nes->load_state(arena.power_on.data(), arena.power_on.size());
+  }
+  if (!arena.nes) {
+    result.seconds = since(start);
+    return;
+  }
+
+  using Format = FrameSink::Format;
+  size_t frame_size = FrameSink::frame_size(Format::index);
+  arena.frames.resize(2 * frame_size);
+  uint8_t *buffers[] = {arena.frames.data(), arena.frames.data() + frame_size};
+  FrameSink sink(Format::index, buffers, 2);
+
+  Nes &nes = *arena.nes;
+  nes.set_frame_sink(&sink);
+  for (uint64_t i = 0; i < job.frames && !nes.cpu().halted(); i++) {
+    nes.set_buttons(0, i < job.buttons.size() ? job.buttons[i] : 0);
+    nes.run_frame();
+  }
+  nes.set_frame_sink(nullptr);
+
+  result.ok = true;
+  result.frames = sink.frame_count();
+  result.cycles = nes.cpu().clock();
+  if (result.frames) {
+    // FNV-1a.
+    uint64_t hash = 0xCBF29CE484222325;
+    const uint8_t *frame = sink.acquire();
+    for (size_t i = 0; i < frame_size; i++)
+      hash = (hash ^ frame[i]) * 0x100000001B3;
+    result.hash = hash;
+  }
+  result.seconds = since(start);
+}
@@ -0,0 +1,89 @@
+#include "Blip.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+/// Cut off frequency as a fraction of the Nyquist frequency of samples.
+constexpr double cutoff = 0.9;
+
+/// High pass removing DC, the sum loses 1 / (1 << bass_shift) per sample.
+constexpr unsigned bass_shift = 9;
+
+} // namespace
+
+Blip::Blip(double clock_rate, double sample_rate, size_t capacity)
+    : m_factor(std::llround(sample_rate / clock_rate * 4294967296.0)),
+      m_offset(0), m_sum(0), m_kernels(kernels()), m_buffer(capacity + taps) {}
+
+const Blip::Kernels &Blip::kernels() {
+  static const struct Table {
+    Kernels kernels;
+
+    Table() {
+      const double pi = std::acos(-1.0);
+      for (size_t phase = 0; phase < phases; phase++) {
+        // sinc impulse centered at the step, with Blackman window.
+        double impulse[taps], total = 0;
+        for (size_t i = 0; i < taps; i++) {
+          double x = i - (taps / 2 - 1.0) - (double)phase / phases;
+          double t = x * cutoff * pi;
+          double sinc = t == 0 ? 1 : std::sin(t) / t;
+          double w = (x + taps / 2) / taps;
+          double window = 0.42 - 0.5 * std::cos(2 * pi * w) +
+                          0.08 * std::cos(4 * pi * w);
+          impulse[i] = sinc * window;
+          total += impulse[i];
+        }
+
+        // rounding error goes to the middle tap, so every step sums exactly.
+        int sum = 0;
+        for (size_t i = 0; i < taps; i++) {
+          kernels[phase][i] = std::lround(impulse[i] / total * (1 << 15));
+          sum += kernels[phase][i];
+        }
+        kernels[phase][taps / 2] += (1 << 15) - sum;
+      }
+    }
+  } table;
+  return table.kernels;
+}
+
+void Blip::end_batch(uint64_t time) { m_offset += time * m_factor; }
+
+size_t Blip::read(int16_t *out, size_t count) {
+  // deltas of completed batches reach at most taps past available().
+  size_t used = available() + taps;
+  count = std::min(count, available());
+  for (size_t i = 0; i < count; i++) {
+    m_sum += m_buffer[i];
+    int64_t sample = m_sum >> 15;
+    out[i] = std::clamp<int64_t>(sample, INT16_MIN, INT16_MAX);
+    m_sum -= sample << (15 - bass_shift);
+  }
+
+  std::copy(m_buffer.begin() + count, m_buffer.begin() + used,
+            m_buffer.begin());
+  std::fill(m_buffer.begin() + used - count, m_buffer.begin() + used, 0);
+  m_offset -= (uint64_t)count << fraction_bits;
+  return count;
+}
+
+void Blip::save(state::Writer &state) const {
+  state.write(m_offset);
+  state.write(m_sum);
+  uint32_t used = available() + taps;
+  state.write(used);
+  state.write(m_buffer.data(), used * sizeof(m_buffer[0]));
+}
+
+void Blip::load(state::Reader &state) {
+  uint32_t used;
+  state.read(m_offset);
+  state.read(m_sum);
+  state.read(used);
+  used = std::min<size_t>(used, m_buffer.size());
+  state.read(m_buffer.data(), used * sizeof(m_buffer[0]));
+  std::fill(m_buffer.begin() + used, m_buffer.end(), 0);
+}
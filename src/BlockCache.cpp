@@ -0,0 +1,124 @@
+#include "BlockCache.hpp"
+
+using Op = Cpu::Operation;
+using Mode = Cpu::Addressing;
+
+/// Number of operand bytes following the opcode, indexed by Cpu::Addressing.
+static constexpr uint8_t s_operand_length[] = {
+    0, // implicit
+    1, // immediate
+    2, // absolute
+    1, // zero_page
+    1, // relative
+    2, // absolute_x
+    2, // absolute_y
+    1, // zero_page_x
+    1, // zero_page_y
+    1, // indirect
+    1, // indexed_indirect
+    1, // indirect_indexed
+};
+
+static_assert(sizeof(s_operand_length) == (size_t)Mode::count,
+              "every addressing mode needs operand length");
+
+/**
+ * @return true if operation may change the program counter.
+ */
+static bool ends_block(Op operation) {
+  switch (operation) {
+  case Op::BPL:
+  case Op::BMI:
+  case Op::BVC:
+  case Op::BVS:
+  case Op::BCC:
+  case Op::BCS:
+  case Op::BNE:
+  case Op::BEQ:
+  case Op::BRK:
+  case Op::RTI:
+  case Op::JSR:
+  case Op::RTS:
+  case Op::JMP:
+  case Op::KIL:
+    return true;
+  default:
+    return false;
+  }
+}
+
+BlockCache::BlockCache(Bus *bus)
+    : m_bus(bus), m_blocks(), m_current(nullptr), m_next(0), m_next_pc(0) {}
+
+const Cpu::Decoded *BlockCache::find(uint16_t pc) {
+  // common case, next instruction of the block being executed.
+  if (m_current && pc == m_next_pc && m_next < m_current->length &&
+      m_bus->version(m_current->page) == m_current->version) {
+    const Cpu::Decoded *instruction = &m_current->instructions[m_next++];
+    m_next_pc += instruction->length;
+    return instruction;
+  }
+
+  Block &block = m_blocks[pc % block_count];
+  if (!block.length || block.pc != pc ||
+      m_bus->version(block.page) != block.version) {
+    if (!decode(block, pc)) {
+      m_current = nullptr;
+      return nullptr;
+    }
+  }
+
+  m_current = &block;
+  m_next = 1;
+  m_next_pc = pc + block.instructions[0].length;
+  return &block.instructions[0];
+}
+
+bool BlockCache::decode(Block &block, uint16_t pc) {
+  uint8_t page = pc >> 8;
+  const uint8_t *memory = m_bus->memory(page);
+
+  block.length = 0;
+  if (!memory)
+    return false;
+
+  // code in RAM has to be decoded again once it is written.
+  m_bus->watch(page);
+
+  block.pc = pc;
+  block.page = page;
+  block.version = m_bus->version(page);
+
+  while (block.length < max_block_length) {
+    uint8_t opcode = memory[pc & 0xff];
+    const Cpu::Instruction &instruction = Cpu::s_lookup[opcode];
+    uint8_t length = 1 + s_operand_length[(size_t)instruction.addressing];
+
+    // instructions crossing into the next page are left to the interpreter.
+    if ((uint16_t)(pc + length - 1) >> 8 != page)
+      break;
+
+    uint16_t operand = 0;
+    if (length == 3)
+      operand = memory[(pc + 1) & 0xff] | (memory[(pc + 2) & 0xff] << 8);
+    else if (length == 2)
+      operand = memory[(pc + 1) & 0xff];
+
+    if (instruction.addressing == Mode::immediate)
+      operand = pc + 1;
+    else if (instruction.addressing == Mode::relative && (operand & 0x80))
+      operand |= 0xFF00;
+
+    block.instructions[block.length++] = {opcode,
+                                          instruction.operation,
+                                          instruction.addressing,
+                                          length,
+                                          instruction.cycles,
+                                          operand};
+    pc += length;
+
+    if (ends_block(instruction.operation) || pc >> 8 != page)
+      break;
+  }
+  return block.length > 0;
+}
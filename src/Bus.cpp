@@ -1,14 +1,134 @@
 #include "Bus.hpp"
 
-Bus::Bus() {}
+#include <cassert>
+#include <limits>
+
+Bus::Bus() : m_versions(), m_ram(0x800) {
+  unmap(0x0000, 0xffff);
+  map(0x0000, 0x1fff, &m_ram);
+}
+
 Bus::~Bus() {}
 
-uint8_t Bus::read(uint16_t address) const {
-  if (address <= 0xffff)
-    return m_ram[address];
+uint8_t Bus::read_device(uint16_t address) const {
+  if (m_devices[address >> 8])
+    return m_devices[address >> 8]->read(address);
   return 0;
 }
-void Bus::write(uint16_t address, uint8_t data) {
-  if (address <= 0xffff)
-    m_ram[address] = data;
+
+uint64_t Bus::stable_until(uint16_t address) const {
+  Device *device = m_devices[address >> 8];
+  if (m_read_pages[address >> 8] || !device)
+    return std::numeric_limits<uint64_t>::max();
+  return device->stable_until(address);
+}
+
+void Bus::write_device(uint16_t address, uint8_t data) {
+  if (m_watched[address >> 8]) {
+    uint8_t *memory = m_read_pages[address >> 8];
+    memory[address & 0xff] = data;
+
+    // memory may be mirrored, every page mapping it has to see the write.
+    for (size_t page = 0; page < page_count; page++) {
+      if (m_watched[page] && m_read_pages[page] == memory) {
+        m_watched[page] = false;
+        m_write_pages[page] = memory;
+        m_versions[page]++;
+      }
+    }
+  } else if (Memory *memory = m_memories[address >> 8]) {
+    // the page is shared with a fork, every page mapping it gets the copy.
+    uint8_t index = m_memory_pages[address >> 8];
+    memory->own(index)[address & 0xff] = data;
+    for (size_t page = 0; page < page_count; page++) {
+      if (m_memories[page] == memory && m_memory_pages[page] == index)
+        map_memory(page);
+    }
+  } else if (m_devices[address >> 8]) {
+    m_devices[address >> 8]->write(address, data);
+  }
+}
+
+void Bus::watch(uint8_t page) {
+  uint8_t *memory = m_write_pages[page];
+  if (!memory)
+    return;
+
+  for (size_t alias = 0; alias < page_count; alias++) {
+    if (m_write_pages[alias] == memory) {
+      m_write_pages[alias] = nullptr;
+      m_watched[alias] = true;
+    }
+  }
+}
+
+void Bus::map(uint16_t first, uint16_t last, uint8_t *memory, size_t size,
+              bool writable, Device *device) {
+  assert((first & 0xff) == 0x00 && (last & 0xff) == 0xff);
+  assert(size >= page_size && size % page_size == 0);
+
+  for (size_t page = first >> 8; page <= (size_t)(last >> 8); page++) {
+    uint8_t *data = memory + (((page - (first >> 8)) * page_size) % size);
+    m_read_pages[page] = data;
+    m_write_pages[page] = writable ? data : nullptr;
+    m_devices[page] = writable ? nullptr : device;
+    m_watched[page] = false;
+    m_memories[page] = nullptr;
+    m_versions[page]++;
+  }
+}
+
+void Bus::map(uint16_t first, uint16_t last, Memory *memory) {
+  assert((first & 0xff) == 0x00 && (last & 0xff) == 0xff);
+  assert(memory->page_count());
+
+  for (size_t page = first >> 8; page <= (size_t)(last >> 8); page++) {
+    m_devices[page] = nullptr;
+    m_memories[page] = memory;
+    m_memory_pages[page] = (page - (first >> 8)) % memory->page_count();
+    map_memory(page);
+  }
+}
+
+void Bus::remap() {
+  for (size_t page = 0; page < page_count; page++) {
+    if (m_memories[page])
+      map_memory(page);
+  }
+}
+
+void Bus::map_memory(size_t page) {
+  Memory *memory = m_memories[page];
+  size_t index = m_memory_pages[page];
+  // pages are never written through m_read_pages.
+  m_read_pages[page] = const_cast<uint8_t *>(memory->page(index));
+  m_write_pages[page] = memory->shared(index) ? nullptr : m_read_pages[page];
+  m_watched[page] = false;
+  m_versions[page]++;
+}
+
+void Bus::map(uint16_t first, uint16_t last, Device *device) {
+  assert((first & 0xff) == 0x00 && (last & 0xff) == 0xff);
+
+  for (size_t page = first >> 8; page <= (size_t)(last >> 8); page++) {
+    m_read_pages[page] = nullptr;
+    m_write_pages[page] = nullptr;
+    m_devices[page] = device;
+    m_watched[page] = false;
+    m_memories[page] = nullptr;
+    m_versions[page]++;
+  }
+}
+
+void Bus::unmap(uint16_t first, uint16_t last) {
+  assert((first & 0xff) == 0x00 && (last & 0xff) == 0xff);
+
+  for (size_t page = first >> 8; page <= (size_t)(last >> 8); page++) {
+    m_read_pages[page] = nullptr;
+    m_write_pages[page] = nullptr;
+    m_devices[page] = nullptr;
+    m_watched[page] = false;
+    m_memories[page] = nullptr;
+    m_versions[page]++;
+  }
 }
@@ -1,266 +1,369 @@
 #include "Cpu.hpp"
+#include "BlockCache.hpp"
+#include "IdleLoop.hpp"
+#include "Trace.hpp"
 
-#include <iostream>
+#ifdef NES_JIT
+#include "Jit.hpp"
+#endif
 
-Cpu::Cpu(Bus *bus) : m_bus(bus), m_halt(false), m_cycles(0) {
-  m_lookup = {
-      {"BRK", &Cpu::BRK, &Cpu::implicit_addressing, 7},
-      {"ORA", &Cpu::ORA, &Cpu::indexed_indirect, 6},
-      {"KIL", &Cpu::KIL, &Cpu::implicit_addressing, 0},
-      {"NOP", &Cpu::NOP, &Cpu::indexed_indirect, 8},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_addressing, 3},
-      {"ORA", &Cpu::ORA, &Cpu::zero_page_addressing, 3},
-      {"ASL", &Cpu::ASL, &Cpu::zero_page_addressing, 5},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_addressing, 5},
-      {"PHP", &Cpu::PHP, &Cpu::implicit_addressing, 3},
-      {"ORA", &Cpu::ORA, &Cpu::immediate_addressing, 2},
-      {"ASL", &Cpu::ASL, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::immediate_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_addressing, 4},
-      {"ORA", &Cpu::ORA, &Cpu::absolute_addressing, 4},
-      {"ASL", &Cpu::ASL, &Cpu::absolute_addressing, 6},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_addressing, 6},
-      {"BPL", &Cpu::BPL, &Cpu::relative_addressing, 2},
-      {"ORA", &Cpu::ORA, &Cpu::indirect_indexed, 5},
-      {"KIL", &Cpu::KIL, &Cpu::implicit_addressing, 0},
-      {"NOP", &Cpu::NOP, &Cpu::indirect_indexed, 8},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_x_indexed, 4},
-      {"ORA", &Cpu::ORA, &Cpu::zero_page_x_indexed, 4},
-      {"ASL", &Cpu::ASL, &Cpu::zero_page_x_indexed, 6},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_x_indexed, 6},
-      {"CLC", &Cpu::CLC, &Cpu::implicit_addressing, 2},
-      {"ORA", &Cpu::ORA, &Cpu::absolute_y_indexed, 4},
-      {"NOP", &Cpu::NOP, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_y_indexed, 7},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_x_indexed, 4},
-      {"ORA", &Cpu::ORA, &Cpu::absolute_x_indexed, 4},
-      {"ASL", &Cpu::ASL, &Cpu::absolute_x_indexed, 7},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_x_indexed, 7},
-      {"JSR", &Cpu::JSR, &Cpu::absolute_addressing, 6},
-      {"AND", &Cpu::AND, &Cpu::indexed_indirect, 6},
-      {"KIL", &Cpu::KIL, &Cpu::implicit_addressing, 0},
-      {"NOP", &Cpu::NOP, &Cpu::indexed_indirect, 8},
-      {"BIT", &Cpu::BIT, &Cpu::zero_page_addressing, 3},
-      {"AND", &Cpu::AND, &Cpu::zero_page_addressing, 3},
-      {"ROL", &Cpu::ROL, &Cpu::zero_page_addressing, 5},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_addressing, 5},
-      {"PLP", &Cpu::PLP, &Cpu::implicit_addressing, 4},
-      {"AND", &Cpu::AND, &Cpu::immediate_addressing, 2},
-      {"ROL", &Cpu::ROL, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::immediate_addressing, 2},
-      {"BIT", &Cpu::BIT, &Cpu::absolute_addressing, 4},
-      {"AND", &Cpu::AND, &Cpu::absolute_addressing, 4},
-      {"ROL", &Cpu::ROL, &Cpu::absolute_addressing, 6},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_addressing, 6},
-      {"BMI", &Cpu::BMI, &Cpu::relative_addressing, 2},
-      {"AND", &Cpu::AND, &Cpu::indirect_indexed, 5},
-      {"KIL", &Cpu::KIL, &Cpu::implicit_addressing, 0},
-      {"NOP", &Cpu::NOP, &Cpu::indirect_indexed, 8},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_x_indexed, 4},
-      {"AND", &Cpu::AND, &Cpu::zero_page_x_indexed, 4},
-      {"ROL", &Cpu::ROL, &Cpu::zero_page_x_indexed, 6},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_x_indexed, 6},
-      {"SEC", &Cpu::SEC, &Cpu::implicit_addressing, 2},
-      {"AND", &Cpu::AND, &Cpu::absolute_y_indexed, 4},
-      {"NOP", &Cpu::NOP, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_y_indexed, 7},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_x_indexed, 4},
-      {"AND", &Cpu::AND, &Cpu::absolute_x_indexed, 4},
-      {"ROL", &Cpu::ROL, &Cpu::absolute_x_indexed, 7},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_x_indexed, 7},
-      {"RTI", &Cpu::RTI, &Cpu::implicit_addressing, 6},
-      {"EOR", &Cpu::EOR, &Cpu::indexed_indirect, 6},
-      {"KIL", &Cpu::KIL, &Cpu::implicit_addressing, 0},
-      {"NOP", &Cpu::NOP, &Cpu::indexed_indirect, 8},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_addressing, 3},
-      {"EOR", &Cpu::EOR, &Cpu::zero_page_addressing, 3},
-      {"LSR", &Cpu::LSR, &Cpu::zero_page_addressing, 5},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_addressing, 5},
-      {"PHA", &Cpu::PHA, &Cpu::implicit_addressing, 3},
-      {"EOR", &Cpu::EOR, &Cpu::immediate_addressing, 2},
-      {"LSR", &Cpu::LSR, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::immediate_addressing, 2},
-      {"JMP", &Cpu::JMP, &Cpu::absolute_addressing, 3},
-      {"EOR", &Cpu::EOR, &Cpu::absolute_addressing, 4},
-      {"LSR", &Cpu::LSR, &Cpu::absolute_addressing, 6},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_addressing, 6},
-      {"BVC", &Cpu::BVC, &Cpu::relative_addressing, 2},
-      {"EOR", &Cpu::EOR, &Cpu::indirect_indexed, 5},
-      {"KIL", &Cpu::KIL, &Cpu::implicit_addressing, 0},
-      {"NOP", &Cpu::NOP, &Cpu::indirect_indexed, 8},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_x_indexed, 4},
-      {"EOR", &Cpu::EOR, &Cpu::zero_page_x_indexed, 4},
-      {"LSR", &Cpu::LSR, &Cpu::zero_page_x_indexed, 6},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_x_indexed, 6},
-      {"CLI", &Cpu::CLI, &Cpu::implicit_addressing, 2},
-      {"EOR", &Cpu::EOR, &Cpu::absolute_y_indexed, 4},
-      {"NOP", &Cpu::NOP, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_y_indexed, 7},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_x_indexed, 4},
-      {"EOR", &Cpu::EOR, &Cpu::absolute_x_indexed, 4},
-      {"LSR", &Cpu::LSR, &Cpu::absolute_x_indexed, 7},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_x_indexed, 7},
-      {"RTS", &Cpu::RTS, &Cpu::implicit_addressing, 6},
-      {"ADC", &Cpu::ADC, &Cpu::indexed_indirect, 6},
-      {"KIL", &Cpu::KIL, &Cpu::implicit_addressing, 0},
-      {"NOP", &Cpu::NOP, &Cpu::indexed_indirect, 8},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_addressing, 3},
-      {"ADC", &Cpu::ADC, &Cpu::zero_page_addressing, 3},
-      {"ROR", &Cpu::ROR, &Cpu::zero_page_addressing, 5},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_addressing, 5},
-      {"PLA", &Cpu::PLA, &Cpu::implicit_addressing, 4},
-      {"ADC", &Cpu::ADC, &Cpu::immediate_addressing, 2},
-      {"ROR", &Cpu::ROR, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::immediate_addressing, 2},
-      {"JMP", &Cpu::JMP, &Cpu::indirect_addressing, 5},
-      {"ADC", &Cpu::ADC, &Cpu::absolute_addressing, 4},
-      {"ROR", &Cpu::ROR, &Cpu::absolute_addressing, 6},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_addressing, 6},
-      {"BVS", &Cpu::BVS, &Cpu::relative_addressing, 2},
-      {"ADC", &Cpu::ADC, &Cpu::indirect_indexed, 5},
-      {"KIL", &Cpu::KIL, &Cpu::implicit_addressing, 0},
-      {"NOP", &Cpu::NOP, &Cpu::indirect_indexed, 8},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_x_indexed, 4},
-      {"ADC", &Cpu::ADC, &Cpu::zero_page_x_indexed, 4},
-      {"ROR", &Cpu::ROR, &Cpu::zero_page_x_indexed, 6},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_x_indexed, 6},
-      {"SEI", &Cpu::SEI, &Cpu::implicit_addressing, 2},
-      {"ADC", &Cpu::ADC, &Cpu::absolute_y_indexed, 4},
-      {"NOP", &Cpu::NOP, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_y_indexed, 7},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_x_indexed, 4},
-      {"ADC", &Cpu::ADC, &Cpu::absolute_x_indexed, 4},
-      {"ROR", &Cpu::ROR, &Cpu::absolute_x_indexed, 7},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_x_indexed, 7},
-      {"NOP", &Cpu::NOP, &Cpu::immediate_addressing, 2},
-      {"STA", &Cpu::STA, &Cpu::indexed_indirect, 6},
-      {"NOP", &Cpu::NOP, &Cpu::immediate_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::indexed_indirect, 6},
-      {"STY", &Cpu::STY, &Cpu::zero_page_addressing, 3},
-      {"STA", &Cpu::STA, &Cpu::zero_page_addressing, 3},
-      {"STX", &Cpu::STX, &Cpu::zero_page_addressing, 3},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_addressing, 3},
-      {"DEY", &Cpu::DEY, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::immediate_addressing, 2},
-      {"TXA", &Cpu::TXA, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::immediate_addressing, 2},
-      {"STY", &Cpu::STY, &Cpu::absolute_addressing, 4},
-      {"STA", &Cpu::STA, &Cpu::absolute_addressing, 4},
-      {"STX", &Cpu::STX, &Cpu::absolute_addressing, 4},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_addressing, 4},
-      {"BCC", &Cpu::BCC, &Cpu::relative_addressing, 2},
-      {"STA", &Cpu::STA, &Cpu::indirect_indexed, 6},
-      {"KIL", &Cpu::KIL, &Cpu::implicit_addressing, 0},
-      {"NOP", &Cpu::NOP, &Cpu::indirect_indexed, 6},
-      {"STY", &Cpu::STY, &Cpu::zero_page_x_indexed, 4},
-      {"STA", &Cpu::STA, &Cpu::zero_page_x_indexed, 4},
-      {"STX", &Cpu::STX, &Cpu::zero_page_y_indexed, 4},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_y_indexed, 4},
-      {"TYA", &Cpu::TYA, &Cpu::implicit_addressing, 2},
-      {"STA", &Cpu::STA, &Cpu::absolute_y_indexed, 5},
-      {"TXS", &Cpu::TXS, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_y_indexed, 5},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_x_indexed, 5},
-      {"STA", &Cpu::STA, &Cpu::absolute_x_indexed, 5},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_y_indexed, 5},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_y_indexed, 5},
-      {"LDY", &Cpu::LDY, &Cpu::immediate_addressing, 2},
-      {"LDA", &Cpu::LDA, &Cpu::indexed_indirect, 6},
-      {"LDX", &Cpu::LDX, &Cpu::immediate_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::indexed_indirect, 6},
-      {"LDY", &Cpu::LDY, &Cpu::zero_page_addressing, 3},
-      {"LDA", &Cpu::LDA, &Cpu::zero_page_addressing, 3},
-      {"LDX", &Cpu::LDX, &Cpu::zero_page_addressing, 3},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_addressing, 3},
-      {"TAY", &Cpu::TAY, &Cpu::implicit_addressing, 2},
-      {"LDA", &Cpu::LDA, &Cpu::immediate_addressing, 2},
-      {"TAX", &Cpu::TAX, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::immediate_addressing, 2},
-      {"LDY", &Cpu::LDY, &Cpu::absolute_addressing, 4},
-      {"LDA", &Cpu::LDA, &Cpu::absolute_addressing, 4},
-      {"LDX", &Cpu::LDX, &Cpu::absolute_addressing, 4},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_addressing, 4},
-      {"BCS", &Cpu::BCS, &Cpu::relative_addressing, 2},
-      {"LDA", &Cpu::LDA, &Cpu::indirect_indexed, 5},
-      {"KIL", &Cpu::KIL, &Cpu::implicit_addressing, 0},
-      {"NOP", &Cpu::NOP, &Cpu::indirect_indexed, 5},
-      {"LDY", &Cpu::LDY, &Cpu::zero_page_x_indexed, 4},
-      {"LDA", &Cpu::LDA, &Cpu::zero_page_x_indexed, 4},
-      {"LDX", &Cpu::LDX, &Cpu::zero_page_y_indexed, 4},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_y_indexed, 4},
-      {"CLV", &Cpu::CLV, &Cpu::implicit_addressing, 2},
-      {"LDA", &Cpu::LDA, &Cpu::absolute_y_indexed, 4},
-      {"TSX", &Cpu::TSX, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_y_indexed, 4},
-      {"LDY", &Cpu::LDY, &Cpu::absolute_x_indexed, 4},
-      {"LDA", &Cpu::LDA, &Cpu::absolute_x_indexed, 4},
-      {"LDX", &Cpu::LDX, &Cpu::absolute_y_indexed, 4},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_y_indexed, 4},
-      {"CPY", &Cpu::CPY, &Cpu::immediate_addressing, 2},
-      {"CMP", &Cpu::CMP, &Cpu::indexed_indirect, 6},
-      {"NOP", &Cpu::NOP, &Cpu::immediate_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::indexed_indirect, 8},
-      {"CPY", &Cpu::CPY, &Cpu::zero_page_addressing, 3},
-      {"CMP", &Cpu::CMP, &Cpu::zero_page_addressing, 3},
-      {"DEC", &Cpu::DEC, &Cpu::zero_page_addressing, 5},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_addressing, 5},
-      {"INY", &Cpu::INY, &Cpu::implicit_addressing, 2},
-      {"CMP", &Cpu::CMP, &Cpu::immediate_addressing, 2},
-      {"DEX", &Cpu::DEX, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::immediate_addressing, 2},
-      {"CPY", &Cpu::CPY, &Cpu::absolute_addressing, 4},
-      {"CMP", &Cpu::CMP, &Cpu::absolute_addressing, 4},
-      {"DEC", &Cpu::DEC, &Cpu::absolute_addressing, 6},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_addressing, 6},
-      {"BNE", &Cpu::BNE, &Cpu::relative_addressing, 2},
-      {"CMP", &Cpu::CMP, &Cpu::indirect_indexed, 5},
-      {"KIL", &Cpu::KIL, &Cpu::implicit_addressing, 0},
-      {"NOP", &Cpu::NOP, &Cpu::indirect_indexed, 8},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_x_indexed, 4},
-      {"CMP", &Cpu::CMP, &Cpu::zero_page_x_indexed, 4},
-      {"DEC", &Cpu::DEC, &Cpu::zero_page_x_indexed, 6},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_x_indexed, 6},
-      {"CLD", &Cpu::CLD, &Cpu::implicit_addressing, 2},
-      {"CMP", &Cpu::CMP, &Cpu::absolute_y_indexed, 4},
-      {"NOP", &Cpu::NOP, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_y_indexed, 7},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_x_indexed, 4},
-      {"CMP", &Cpu::CMP, &Cpu::absolute_x_indexed, 4},
-      {"DEC", &Cpu::DEC, &Cpu::absolute_x_indexed, 7},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_x_indexed, 7},
-      {"CPX", &Cpu::CPX, &Cpu::immediate_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::indexed_indirect, 6},
-      {"NOP", &Cpu::NOP, &Cpu::immediate_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::indexed_indirect, 8},
-      {"CPX", &Cpu::CPX, &Cpu::zero_page_addressing, 3},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_addressing, 3},
-      {"INC", &Cpu::INC, &Cpu::zero_page_addressing, 5},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_addressing, 5},
-      {"INX", &Cpu::INX, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::immediate_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::immediate_addressing, 2},
-      {"CPX", &Cpu::CPX, &Cpu::absolute_addressing, 4},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_addressing, 4},
-      {"INC", &Cpu::INC, &Cpu::absolute_addressing, 6},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_addressing, 6},
-      {"BEQ", &Cpu::BEQ, &Cpu::relative_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::indirect_indexed, 5},
-      {"KIL", &Cpu::KIL, &Cpu::implicit_addressing, 0},
-      {"NOP", &Cpu::NOP, &Cpu::indirect_indexed, 8},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_x_indexed, 4},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_x_indexed, 4},
-      {"INC", &Cpu::INC, &Cpu::zero_page_x_indexed, 6},
-      {"NOP", &Cpu::NOP, &Cpu::zero_page_x_indexed, 6},
-      {"SED", &Cpu::SED, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_y_indexed, 4},
-      {"NOP", &Cpu::NOP, &Cpu::implicit_addressing, 2},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_y_indexed, 7},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_x_indexed, 4},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_x_indexed, 4},
-      {"INC", &Cpu::INC, &Cpu::absolute_x_indexed, 7},
-      {"NOP", &Cpu::NOP, &Cpu::absolute_x_indexed, 7},
-  };
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+
+using Op = Cpu::Operation;
+using Mode = Cpu::Addressing;
+
+static_assert(std::is_trivially_copyable<Cpu::Instruction>::value,
+              "opcode table entries must be trivially copyable");
+static_assert(sizeof(Cpu::Instruction) == 3,
+              "opcode table must stay 768 bytes");
+
+constexpr Cpu::Instruction Cpu::s_lookup[256] = {
+    {Op::BRK, Mode::implicit, 7},
+    {Op::ORA, Mode::indexed_indirect, 6},
+    {Op::KIL, Mode::implicit, 0},
+    {Op::NOP, Mode::indexed_indirect, 8},
+    {Op::NOP, Mode::zero_page, 3},
+    {Op::ORA, Mode::zero_page, 3},
+    {Op::ASL, Mode::zero_page, 5},
+    {Op::NOP, Mode::zero_page, 5},
+    {Op::PHP, Mode::implicit, 3},
+    {Op::ORA, Mode::immediate, 2},
+    {Op::ASL_A, Mode::implicit, 2},
+    {Op::NOP, Mode::immediate, 2},
+    {Op::NOP, Mode::absolute, 4},
+    {Op::ORA, Mode::absolute, 4},
+    {Op::ASL, Mode::absolute, 6},
+    {Op::NOP, Mode::absolute, 6},
+    {Op::BPL, Mode::relative, 2},
+    {Op::ORA, Mode::indirect_indexed, 5},
+    {Op::KIL, Mode::implicit, 0},
+    {Op::NOP, Mode::indirect_indexed, 8},
+    {Op::NOP, Mode::zero_page_x, 4},
+    {Op::ORA, Mode::zero_page_x, 4},
+    {Op::ASL, Mode::zero_page_x, 6},
+    {Op::NOP, Mode::zero_page_x, 6},
+    {Op::CLC, Mode::implicit, 2},
+    {Op::ORA, Mode::absolute_y, 4},
+    {Op::NOP, Mode::implicit, 2},
+    {Op::NOP, Mode::absolute_y, 7},
+    {Op::NOP, Mode::absolute_x, 4},
+    {Op::ORA, Mode::absolute_x, 4},
+    {Op::ASL, Mode::absolute_x, 7},
+    {Op::NOP, Mode::absolute_x, 7},
+    {Op::JSR, Mode::absolute, 6},
+    {Op::AND, Mode::indexed_indirect, 6},
+    {Op::KIL, Mode::implicit, 0},
+    {Op::NOP, Mode::indexed_indirect, 8},
+    {Op::BIT, Mode::zero_page, 3},
+    {Op::AND, Mode::zero_page, 3},
+    {Op::ROL, Mode::zero_page, 5},
+    {Op::NOP, Mode::zero_page, 5},
+    {Op::PLP, Mode::implicit, 4},
+    {Op::AND, Mode::immediate, 2},
+    {Op::ROL_A, Mode::implicit, 2},
+    {Op::NOP, Mode::immediate, 2},
+    {Op::BIT, Mode::absolute, 4},
+    {Op::AND, Mode::absolute, 4},
+    {Op::ROL, Mode::absolute, 6},
+    {Op::NOP, Mode::absolute, 6},
+    {Op::BMI, Mode::relative, 2},
+    {Op::AND, Mode::indirect_indexed, 5},
+    {Op::KIL, Mode::implicit, 0},
+    {Op::NOP, Mode::indirect_indexed, 8},
+    {Op::NOP, Mode::zero_page_x, 4},
+    {Op::AND, Mode::zero_page_x, 4},
+    {Op::ROL, Mode::zero_page_x, 6},
+    {Op::NOP, Mode::zero_page_x, 6},
+    {Op::SEC, Mode::implicit, 2},
+    {Op::AND, Mode::absolute_y, 4},
+    {Op::NOP, Mode::implicit, 2},
+    {Op::NOP, Mode::absolute_y, 7},
+    {Op::NOP, Mode::absolute_x, 4},
+    {Op::AND, Mode::absolute_x, 4},
+    {Op::ROL, Mode::absolute_x, 7},
+    {Op::NOP, Mode::absolute_x, 7},
+    {Op::RTI, Mode::implicit, 6},
+    {Op::EOR, Mode::indexed_indirect, 6},
+    {Op::KIL, Mode::implicit, 0},
+    {Op::NOP, Mode::indexed_indirect, 8},
+    {Op::NOP, Mode::zero_page, 3},
+    {Op::EOR, Mode::zero_page, 3},
+    {Op::LSR, Mode::zero_page, 5},
+    {Op::NOP, Mode::zero_page, 5},
+    {Op::PHA, Mode::implicit, 3},
+    {Op::EOR, Mode::immediate, 2},
+    {Op::LSR_A, Mode::implicit, 2},
+    {Op::NOP, Mode::immediate, 2},
+    {Op::JMP, Mode::absolute, 3},
+    {Op::EOR, Mode::absolute, 4},
+    {Op::LSR, Mode::absolute, 6},
+    {Op::NOP, Mode::absolute, 6},
+    {Op::BVC, Mode::relative, 2},
+    {Op::EOR, Mode::indirect_indexed, 5},
+    {Op::KIL, Mode::implicit, 0},
+    {Op::NOP, Mode::indirect_indexed, 8},
+    {Op::NOP, Mode::zero_page_x, 4},
+    {Op::EOR, Mode::zero_page_x, 4},
+    {Op::LSR, Mode::zero_page_x, 6},
+    {Op::NOP, Mode::zero_page_x, 6},
+    {Op::CLI, Mode::implicit, 2},
+    {Op::EOR, Mode::absolute_y, 4},
+    {Op::NOP, Mode::implicit, 2},
+    {Op::NOP, Mode::absolute_y, 7},
+    {Op::NOP, Mode::absolute_x, 4},
+    {Op::EOR, Mode::absolute_x, 4},
+    {Op::LSR, Mode::absolute_x, 7},
+    {Op::NOP, Mode::absolute_x, 7},
+    {Op::RTS, Mode::implicit, 6},
+    {Op::ADC, Mode::indexed_indirect, 6},
+    {Op::KIL, Mode::implicit, 0},
+    {Op::NOP, Mode::indexed_indirect, 8},
+    {Op::NOP, Mode::zero_page, 3},
+    {Op::ADC, Mode::zero_page, 3},
+    {Op::ROR, Mode::zero_page, 5},
+    {Op::NOP, Mode::zero_page, 5},
+    {Op::PLA, Mode::implicit, 4},
+    {Op::ADC, Mode::immediate, 2},
+    {Op::ROR_A, Mode::implicit, 2},
+    {Op::NOP, Mode::immediate, 2},
+    {Op::JMP, Mode::indirect, 5},
+    {Op::ADC, Mode::absolute, 4},
+    {Op::ROR, Mode::absolute, 6},
+    {Op::NOP, Mode::absolute, 6},
+    {Op::BVS, Mode::relative, 2},
+    {Op::ADC, Mode::indirect_indexed, 5},
+    {Op::KIL, Mode::implicit, 0},
+    {Op::NOP, Mode::indirect_indexed, 8},
+    {Op::NOP, Mode::zero_page_x, 4},
+    {Op::ADC, Mode::zero_page_x, 4},
+    {Op::ROR, Mode::zero_page_x, 6},
+    {Op::NOP, Mode::zero_page_x, 6},
+    {Op::SEI, Mode::implicit, 2},
+    {Op::ADC, Mode::absolute_y, 4},
+    {Op::NOP, Mode::implicit, 2},
+    {Op::NOP, Mode::absolute_y, 7},
+    {Op::NOP, Mode::absolute_x, 4},
+    {Op::ADC, Mode::absolute_x, 4},
+    {Op::ROR, Mode::absolute_x, 7},
+    {Op::NOP, Mode::absolute_x, 7},
+    {Op::NOP, Mode::immediate, 2},
+    {Op::STA, Mode::indexed_indirect, 6},
+    {Op::NOP, Mode::immediate, 2},
+    {Op::NOP, Mode::indexed_indirect, 6},
+    {Op::STY, Mode::zero_page, 3},
+    {Op::STA, Mode::zero_page, 3},
+    {Op::STX, Mode::zero_page, 3},
+    {Op::NOP, Mode::zero_page, 3},
+    {Op::DEY, Mode::implicit, 2},
+    {Op::NOP, Mode::immediate, 2},
+    {Op::TXA, Mode::implicit, 2},
+    {Op::NOP, Mode::immediate, 2},
+    {Op::STY, Mode::absolute, 4},
+    {Op::STA, Mode::absolute, 4},
+    {Op::STX, Mode::absolute, 4},
+    {Op::NOP, Mode::absolute, 4},
+    {Op::BCC, Mode::relative, 2},
+    {Op::STA, Mode::indirect_indexed, 6},
+    {Op::KIL, Mode::implicit, 0},
+    {Op::NOP, Mode::indirect_indexed, 6},
+    {Op::STY, Mode::zero_page_x, 4},
+    {Op::STA, Mode::zero_page_x, 4},
+    {Op::STX, Mode::zero_page_y, 4},
+    {Op::NOP, Mode::zero_page_y, 4},
+    {Op::TYA, Mode::implicit, 2},
+    {Op::STA, Mode::absolute_y, 5},
+    {Op::TXS, Mode::implicit, 2},
+    {Op::NOP, Mode::absolute_y, 5},
+    {Op::NOP, Mode::absolute_x, 5},
+    {Op::STA, Mode::absolute_x, 5},
+    {Op::NOP, Mode::absolute_y, 5},
+    {Op::NOP, Mode::absolute_y, 5},
+    {Op::LDY, Mode::immediate, 2},
+    {Op::LDA, Mode::indexed_indirect, 6},
+    {Op::LDX, Mode::immediate, 2},
+    {Op::NOP, Mode::indexed_indirect, 6},
+    {Op::LDY, Mode::zero_page, 3},
+    {Op::LDA, Mode::zero_page, 3},
+    {Op::LDX, Mode::zero_page, 3},
+    {Op::NOP, Mode::zero_page, 3},
+    {Op::TAY, Mode::implicit, 2},
+    {Op::LDA, Mode::immediate, 2},
+    {Op::TAX, Mode::implicit, 2},
+    {Op::NOP, Mode::immediate, 2},
+    {Op::LDY, Mode::absolute, 4},
+    {Op::LDA, Mode::absolute, 4},
+    {Op::LDX, Mode::absolute, 4},
+    {Op::NOP, Mode::absolute, 4},
+    {Op::BCS, Mode::relative, 2},
+    {Op::LDA, Mode::indirect_indexed, 5},
+    {Op::KIL, Mode::implicit, 0},
+    {Op::NOP, Mode::indirect_indexed, 5},
+    {Op::LDY, Mode::zero_page_x, 4},
+    {Op::LDA, Mode::zero_page_x, 4},
+    {Op::LDX, Mode::zero_page_y, 4},
+    {Op::NOP, Mode::zero_page_y, 4},
+    {Op::CLV, Mode::implicit, 2},
+    {Op::LDA, Mode::absolute_y, 4},
+    {Op::TSX, Mode::implicit, 2},
+    {Op::NOP, Mode::absolute_y, 4},
+    {Op::LDY, Mode::absolute_x, 4},
+    {Op::LDA, Mode::absolute_x, 4},
+    {Op::LDX, Mode::absolute_y, 4},
+    {Op::NOP, Mode::absolute_y, 4},
+    {Op::CPY, Mode::immediate, 2},
+    {Op::CMP, Mode::indexed_indirect, 6},
+    {Op::NOP, Mode::immediate, 2},
+    {Op::NOP, Mode::indexed_indirect, 8},
+    {Op::CPY, Mode::zero_page, 3},
+    {Op::CMP, Mode::zero_page, 3},
+    {Op::DEC, Mode::zero_page, 5},
+    {Op::NOP, Mode::zero_page, 5},
+    {Op::INY, Mode::implicit, 2},
+    {Op::CMP, Mode::immediate, 2},
+    {Op::DEX, Mode::implicit, 2},
+    {Op::NOP, Mode::immediate, 2},
+    {Op::CPY, Mode::absolute, 4},
+    {Op::CMP, Mode::absolute, 4},
+    {Op::DEC, Mode::absolute, 6},
+    {Op::NOP, Mode::absolute, 6},
+    {Op::BNE, Mode::relative, 2},
+    {Op::CMP, Mode::indirect_indexed, 5},
+    {Op::KIL, Mode::implicit, 0},
+    {Op::NOP, Mode::indirect_indexed, 8},
+    {Op::NOP, Mode::zero_page_x, 4},
+    {Op::CMP, Mode::zero_page_x, 4},
+    {Op::DEC, Mode::zero_page_x, 6},
+    {Op::NOP, Mode::zero_page_x, 6},
+    {Op::CLD, Mode::implicit, 2},
+    {Op::CMP, Mode::absolute_y, 4},
+    {Op::NOP, Mode::implicit, 2},
+    {Op::NOP, Mode::absolute_y, 7},
+    {Op::NOP, Mode::absolute_x, 4},
+    {Op::CMP, Mode::absolute_x, 4},
+    {Op::DEC, Mode::absolute_x, 7},
+    {Op::NOP, Mode::absolute_x, 7},
+    {Op::CPX, Mode::immediate, 2},
+    {Op::NOP, Mode::indexed_indirect, 6},
+    {Op::NOP, Mode::immediate, 2},
+    {Op::NOP, Mode::indexed_indirect, 8},
+    {Op::CPX, Mode::zero_page, 3},
+    {Op::NOP, Mode::zero_page, 3},
+    {Op::INC, Mode::zero_page, 5},
+    {Op::NOP, Mode::zero_page, 5},
+    {Op::INX, Mode::implicit, 2},
+    {Op::NOP, Mode::immediate, 2},
+    {Op::NOP, Mode::implicit, 2},
+    {Op::NOP, Mode::immediate, 2},
+    {Op::CPX, Mode::absolute, 4},
+    {Op::NOP, Mode::absolute, 4},
+    {Op::INC, Mode::absolute, 6},
+    {Op::NOP, Mode::absolute, 6},
+    {Op::BEQ, Mode::relative, 2},
+    {Op::NOP, Mode::indirect_indexed, 5},
+    {Op::KIL, Mode::implicit, 0},
+    {Op::NOP, Mode::indirect_indexed, 8},
+    {Op::NOP, Mode::zero_page_x, 4},
+    {Op::NOP, Mode::zero_page_x, 4},
+    {Op::INC, Mode::zero_page_x, 6},
+    {Op::NOP, Mode::zero_page_x, 6},
+    {Op::SED, Mode::implicit, 2},
+    {Op::NOP, Mode::absolute_y, 4},
+    {Op::NOP, Mode::implicit, 2},
+    {Op::NOP, Mode::absolute_y, 7},
+    {Op::NOP, Mode::absolute_x, 4},
+    {Op::NOP, Mode::absolute_x, 4},
+    {Op::INC, Mode::absolute_x, 7},
+    {Op::NOP, Mode::absolute_x, 7},
+};
+
+constexpr uint8_t (Cpu::*const Cpu::s_operations[(size_t)Op::count])(void) = {
+    &Cpu::KIL, &Cpu::AND, &Cpu::ORA, &Cpu::EOR, &Cpu::ADC, &Cpu::SBC, &Cpu::CMP,
+    &Cpu::CPX, &Cpu::CPY, &Cpu::DEC, &Cpu::DEX, &Cpu::DEY, &Cpu::INC, &Cpu::INX,
+    &Cpu::INY, &Cpu::ASL<Operand::memory>, &Cpu::ROL<Operand::memory>,
+    &Cpu::LSR<Operand::memory>, &Cpu::ROR<Operand::memory>, &Cpu::LDA,
+    &Cpu::STA, &Cpu::LDX, &Cpu::STX, &Cpu::LDY, &Cpu::STY, &Cpu::TAX, &Cpu::TXA,
+    &Cpu::TAY, &Cpu::TYA, &Cpu::TSX, &Cpu::TXS, &Cpu::PLA, &Cpu::PHA, &Cpu::PLP,
+    &Cpu::PHP, &Cpu::BPL, &Cpu::BMI, &Cpu::BVC, &Cpu::BVS, &Cpu::BCC, &Cpu::BCS,
+    &Cpu::BNE, &Cpu::BEQ, &Cpu::BRK, &Cpu::RTI, &Cpu::JSR, &Cpu::RTS, &Cpu::JMP,
+    &Cpu::BIT, &Cpu::CLC, &Cpu::SEC, &Cpu::CLD, &Cpu::SED, &Cpu::CLI, &Cpu::SEI,
+    &Cpu::CLV, &Cpu::NOP, &Cpu::ASL<Operand::accumulator>,
+    &Cpu::ROL<Operand::accumulator>, &Cpu::LSR<Operand::accumulator>,
+    &Cpu::ROR<Operand::accumulator>,
+};
+
+constexpr uint8_t (Cpu::*const Cpu::s_addressing_modes[(size_t)Mode::count])(
+    void) = {
+    &Cpu::implicit_addressing, &Cpu::immediate_addressing,
+    &Cpu::absolute_addressing, &Cpu::zero_page_addressing,
+    &Cpu::relative_addressing, &Cpu::absolute_x_indexed,
+    &Cpu::absolute_y_indexed,  &Cpu::zero_page_x_indexed,
+    &Cpu::zero_page_y_indexed, &Cpu::indirect_addressing,
+    &Cpu::indexed_indirect,    &Cpu::indirect_indexed,
+};
+
+/// Mnemonics indexed by Cpu::Operation.
+static constexpr const char *s_mnemonics[] = {
+    "KIL", "AND", "ORA", "EOR", "ADC", "SBC", "CMP", "CPX", "CPY", "DEC",
+    "DEX", "DEY", "INC", "INX", "INY", "ASL", "ROL", "LSR", "ROR", "LDA",
+    "STA", "LDX", "STX", "LDY", "STY", "TAX", "TXA", "TAY", "TYA", "TSX",
+    "TXS", "PLA", "PHA", "PLP", "PHP", "BPL", "BMI", "BVC", "BVS", "BCC",
+    "BCS", "BNE", "BEQ", "BRK", "RTI", "JSR", "RTS", "JMP", "BIT", "CLC",
+    "SEC", "CLD", "SED", "CLI", "SEI", "CLV", "NOP", "ASL", "ROL", "LSR",
+    "ROR",
+};
+
+static_assert(sizeof(s_mnemonics) / sizeof(*s_mnemonics) == (size_t)Op::count,
+              "every operation needs a mnemonic");
+
+/// Names indexed by Cpu::Addressing.
+static constexpr const char *s_addressing_names[] = {
+    "implicit",    "immediate",  "absolute",         "zero_page",
+    "relative",    "absolute_x", "absolute_y",       "zero_page_x",
+    "zero_page_y", "indirect",   "indexed_indirect", "indirect_indexed",
+};
+
+static_assert(sizeof(s_addressing_names) / sizeof(*s_addressing_names) ==
+                  (size_t)Cpu::Addressing::count,
+              "every addressing mode needs a name");
+
+Cpu::Cpu(Bus *bus)
+    : m_bus(bus), m_a(0), m_x(0), m_y(0), m_s(0), m_pc(0), m_p(0),
+      m_nz(1), m_carry(0), m_overflow(false), m_effective_address(0),
+      m_fetched_data(0), m_halt(false), m_opcode(0), m_cycles(0), m_clock(0),
+      m_deadline(0), m_nmi(false), m_irq(0), m_hot_spots(nullptr),
+      m_trace(nullptr) {
+  // power on state, reset() leaves the stack pointer at $FD.
+  m_scheduler.set_handler(Scheduler::Event::nmi, this);
+  m_scheduler.set_handler(Scheduler::Event::irq, this);
+  m_scheduler.set_deadline(&m_deadline);
+  set_idle_loops(true);
+}
+
+Cpu::~Cpu() {}
+
+void Cpu::set_block_cache(bool enabled) {
+  if (!enabled)
+    m_block_cache.reset();
+  else if (!m_block_cache)
+    m_block_cache = std::make_unique<BlockCache>(m_bus);
+}
+
+void Cpu::set_idle_loops(bool enabled) {
+  if (!enabled)
+    m_idle_loop.reset();
+  else if (!m_idle_loop)
+    m_idle_loop = std::make_unique<IdleLoop>(m_bus);
+}
+
+const char *Cpu::mnemonic(uint8_t opcode) {
+  return s_mnemonics[(size_t)s_lookup[opcode].operation];
+}
+
+const char *Cpu::addressing_name(Addressing addressing) {
+  return s_addressing_names[(size_t)addressing];
 }
 
 void Cpu::log() const {
@@ -275,15 +378,19 @@ void Cpu::log() const {
   std::cout << "Flags             : N V X B D I Z C\n";
   std::cout << "                    ";
   for (int i = 7; i >= 0; i--) {
-    std::cout << (bool)(m_p & (1 << i)) << " ";
+    std::cout << (bool)(status() & (1 << i)) << " ";
   }
   std::cout << "\n";
 }
 
-void Cpu::test() {
+bool Cpu::test() {
   Bus bus;
   Cpu cpu(&bus);
 
+  // stands in for cartridge memory.
+  uint8_t prg[0x8000] = {};
+  bus.map(0x8000, 0xffff, prg, sizeof(prg), true);
+
   cpu.m_pc = 0xc0fd;
 
   cpu.m_s = 0x30;
@@ -302,26 +409,495 @@ void Cpu::test() {
 
   cpu.tick();
   cpu.log();
+
+  bool ok = test_interrupts();
+#ifdef NES_JIT
+  ok = test_jit() && ok;
+#endif
+  return ok;
 }
 
+bool Cpu::test_interrupts() {
+  Bus bus;
+  Cpu cpu(&bus);
+  uint8_t ram[0x800];
+  for (size_t i = 0; i < sizeof(ram); i++)
+    ram[i] = (uint8_t)i;
+  uint8_t zero_page[0x100];
+  std::memcpy(zero_page, ram, sizeof(zero_page));
+  bus.map(0x0000, 0x07ff, ram, sizeof(ram), true);
+
+  // BRK, its padding byte and NOP, both vectors point to RTI at $9000.
+  uint8_t prg[0x8000] = {0x00, 0xea, 0xea};
+  prg[0x1000] = 0x40;
+  prg[0x7ffa] = prg[0x7ffe] = 0x00;
+  prg[0x7ffb] = prg[0x7fff] = 0x90;
+  bus.map(0x8000, 0xffff, prg, sizeof(prg), false);
+
+  cpu.m_pc = 0x8000;
+  cpu.m_s = 0xff;
+  bool ok = true;
+  for (bool brk : {true, false}) {
+    if (brk) {
+      cpu.step();
+    } else {
+      cpu.nmi();
+      cpu.interrupt();
+    }
+    // TSX then $0101,X reads the status first.
+    ok &= cpu.m_pc == 0x9000 && cpu.m_s == 0xfc;
+    ok &= ram[0x1ff] == 0x80 && ram[0x1fe] == 0x02;
+    ok &= (bool)(ram[0x1fd] & break_command) == brk;
+    cpu.step();
+    ok &= cpu.m_pc == 0x8002 && cpu.m_s == 0xff;
+  }
+  ok &= !std::memcmp(zero_page, ram, sizeof(zero_page));
+  std::cout << "interrupt frames " << (ok ? "ok" : "FAILED") << "\n";
+  return ok;
+}
+
+#ifdef NES_JIT
+bool Cpu::test_jit() {
+  uint8_t ram[0x800] = {};
+  const uint8_t arithmetic[] = {
+      0x18,             // $0500 CLC
+      0xa5, 0x10,       // LDA $10
+      0x69, 0x37,       // ADC #$37
+      0x85, 0x10,       // STA $10
+      0xe5, 0x11,       // SBC $11, borrows the carry of ADC
+      0x85, 0x11,       // STA $11
+      0x70, 0x02,       // BVS $050F
+      0x49, 0x80,       // EOR #$80
+      0x24, 0x12,       // $050F BIT $12, V from $F8 whatever A is
+      0x50, 0x01,       // BVC $0514
+      0xe8,             // INX
+      0x7d, 0xf0, 0x05, // $0514 ADC $05F0,X, crosses a page from X = $10
+      0x99, 0xf0, 0x03, // STA $03F0,Y, crosses a page from Y = $10
+      0x71, 0x12,       // ADC ($12),Y, crosses a page from Y = 8
+      0xc8,             // INY
+      0x4c, 0x00, 0x02, // JMP $0200
+  };
+  const uint8_t modifying[] = {
+      0x8d, 0x06, 0x02, // $0200 STA $0206, into the block running
+      0xe8,             // INX
+      0xea,             // NOP
+      0xa9, 0x00,       // LDA #$00, operand written above
+      0x65, 0x11,       // ADC $11
+      0x4c, 0xf9, 0x06, // JMP $06F9
+  };
+  const uint8_t branches[] = {
+      0xca,             // $06F9 DEX
+      0x8a,             // TXA
+      0x29, 0x07,       // AND #$07
+      0xd0, 0x04,       // BNE $0703, crosses a page
+      0x4c, 0x00, 0x05, // $06FF JMP $0500
+      0xea,             // NOP
+      0x38,             // $0703 SEC
+      0xe9, 0x05,       // SBC #$05
+      0xb0, 0xf7,       // BCS $06FF, crosses a page
+      0x4c, 0x00, 0x05, // JMP $0500
+  };
+  std::memcpy(ram + 0x500, arithmetic, sizeof(arithmetic));
+  std::memcpy(ram + 0x200, modifying, sizeof(modifying));
+  std::memcpy(ram + 0x6f9, branches, sizeof(branches));
+  ram[0x11] = 0x5a;
+  ram[0x12] = 0xf8;
+  ram[0x13] = 0x07;
+
+  Bus buses[2];
+  uint8_t memory[2][sizeof(ram)];
+  Cpu interpreter(&buses[0]), recompiled(&buses[1]);
+  Cpu *cpus[] = {&interpreter, &recompiled};
+  for (int i = 0; i < 2; i++) {
+    std::memcpy(memory[i], ram, sizeof(ram));
+    buses[i].map(0x0000, 0x07ff, memory[i], sizeof(ram), true);
+    cpus[i]->set_idle_loops(false);
+    cpus[i]->m_pc = 0x0500;
+    cpus[i]->m_s = 0xfd;
+  }
+
+  bool ok = true;
+  for (uint64_t round = 0; round < 4000 && ok; round++) {
+    // budgets end mid block, run_to() takes its deadline from the clock.
+    uint64_t budget = 1 + round % 37;
+    uint64_t elapsed = 0;
+    while (elapsed < budget)
+      elapsed += interpreter.step();
+    if (round & 1)
+      recompiled.run_to(recompiled.m_clock + budget);
+    else
+      recompiled.run(budget);
+
+    ok &= interpreter.m_a == recompiled.m_a &&
+          interpreter.m_x == recompiled.m_x &&
+          interpreter.m_y == recompiled.m_y &&
+          interpreter.m_s == recompiled.m_s &&
+          interpreter.status() == recompiled.status() &&
+          interpreter.m_pc == recompiled.m_pc &&
+          interpreter.m_clock == recompiled.m_clock;
+    ok &= !std::memcmp(memory[0], memory[1], sizeof(ram));
+  }
+  std::cout << "jit against interpreter " << (ok ? "ok" : "FAILED") << "\n";
+  return ok;
+}
+#endif
+
 void Cpu::tick() {
-  if (!m_cycles) {
+  if (!m_cycles)
+    m_cycles = step();
+  m_cycles--;
+}
+
+uint8_t Cpu::step() {
+#ifdef NES_PROFILE
+  Profiler::Sample sample = m_profiler.begin();
+#endif
+  if (m_trace)
+    trace();
+  uint8_t cycles;
+  const Decoded *instruction =
+      m_block_cache ? m_block_cache->find(m_pc) : nullptr;
+  if (instruction) {
+    cycles = execute(*instruction);
+  } else {
     m_opcode = m_bus->read(m_pc++);
-    m_cycles = m_lookup[m_opcode].cycles;
-    m_cycles += (this->*m_lookup[m_opcode].addressing)();
-    m_cycles += (this->*m_lookup[m_opcode].exec)();
+    cycles = execute();
   }
-  m_cycles--;
+  m_clock += cycles;
+#ifdef NES_PROFILE
+  // both paths leave the opcode executed in m_opcode.
+  m_profiler.end(sample, m_opcode, cycles);
+#endif
+  return cycles;
+}
+
+void Cpu::trace() {
+  Trace::Record record;
+  record.clock = m_clock;
+  record.pc = m_pc;
+  // peeks at memory only, reads of devices have side effects.
+  for (uint16_t i = 0; i < sizeof(record.bytes); i++) {
+    uint16_t address = m_pc + i;
+    const uint8_t *page = m_bus->memory(address >> 8);
+    record.bytes[i] = page ? page[address & 0xFF] : 0;
+  }
+  record.a = m_a;
+  record.x = m_x;
+  record.y = m_y;
+  record.s = m_s;
+  // the unused bit reads as set, as in logs of other emulators.
+  record.p = status() | expansion;
+  m_trace->write(record);
+}
+
+uint64_t Cpu::run(uint64_t cycles) {
+#ifdef NES_JIT
+  if (!m_jit)
+    m_jit = std::make_unique<Jit>(m_bus);
+
+  // finish the instruction started by tick() first.
+  uint64_t elapsed = m_cycles;
+  m_cycles = 0;
+
+  while (elapsed < cycles && !m_halt) {
+    // blocks which may overshoot the budget are left to the interpreter.
+    uint64_t taken = m_trace ? 0 : m_jit->execute(*this, cycles - elapsed);
+    if (taken)
+      m_clock += taken;
+    else
+      taken = step();
+    elapsed += taken;
+  }
+  return elapsed;
+#else
+  return run_until([](const Cpu &) { return false; }, cycles);
+#endif
+}
+
+uint64_t Cpu::run_to(uint64_t time) {
+#ifdef NES_JIT
+  if (!m_jit)
+    m_jit = std::make_unique<Jit>(m_bus);
+#endif
+  uint64_t start = m_clock;
+  while (m_clock < time && !m_halt) {
+    // the scheduler lowers m_deadline when an event is scheduled earlier
+    // while instructions run.
+    m_deadline = std::min(time, m_scheduler.next());
+    while (m_clock < m_deadline && !m_halt) {
+      uint16_t pc = m_pc;
+#ifdef NES_JIT
+      if (uint64_t taken =
+              m_trace ? 0 : m_jit->execute(*this, m_deadline - m_clock))
+        m_clock += taken;
+      else
+        step();
+#else
+      step();
+#endif
+      // jumped back, maybe to the start of a loop waiting for an event,
+      // m_deadline is kept at the next one by Scheduler::set_deadline().
+      if (m_pc <= pc && m_idle_loop && !m_trace)
+        m_clock += m_idle_loop->skip(m_pc, m_clock, m_deadline);
+    }
+    m_scheduler.dispatch(m_clock);
+    interrupt();
+  }
+  // the interrupt sequence may have passed deadlines of events.
+  m_scheduler.dispatch(m_clock);
+  return m_clock - start;
 }
 
-void Cpu::set_flag(Flag flag, bool value) {
-  if (value)
-    m_p |= flag;
+void Cpu::reset() {
+  // reset runs the interrupt sequence with writes to the stack suppressed.
+  m_s -= 3;
+  set_flag(interrupt_disable, true);
+  m_pc = m_bus->read(0xFFFC);
+  m_pc |= ((uint16_t)m_bus->read(0xFFFD) << 8);
+  m_halt = false;
+  m_nmi = false;
+  m_cycles = 0;
+  m_clock += 7;
+  if (m_idle_loop)
+    m_idle_loop->reset();
+}
+
+void Cpu::save(state::Writer &state) const {
+  state.write(m_a);
+  state.write(m_x);
+  state.write(m_y);
+  state.write(m_s);
+  state.write(m_pc);
+  state.write(status());
+  state.write(m_cycles);
+  state.write(m_halt);
+  state.write(m_opcode);
+  state.write(m_clock);
+  state.write(m_nmi);
+  state.write(m_irq);
+  m_scheduler.save(state);
+}
+
+void Cpu::load(state::Reader &state) {
+  uint8_t p;
+  state.read(m_a);
+  state.read(m_x);
+  state.read(m_y);
+  state.read(m_s);
+  state.read(m_pc);
+  state.read(p);
+  set_status(p);
+  state.read(m_cycles);
+  state.read(m_halt);
+  state.read(m_opcode);
+  state.read(m_clock);
+  state.read(m_nmi);
+  state.read(m_irq);
+  m_scheduler.load(state);
+  m_deadline = 0;
+  if (m_idle_loop)
+    m_idle_loop->reset();
+}
+
+void Cpu::nmi() {
+  m_nmi = true;
+  m_deadline = 0;
+}
+
+void Cpu::irq(bool asserted, IrqSource source) {
+  if (asserted) {
+    m_irq |= source;
+    m_deadline = 0;
+  } else {
+    m_irq &= ~source;
+  }
+}
+
+void Cpu::interrupt() {
+  uint16_t vector;
+  if (m_nmi)
+    vector = 0xFFFA;
+  else if (m_irq && !get_flag(interrupt_disable))
+    vector = 0xFFFE;
   else
-    m_p &= ~flag;
+    return;
+  m_nmi = false;
+
+  // same frame as BRK, but with break flag clear.
+  push((m_pc >> 8) & 0xFF);
+  push(m_pc & 0xFF);
+  push(status() & ~break_command);
+  set_flag(interrupt_disable, true);
+
+  m_pc = m_bus->read(vector);
+  m_pc |= ((uint16_t)m_bus->read(vector + 1) << 8);
+  m_clock += 7;
+  if (m_idle_loop)
+    m_idle_loop->reset();
+  if (m_hot_spots)
+    m_hot_spots->call(vector == 0xFFFA ? HotSpots::Call::nmi
+                                       : HotSpots::Call::irq,
+                      m_pc, m_s);
+}
+
+void Cpu::handle(Scheduler::Event event, uint64_t) {
+  if (event == Scheduler::Event::nmi)
+    nmi();
+  else
+    irq(true);
+}
+
+uint64_t Cpu::run_until(const Breakpoints &breakpoints, uint64_t cycles) {
+  return run_until(
+      [&breakpoints](const Cpu &cpu) { return breakpoints.test(cpu.m_pc); },
+      cycles);
+}
+
+#ifdef NES_FUSED_CORE
+
+template <uint8_t opcode> uint8_t Cpu::execute() {
+  // both handlers are compile time constants, so they are inlined into one
+  // specialised function per opcode.
+  constexpr Instruction instruction = s_lookup[opcode];
+  constexpr auto addressing =
+      s_addressing_modes[(size_t)instruction.addressing];
+  constexpr auto operation = s_operations[(size_t)instruction.operation];
+
+  uint8_t cycles = instruction.cycles;
+  cycles += (this->*addressing)();
+  cycles += (this->*operation)();
+  return cycles;
+}
+
+template <uint8_t opcode> uint8_t Cpu::execute(uint16_t operand) {
+  constexpr Instruction instruction = s_lookup[opcode];
+  constexpr auto operation = s_operations[(size_t)instruction.operation];
+
+  uint8_t cycles = instruction.cycles;
+  cycles += resolve(instruction.addressing, operand);
+  cycles += (this->*operation)();
+  return cycles;
+}
+
+#define NES_CASE(n, ...)                                                       \
+  case n:                                                                      \
+    return execute<n>(__VA_ARGS__);
+#define NES_CASE_4(n, ...)                                                     \
+  NES_CASE(n, __VA_ARGS__)                                                     \
+  NES_CASE(n + 1, __VA_ARGS__)                                                 \
+  NES_CASE(n + 2, __VA_ARGS__)                                                 \
+  NES_CASE(n + 3, __VA_ARGS__)
+#define NES_CASE_16(n, ...)                                                    \
+  NES_CASE_4(n, __VA_ARGS__)                                                   \
+  NES_CASE_4(n + 4, __VA_ARGS__)                                               \
+  NES_CASE_4(n + 8, __VA_ARGS__)                                               \
+  NES_CASE_4(n + 12, __VA_ARGS__)
+#define NES_CASE_64(n, ...)                                                    \
+  NES_CASE_16(n, __VA_ARGS__)                                                  \
+  NES_CASE_16(n + 16, __VA_ARGS__)                                             \
+  NES_CASE_16(n + 32, __VA_ARGS__)                                             \
+  NES_CASE_16(n + 48, __VA_ARGS__)
+#define NES_SWITCH(...)                                                        \
+  switch (m_opcode) {                                                          \
+    NES_CASE_64(0x00, __VA_ARGS__)                                             \
+    NES_CASE_64(0x40, __VA_ARGS__)                                             \
+    NES_CASE_64(0x80, __VA_ARGS__)                                             \
+    NES_CASE_64(0xc0, __VA_ARGS__)                                             \
+  }
+
+uint8_t Cpu::execute() {
+  NES_SWITCH()
+  return 0;
+}
+
+uint8_t Cpu::execute(const Decoded &instruction) {
+  m_opcode = instruction.opcode;
+  m_pc += instruction.length;
+
+  NES_SWITCH(instruction.operand)
+  return 0;
+}
+
+#undef NES_SWITCH
+#undef NES_CASE_64
+#undef NES_CASE_16
+#undef NES_CASE_4
+#undef NES_CASE
+
+#else
+
+uint8_t Cpu::execute() {
+  const Instruction &instruction = s_lookup[m_opcode];
+  uint8_t cycles = instruction.cycles;
+  cycles += (this->*s_addressing_modes[(size_t)instruction.addressing])();
+  cycles += (this->*s_operations[(size_t)instruction.operation])();
+  return cycles;
+}
+
+uint8_t Cpu::execute(const Decoded &instruction) {
+  m_opcode = instruction.opcode;
+  m_pc += instruction.length;
+
+  uint8_t cycles = instruction.cycles;
+  cycles += resolve(instruction.addressing, instruction.operand);
+  cycles += (this->*s_operations[(size_t)instruction.operation])();
+  return cycles;
+}
+
+#endif
+
+void Cpu::set_flag(Flag flag, bool value) {
+  switch (flag) {
+  case carry:
+    m_carry = value;
+    break;
+  case overflow:
+    m_overflow = value;
+    break;
+  case zero:
+  case negative:
+    set_status(value ? status() | flag : status() & ~flag);
+    break;
+  default:
+    if (value)
+      m_p |= flag;
+    else
+      m_p &= ~flag;
+  }
+}
+
+uint8_t Cpu::get_flag(Flag flag) const {
+  switch (flag) {
+  case carry:
+    return m_carry;
+  case overflow:
+    return m_overflow;
+  case zero:
+    return !(m_nz & 0xFF);
+  case negative:
+    return (m_nz & 0x180) != 0;
+  default:
+    return (m_p & flag) > 0 ? 1 : 0;
+  }
+}
+
+uint8_t Cpu::status() const {
+  uint8_t p = m_p & ~(negative | overflow | zero | carry);
+  if (m_nz & 0x180)
+    p |= negative;
+  if (m_overflow)
+    p |= overflow;
+  if (!(m_nz & 0xFF))
+    p |= zero;
+  return p | m_carry;
 }
 
-uint8_t Cpu::get_flag(Flag flag) const { return (m_p & flag) > 0 ? 1 : 0; }
+void Cpu::set_status(uint8_t p) {
+  m_p = p;
+  m_nz = (p & zero ? 0 : 1) | (p & negative ? 0x100 : 0);
+  m_carry = p & carry;
+  m_overflow = p & overflow;
+}
 
 uint8_t Cpu::immediate_addressing() {
   m_effective_address = m_pc++;
@@ -329,13 +905,13 @@ uint8_t Cpu::immediate_addressing() {
 }
 
 void Cpu::push(uint8_t data) {
-  m_bus->write(m_s, data);
+  m_bus->write(0x0100 | m_s, data);
   m_s--;
 }
 
 uint8_t Cpu::pop() {
   m_s++;
-  return m_bus->read(m_s);
+  return m_bus->read(0x0100 | m_s);
 }
 
 uint8_t Cpu::implicit_addressing() { return 0; }
@@ -367,15 +943,7 @@ uint8_t Cpu::absolute_x_indexed() {
   // read high order byte.
   m_effective_address =
       ((uint16_t)m_bus->read(m_pc++) << 8) | m_effective_address;
-
-  uint8_t page = (m_effective_address & 0xFF00) >> 8;
-  m_effective_address += m_x;
-
-  /// Requries one extra cycle if page is changed.
-  if (page != ((m_effective_address & 0xFF00) >> 8))
-    return 1;
-
-  return 0;
+  return index_address(m_x);
 }
 
 uint8_t Cpu::absolute_y_indexed() {
@@ -384,15 +952,7 @@ uint8_t Cpu::absolute_y_indexed() {
   // read high order byte.
   m_effective_address =
       ((uint16_t)m_bus->read(m_pc++) << 8) | m_effective_address;
-
-  uint8_t page = (m_effective_address & 0xFF00) >> 8;
-  m_effective_address += m_y;
-
-  /// Requries one extra cycle if page is changed.
-  if (page != ((m_effective_address & 0xFF00) >> 8))
-    return 1;
-
-  return 0;
+  return index_address(m_y);
 }
 
 uint8_t Cpu::zero_page_x_indexed() {
@@ -415,28 +975,68 @@ uint8_t Cpu::indirect_addressing() {
 
 uint8_t Cpu::indexed_indirect() {
   // val = PEEK(PEEK((arg + X) % 256) + PEEK((arg + X + 1) % 256) * 256)
-  m_effective_address = m_bus->read(m_pc++);
-  m_effective_address =
-      m_bus->read((m_effective_address + m_x) % 256) +
-      m_bus->read((m_effective_address + m_x + 1) % 256) * 256;
+  m_effective_address = read_pointer(m_bus->read(m_pc++) + m_x);
   return 0;
 }
 
 uint8_t Cpu::indirect_indexed() {
   // val = PEEK(PEEK(arg) + PEEK((arg + 1) % 256) * 256 + Y)
-  m_effective_address = m_bus->read(m_pc++);
-  m_effective_address = m_bus->read(m_effective_address) +
-                        m_bus->read((m_effective_address + 1) % 256) * 256;
+  m_effective_address = read_pointer(m_bus->read(m_pc++));
+  return index_address(m_y);
+}
 
+uint8_t Cpu::index_address(uint8_t index) {
   uint8_t page = (m_effective_address & 0xFF00) >> 8;
-  m_effective_address += m_y;
+  m_effective_address += index;
 
+  /// Requries one extra cycle if page is changed.
   if (page != ((m_effective_address & 0xFF00) >> 8))
     return 1;
 
   return 0;
 }
 
+uint16_t Cpu::read_pointer(uint8_t address) {
+  return m_bus->read(address) | (m_bus->read((address + 1) % 256) << 8);
+}
+
+uint8_t Cpu::resolve(Addressing addressing, uint16_t operand) {
+  switch (addressing) {
+  case Addressing::implicit:
+    return 0;
+  case Addressing::immediate:
+  case Addressing::absolute:
+  case Addressing::zero_page:
+  case Addressing::relative:
+    m_effective_address = operand;
+    return 0;
+  case Addressing::absolute_x:
+    m_effective_address = operand;
+    return index_address(m_x);
+  case Addressing::absolute_y:
+    m_effective_address = operand;
+    return index_address(m_y);
+  case Addressing::zero_page_x:
+    m_effective_address = (operand + m_x) % 256;
+    return 0;
+  case Addressing::zero_page_y:
+    m_effective_address = (operand + m_y) % 256;
+    return 0;
+  case Addressing::indirect:
+    m_effective_address = ((uint16_t)m_bus->read(operand + 1) << 8) |
+                          (uint16_t)m_bus->read(operand);
+    return 0;
+  case Addressing::indexed_indirect:
+    m_effective_address = read_pointer(operand + m_x);
+    return 0;
+  case Addressing::indirect_indexed:
+    m_effective_address = read_pointer(operand);
+    return index_address(m_y);
+  default:
+    return 0;
+  }
+}
+
 uint8_t Cpu::KIL() {
   m_halt = true;
   return 0;
@@ -445,24 +1045,21 @@ uint8_t Cpu::KIL() {
 uint8_t Cpu::AND() {
   m_fetched_data = m_bus->read(m_effective_address);
   m_a &= m_fetched_data;
-  set_flag(zero, m_a == 0);
-  set_flag(negative, m_a & 0x80);
+  set_nz(m_a);
   return 0;
 }
 
 uint8_t Cpu::ORA() {
   m_fetched_data = m_bus->read(m_effective_address);
   m_a |= m_fetched_data;
-  set_flag(zero, m_a == 0);
-  set_flag(negative, m_a & 0x80);
+  set_nz(m_a);
   return 0;
 }
 
 uint8_t Cpu::EOR() {
   m_fetched_data = m_bus->read(m_effective_address);
   m_a ^= m_fetched_data;
-  set_flag(zero, m_a == 0);
-  set_flag(negative, m_a & 0x80);
+  set_nz(m_a);
   return 0;
 }
 
@@ -472,8 +1069,7 @@ uint8_t Cpu::ADC() {
   result = m_a + m_fetched_data + get_flag(carry);
   /// set appropriate flags.
   set_flag(carry, result > 255);
-  set_flag(zero, !(result & 0xFF));
-  set_flag(negative, result & 0x80);
+  set_nz(result);
 
   if ((m_a & 0x80) == (m_fetched_data & 0x80)) {
     // if both the numbers have same sign then their is possibility of overflow.
@@ -492,8 +1088,7 @@ uint8_t Cpu::SBC() {
   result = m_a - m_fetched_data - get_flag(carry);
 
   set_flag(carry, (result & 0x80) == 0);
-  set_flag(zero, !(result & 0xFF));
-  set_flag(negative, result & 0x80);
+  set_nz(result);
 
   if ((m_a & 0x80) != (m_fetched_data & 0x80)) {
     // if both the numbers have different sign then their is possibility of
@@ -511,8 +1106,7 @@ uint8_t Cpu::CMP() {
   m_fetched_data = m_bus->read(m_effective_address);
   result = m_a - m_fetched_data;
 
-  set_flag(zero, !(result & 0xFF));
-  set_flag(negative, result & 0x80);
+  set_nz(result);
   set_flag(carry, (m_fetched_data <= m_a));
   return 0;
 }
@@ -522,8 +1116,7 @@ uint8_t Cpu::CPX() {
   m_fetched_data = m_bus->read(m_effective_address);
   result = m_x - m_fetched_data;
 
-  set_flag(zero, !(result & 0xFF));
-  set_flag(negative, result & 0x80);
+  set_nz(result);
   set_flag(carry, m_fetched_data <= m_x);
   return 0;
 }
@@ -533,8 +1126,7 @@ uint8_t Cpu::CPY() {
   m_fetched_data = m_bus->read(m_effective_address);
   result = m_y - m_fetched_data;
 
-  set_flag(zero, !(result & 0xFF));
-  set_flag(negative, result & 0x80);
+  set_nz(result);
   set_flag(carry, m_fetched_data <= m_y);
   return 0;
 }
@@ -544,24 +1136,21 @@ uint8_t Cpu::DEC() {
   m_fetched_data--;
   m_bus->write(m_effective_address, m_fetched_data);
 
-  set_flag(zero, !m_fetched_data);
-  set_flag(negative, m_fetched_data & 0x80);
+  set_nz(m_fetched_data);
   return 0;
 }
 
 uint8_t Cpu::DEX() {
   m_x--;
 
-  set_flag(zero, !m_x);
-  set_flag(negative, m_x & 0x80);
+  set_nz(m_x);
   return 0;
 }
 
 uint8_t Cpu::DEY() {
   m_y--;
 
-  set_flag(zero, !m_y);
-  set_flag(negative, m_y & 0x80);
+  set_nz(m_y);
   return 0;
 }
 
@@ -570,124 +1159,94 @@ uint8_t Cpu::INC() {
   m_fetched_data++;
   m_bus->write(m_effective_address, m_fetched_data);
 
-  set_flag(zero, !m_fetched_data);
-  set_flag(negative, m_fetched_data & 0x80);
+  set_nz(m_fetched_data);
   return 0;
 }
 
 uint8_t Cpu::INX() {
   m_x++;
 
-  set_flag(zero, !m_x);
-  set_flag(negative, m_x & 0x80);
+  set_nz(m_x);
   return 0;
 }
 
 uint8_t Cpu::INY() {
   m_y++;
 
-  set_flag(zero, !m_y);
-  set_flag(negative, m_y & 0x80);
+  set_nz(m_y);
   return 0;
 }
 
-uint8_t Cpu::ASL() {
-  // TODO: implement for implied addressing mode.
+template <Cpu::Operand operand> uint8_t Cpu::load_operand() {
+  if constexpr (operand == Operand::accumulator)
+    return m_a;
+  else
+    return m_bus->read(m_effective_address);
+}
 
-  if (m_lookup[m_opcode].addressing == &Cpu::implicit_addressing) {
-    m_fetched_data = m_a;
-  } else {
-    m_fetched_data = m_bus->read(m_effective_address);
-  }
+template <Cpu::Operand operand> void Cpu::store_operand(uint8_t data) {
+  if constexpr (operand == Operand::accumulator)
+    m_a = data;
+  else
+    m_bus->write(m_effective_address, data);
+}
+
+template <Cpu::Operand operand> uint8_t Cpu::ASL() {
+  m_fetched_data = load_operand<operand>();
 
   set_flag(carry, m_fetched_data & 0x80);
   m_fetched_data = m_fetched_data << 1;
-  set_flag(negative, m_fetched_data & 0x80);
-  set_flag(zero, !m_fetched_data);
+  set_nz(m_fetched_data);
 
-  if (m_lookup[m_opcode].addressing == &Cpu::implicit_addressing) {
-    m_a = m_fetched_data;
-  } else {
-    m_bus->write(m_effective_address, m_fetched_data);
-  }
+  store_operand<operand>(m_fetched_data);
   return 0;
 }
 
-uint8_t Cpu::ROL() {
-
-  if (m_lookup[m_opcode].addressing == &Cpu::implicit_addressing) {
-    m_fetched_data = m_a;
-  } else {
-    m_fetched_data = m_bus->read(m_effective_address);
-  }
+template <Cpu::Operand operand> uint8_t Cpu::ROL() {
+  m_fetched_data = load_operand<operand>();
 
   uint8_t result = m_fetched_data << 1;
   result = result | get_flag(carry);
 
   // set flags
   set_flag(carry, m_fetched_data & 0x80);
-  set_flag(zero, !result);
-  set_flag(negative, result & 0x80);
-
-  if (m_lookup[m_opcode].addressing == &Cpu::implicit_addressing) {
-    m_a = result;
-  } else {
-    m_bus->write(m_effective_address, result);
-  }
+  set_nz(result);
 
+  store_operand<operand>(result);
   return 0;
 }
 
-uint8_t Cpu::LSR() {
-  if (m_lookup[m_opcode].addressing == &Cpu::implicit_addressing) {
-    m_fetched_data = m_a;
-  } else {
-    m_fetched_data = m_bus->read(m_effective_address);
-  }
+template <Cpu::Operand operand> uint8_t Cpu::LSR() {
+  m_fetched_data = load_operand<operand>();
 
   set_flag(carry, m_fetched_data & 1);
   m_fetched_data = m_fetched_data >> 1;
 
   // set flags.
-  set_flag(zero, !m_fetched_data);
-  set_flag(negative, m_fetched_data & 0x80);
+  set_nz(m_fetched_data);
 
-  if (m_lookup[m_opcode].addressing == &Cpu::implicit_addressing) {
-    m_a = m_fetched_data;
-  } else {
-    m_bus->write(m_effective_address, m_fetched_data);
-  }
+  store_operand<operand>(m_fetched_data);
   return 0;
 }
 
-uint8_t Cpu::ROR() {
-  if (m_lookup[m_opcode].addressing == &Cpu::implicit_addressing) {
-    m_fetched_data = m_a;
-  } else {
-    m_fetched_data = m_bus->read(m_effective_address);
-  }
+template <Cpu::Operand operand> uint8_t Cpu::ROR() {
+  m_fetched_data = load_operand<operand>();
 
   uint8_t result = m_fetched_data >> 1;
   result = result | (get_flag(carry) << 7);
 
   // set flags.
   set_flag(carry, m_fetched_data & 1);
-  set_flag(zero, !result);
-  set_flag(negative, result & 0x80);
+  set_nz(result);
 
-  if (m_lookup[m_opcode].addressing == &Cpu::implicit_addressing) {
-    m_a = result;
-  } else {
-    m_bus->write(m_effective_address, result);
-  }
+  store_operand<operand>(result);
   return 0;
 }
 
 uint8_t Cpu::LDA() {
   m_fetched_data = m_bus->read(m_effective_address);
   m_a = m_fetched_data;
-  set_flag(zero, !m_a);
-  set_flag(negative, m_a & 0x80);
+  set_nz(m_a);
   return 0;
 }
 
@@ -699,8 +1258,7 @@ uint8_t Cpu::STA() {
 uint8_t Cpu::LDX() {
   m_fetched_data = m_bus->read(m_effective_address);
   m_x = m_fetched_data;
-  set_flag(zero, !m_x);
-  set_flag(negative, m_x & 0x80);
+  set_nz(m_x);
   return 0;
 }
 
@@ -712,8 +1270,7 @@ uint8_t Cpu::STX() {
 uint8_t Cpu::LDY() {
   m_fetched_data = m_bus->read(m_effective_address);
   m_y = m_fetched_data;
-  set_flag(zero, !m_y);
-  set_flag(negative, m_y & 0x80);
+  set_nz(m_y);
   return 0;
 }
 
@@ -724,50 +1281,43 @@ uint8_t Cpu::STY() {
 
 uint8_t Cpu::TAX() {
   m_x = m_a;
-  set_flag(zero, !m_x);
-  set_flag(negative, m_x & 0x80);
+  set_nz(m_x);
   return 0;
 }
 
 uint8_t Cpu::TXA() {
   m_a = m_x;
-  set_flag(zero, !m_a);
-  set_flag(negative, m_a & 0x80);
+  set_nz(m_a);
   return 0;
 }
 
 uint8_t Cpu::TAY() {
   m_y = m_a;
-  set_flag(zero, !m_y);
-  set_flag(negative, m_y & 0x80);
+  set_nz(m_y);
   return 0;
 }
 
 uint8_t Cpu::TYA() {
   m_a = m_y;
-  set_flag(zero, !m_a);
-  set_flag(negative, m_a & 0x80);
+  set_nz(m_a);
   return 0;
 }
 
 uint8_t Cpu::TSX() {
   m_x = m_s;
-  set_flag(zero, !m_x);
-  set_flag(negative, m_x & 0x80);
+  set_nz(m_x);
   return 0;
 }
 
 uint8_t Cpu::TXS() {
   m_s = m_x;
-  set_flag(zero, !m_s);
-  set_flag(negative, m_s & 0x80);
+  set_nz(m_s);
   return 0;
 }
 
 uint8_t Cpu::PLA() {
   m_a = pop();
-  set_flag(zero, !m_a);
-  set_flag(negative, m_a & 0x80);
+  set_nz(m_a);
   return 0;
 }
 
@@ -777,12 +1327,15 @@ uint8_t Cpu::PHA() {
 }
 
 uint8_t Cpu::PLP() {
-  m_p = pop();
+  set_status(pop());
+  // a pending interrupt request may have been unmasked.
+  if (m_irq)
+    m_deadline = 0;
   return 0;
 }
 
 uint8_t Cpu::PHP() {
-  push(m_p);
+  push(status());
   return 0;
 }
 
@@ -877,26 +1430,33 @@ uint8_t Cpu::BEQ() {
 uint8_t Cpu::BRK() {
 
   m_pc++;
-  push(m_p);
-  // set break flag.
-  set_flag(break_command, true);
   // push high order byte of program counter.
   push((m_pc >> 8) & 0xFF);
   // push low order byte of program counter.
   push(m_pc & 0xFF);
+  // push status with break flag set, an interrupt pushes it clear.
+  push(status() | break_command);
+  // set break flag.
+  set_flag(break_command, true);
 
   m_pc = m_bus->read(0xFFFE);
   m_pc |= ((uint16_t)m_bus->read(0xFFFF) << 8);
+  if (m_hot_spots)
+    m_hot_spots->call(HotSpots::Call::brk, m_pc, m_s);
   return 0;
 }
 
 uint8_t Cpu::RTI() {
+  // read program status register.
+  set_status(pop());
   // read low order byte of program counter.
   m_pc = pop();
   // read high order byte of program counter.
   m_pc = ((uint16_t)pop() << 8) | m_pc;
-  // read program status register.
-  m_p = pop();
+  if (m_irq)
+    m_deadline = 0;
+  if (m_hot_spots)
+    m_hot_spots->unwind(m_s);
   return 0;
 }
 
@@ -907,6 +1467,8 @@ uint8_t Cpu::JSR() {
   push(m_pc & 0xFF);
 
   m_pc = m_effective_address;
+  if (m_hot_spots)
+    m_hot_spots->call(HotSpots::Call::subroutine, m_pc, m_s);
   return 0;
 }
 
@@ -915,6 +1477,8 @@ uint8_t Cpu::RTS() {
   m_pc = pop();
   // read high order byte of program counter.
   m_pc = ((uint16_t)pop() << 8) | m_pc;
+  if (m_hot_spots)
+    m_hot_spots->unwind(m_s);
   return 0;
 }
 
@@ -925,10 +1489,9 @@ uint8_t Cpu::JMP() {
 
 uint8_t Cpu::BIT() {
   m_fetched_data = m_bus->read(m_effective_address);
-  m_fetched_data &= m_a;
-  set_flag(negative, m_fetched_data & 0x80);
-  set_flag(overflow, m_fetched_data & 0x40);
-  set_flag(zero, !m_fetched_data);
+  // Z is taken from M & A, N and V from M.
+  m_nz = (m_fetched_data & m_a) | ((m_fetched_data & negative) << 1);
+  set_flag(overflow, m_fetched_data & overflow);
   return 0;
 }
 
@@ -953,6 +1516,8 @@ uint8_t Cpu::SED() {
 }
 uint8_t Cpu::CLI() {
   set_flag(interrupt_disable, false);
+  if (m_irq)
+    m_deadline = 0;
   return 0;
 }
 
@@ -0,0 +1,57 @@
+#include "FrameSink.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+/// Colors of the 2C02 without emphasis, red, green and blue in bits 16-23,
+/// 8-15 and 0-7.
+const uint32_t default_palette[64] = {
+    0x626262, 0x001FB2, 0x2404C8, 0x5200B2, 0x730076, 0x800024, 0x730B00,
+    0x522800, 0x244400, 0x005700, 0x005C00, 0x005324, 0x003C76, 0x000000,
+    0x000000, 0x000000, 0xABABAB, 0x0D57FF, 0x4B30FF, 0x8A13FF, 0xBC08D6,
+    0xD21269, 0xC72E00, 0x9D5400, 0x607B00, 0x209800, 0x00A300, 0x009942,
+    0x007DB4, 0x000000, 0x000000, 0x000000, 0xFFFFFF, 0x53AEFF, 0x9085FF,
+    0xD365FF, 0xFF57FF, 0xFF5DCF, 0xFF7757, 0xFA9E00, 0xBDC700, 0x7AE700,
+    0x43F611, 0x26EF7E, 0x2CD5F6, 0x4E4E4E, 0x000000, 0x000000, 0xFFFFFF,
+    0xB6E1FF, 0xCED1FF, 0xE9C3FF, 0xFFBCFF, 0xFFBDF4, 0xFFC6C3, 0xFFD59A,
+    0xE9E681, 0xCEF481, 0xB6FB9A, 0xA9FAC3, 0xA9F0F4, 0xB8B8B8, 0x000000,
+    0x000000};
+
+} // namespace
+
+FrameSink::FrameSink(Format format, uint8_t *const *buffers, size_t count)
+    : m_format(format), m_buffers(), m_count(std::min<size_t>(count, 3)),
+      m_back(0), m_front(1), m_ready(2), m_frame_count(0), m_line() {
+  std::copy(buffers, buffers + m_count, m_buffers);
+  set_palette(default_palette);
+}
+
+void FrameSink::set_palette(const uint32_t *palette) {
+  for (size_t i = 0; i < 64; i++) {
+    uint8_t rgba[4] = {uint8_t(palette[i] >> 16), uint8_t(palette[i] >> 8),
+                       uint8_t(palette[i]), 0xFF};
+    std::memcpy(&m_colors[i], rgba, sizeof(rgba));
+  }
+}
+
+const uint8_t *FrameSink::acquire() {
+  if (m_count == 3 && (m_ready.load(std::memory_order_relaxed) & fresh))
+    m_front = m_ready.exchange(m_front, std::memory_order_acquire) & 3;
+  return m_buffers[m_front];
+}
+
+void FrameSink::end_frame() {
+  if (m_count == 3)
+    m_back = m_ready.exchange(m_back | fresh, std::memory_order_acq_rel) & 3;
+  else
+    std::swap(m_back, m_front);
+  m_frame_count++;
+}
+
+void FrameSink::expand(size_t y) {
+  uint8_t *line = m_buffers[m_back] + y * width * 4;
+  for (size_t x = 0; x < width; x++)
+    std::memcpy(line + x * 4, &m_colors[m_line[x] & 0x3F], 4);
+}
@@ -0,0 +1,95 @@
+#include "HotSpots.hpp"
+
+#include "Cpu.hpp"
+
+#include <algorithm>
+
+namespace {
+
+/// Kind of the last entry of a key, the program counter sampled.
+constexpr uint32_t leaf = 0xFF;
+
+const char *const prefixes[] = {"sub_", "nmi_", "irq_", "brk_"};
+
+} // namespace
+
+HotSpots::HotSpots(Cpu *cpu, uint64_t interval)
+    : m_cpu(cpu), m_interval(std::max<uint64_t>(interval, 2)),
+      m_random(0x2545F491), m_samples(0), m_counts(0x10000) {
+  m_stack.reserve(max_depth);
+  m_pending.reserve(pending_capacity + max_depth + 2);
+  m_key.reserve(max_depth + 1);
+  m_cpu->set_hot_spots(this);
+  Scheduler &scheduler = m_cpu->scheduler();
+  scheduler.set_handler(Scheduler::Event::sample, this);
+  scheduler.schedule(Scheduler::Event::sample,
+                     m_cpu->clock() + next_interval());
+}
+
+HotSpots::~HotSpots() {
+  m_cpu->set_hot_spots(nullptr);
+  Scheduler &scheduler = m_cpu->scheduler();
+  scheduler.set_handler(Scheduler::Event::sample, nullptr);
+  scheduler.cancel(Scheduler::Event::sample);
+}
+
+void HotSpots::clear() {
+  m_samples = 0;
+  m_pending.clear();
+  std::fill(m_counts.begin(), m_counts.end(), 0);
+  m_stacks.clear();
+}
+
+void HotSpots::write_folded(std::FILE *out) const {
+  fold();
+  for (const auto &stack : m_stacks) {
+    std::fputs("main", out);
+    for (uint32_t frame : stack.first) {
+      uint32_t call = frame >> 16;
+      std::fprintf(out, ";%s$%04X", call == leaf ? "" : prefixes[call],
+                   frame & 0xFFFF);
+    }
+    std::fprintf(out, " %llu\n", (unsigned long long)stack.second);
+  }
+}
+
+void HotSpots::handle(Scheduler::Event, uint64_t) {
+  // drops frames the program unwound without returning.
+  unwind(m_cpu->stack_pointer());
+
+  m_samples++;
+  m_pending.push_back(m_stack.size());
+  for (const Frame &frame : m_stack)
+    m_pending.push_back((uint32_t)frame.call << 16 | frame.address);
+  m_pending.push_back(leaf << 16 | m_cpu->pc());
+  if (m_pending.size() >= pending_capacity)
+    fold();
+
+  // from the clock rather than the deadline, the cpu may have been stalled
+  // past it.
+  m_cpu->scheduler().schedule(Scheduler::Event::sample,
+                              m_cpu->clock() + next_interval());
+}
+
+void HotSpots::fold() const {
+  for (size_t i = 0; i < m_pending.size();) {
+    size_t depth = m_pending[i++];
+    m_key.assign(m_pending.begin() + i, m_pending.begin() + i + depth + 1);
+    i += depth + 1;
+    m_counts[m_key.back() & 0xFFFF]++;
+    auto stack = m_stacks.find(m_key);
+    if (stack != m_stacks.end())
+      stack->second++;
+    else
+      m_stacks.emplace(m_key, 1);
+  }
+  m_pending.clear();
+}
+
+uint64_t HotSpots::next_interval() {
+  // xorshift.
+  m_random ^= m_random << 13;
+  m_random ^= m_random >> 17;
+  m_random ^= m_random << 5;
+  return m_interval / 2 + m_random % (m_interval + 1);
+}
@@ -0,0 +1,204 @@
+#include "IdleLoop.hpp"
+
+#include <algorithm>
+
+using Op = Cpu::Operation;
+using Mode = Cpu::Addressing;
+
+namespace {
+
+/// Registers read and written by an instruction.
+enum Register : uint8_t { a = 1 << 0, x = 1 << 1, y = 1 << 2 };
+
+/// Flags of the status register.
+enum Flag : uint8_t { c = 0x01, z = 0x02, v = 0x40, n = 0x80 };
+
+/**
+ * Effect of an operation allowed in the body of an idle loop.
+ */
+struct Effect {
+  /// false if the operation is not allowed.
+  bool allowed;
+  /// Registers read and written.
+  uint8_t reads, writes;
+  /// Flags read and written.
+  uint8_t flags_read, flags_written;
+  /// true if the operand is read from memory unless immediate.
+  bool memory;
+};
+
+Effect effect(Op operation) {
+  switch (operation) {
+  case Op::LDA:
+    return {true, 0, a, 0, n | z, true};
+  case Op::LDX:
+    return {true, 0, x, 0, n | z, true};
+  case Op::LDY:
+    return {true, 0, y, 0, n | z, true};
+  case Op::CMP:
+    return {true, a, 0, 0, n | z | c, true};
+  case Op::CPX:
+    return {true, x, 0, 0, n | z | c, true};
+  case Op::CPY:
+    return {true, y, 0, 0, n | z | c, true};
+  case Op::BIT:
+    return {true, a, 0, 0, n | v | z, true};
+  case Op::AND:
+  case Op::ORA:
+  case Op::EOR:
+    return {true, a, a, 0, n | z, true};
+  case Op::TAX:
+    return {true, a, x, 0, n | z, false};
+  case Op::TAY:
+    return {true, a, y, 0, n | z, false};
+  case Op::TXA:
+    return {true, x, a, 0, n | z, false};
+  case Op::TYA:
+    return {true, y, a, 0, n | z, false};
+  case Op::CLC:
+  case Op::SEC:
+    return {true, 0, 0, 0, c, false};
+  case Op::CLV:
+    return {true, 0, 0, 0, v, false};
+  case Op::NOP:
+    return {true, 0, 0, 0, 0, false};
+  case Op::BPL:
+  case Op::BMI:
+    return {true, 0, 0, n, 0, false};
+  case Op::BVC:
+  case Op::BVS:
+    return {true, 0, 0, v, 0, false};
+  case Op::BCC:
+  case Op::BCS:
+    return {true, 0, 0, c, 0, false};
+  case Op::BNE:
+  case Op::BEQ:
+    return {true, 0, 0, z, 0, false};
+  case Op::JMP:
+    return {true, 0, 0, 0, 0, false};
+  default:
+    return {false, 0, 0, 0, 0, false};
+  }
+}
+
+} // namespace
+
+IdleLoop::IdleLoop(Bus *bus)
+    : m_bus(bus), m_loops(), m_settling(false), m_pc(0), m_clock(0),
+      m_until(0) {}
+
+uint64_t IdleLoop::settle(uint16_t pc, uint64_t clock, uint64_t deadline) {
+  Loop &loop = m_loops[pc % loop_count];
+  if (!loop.decoded || loop.pc != pc ||
+      loop.version != m_bus->version(pc >> 8))
+    analyze(loop, pc);
+  if (!loop.idle) {
+    m_settling = false;
+    return 0;
+  }
+
+  uint64_t until = std::min(deadline, stable_until(loop));
+  if (m_settling && m_pc == pc && m_clock + loop.period == clock &&
+      clock <= m_until) {
+    // this iteration read what the previous one found stable, so every
+    // iteration before until leaves the cpu as it is now.
+    uint64_t count = until > clock ? (until - clock) / loop.period : 0;
+    m_clock = clock + count * loop.period;
+    m_until = until;
+    return count * loop.period;
+  }
+
+  m_settling = until > clock;
+  m_pc = pc;
+  m_clock = clock;
+  m_until = until;
+  return 0;
+}
+
+void IdleLoop::analyze(Loop &loop, uint16_t pc) {
+  uint8_t page = pc >> 8;
+  loop = {};
+  loop.pc = pc;
+  loop.page = page;
+  loop.decoded = true;
+  loop.version = m_bus->version(page);
+
+  const uint8_t *memory = m_bus->memory(page);
+  if (!memory)
+    return;
+
+  // registers and flags written so far, and those read before being written.
+  uint8_t written = 0, read_first = 0;
+  uint8_t flags_written = 0, flags_read_first = 0;
+  uint16_t address = pc;
+  for (size_t i = 0; i < max_length; i++) {
+    uint8_t opcode = memory[address & 0xFF];
+    const Cpu::Instruction &instruction = Cpu::s_lookup[opcode];
+    Effect effect = ::effect(instruction.operation);
+    // unofficial NOPs with an operand may stand in for opcodes writing it.
+    if (!effect.allowed || (instruction.operation == Op::NOP &&
+                            instruction.addressing != Mode::implicit))
+      return;
+
+    size_t length;
+    switch (instruction.addressing) {
+    case Mode::implicit:
+      length = 1;
+      break;
+    case Mode::immediate:
+    case Mode::zero_page:
+    case Mode::relative:
+      length = 2;
+      break;
+    case Mode::absolute:
+      length = 3;
+      break;
+    default:
+      return;
+    }
+    if ((address & 0xFF) + length > Bus::page_size)
+      return;
+    uint16_t operand = memory[(address + 1) & 0xFF];
+    if (length == 3)
+      operand |= memory[(address + 2) & 0xFF] << 8;
+    uint16_t next = address + length;
+
+    read_first |= effect.reads & ~written;
+    written |= effect.writes;
+    flags_read_first |= effect.flags_read & ~flags_written;
+    flags_written |= effect.flags_written;
+    loop.period += instruction.cycles;
+    if (effect.memory && instruction.addressing != Mode::immediate)
+      loop.reads[loop.read_count++] = operand;
+
+    uint16_t target;
+    if (instruction.addressing == Mode::relative)
+      target = next + (int8_t)operand;
+    else if (instruction.operation == Op::JMP)
+      target = operand;
+    else {
+      address = next;
+      continue;
+    }
+
+    if (target == pc) {
+      // taken branch, one more cycle when it crosses a page.
+      if (instruction.addressing == Mode::relative)
+        loop.period += 1 + ((next & 0xFF00) != (pc & 0xFF00));
+      loop.idle =
+          !(read_first & written) && !(flags_read_first & flags_written);
+      return;
+    }
+    // only conditional branches leaving the body may go elsewhere.
+    if (instruction.operation == Op::JMP || (target >= pc && target < next))
+      return;
+    address = next;
+  }
+}
+
+uint64_t IdleLoop::stable_until(const Loop &loop) const {
+  uint64_t until = Scheduler::never;
+  for (size_t i = 0; i < loop.read_count; i++)
+    until = std::min(until, m_bus->stable_until(loop.reads[i]));
+  return until;
+}
@@ -0,0 +1,68 @@
+#include "Io.hpp"
+
+Io::Io(Bus *bus, Cpu *cpu, Ppu *ppu, Apu *apu)
+    : m_bus(bus), m_cpu(cpu), m_ppu(ppu), m_apu(apu), m_buttons(), m_shift(),
+      m_strobe(false) {
+  m_bus->map(0x4000, 0x40FF, this);
+}
+
+Io::~Io() { m_bus->unmap(0x4000, 0x40FF); }
+
+void Io::save(state::Writer &state) const {
+  state.write(m_buttons);
+  state.write(m_shift);
+  state.write(m_strobe);
+}
+
+void Io::load(state::Reader &state) {
+  state.read(m_buttons);
+  state.read(m_shift);
+  state.read(m_strobe);
+}
+
+uint8_t Io::read(uint16_t address) {
+  if (address == 0x4015)
+    return m_apu->read(address);
+  if (address != 0x4016 && address != 0x4017)
+    return 0;
+
+  size_t port = address & 1;
+  if (m_strobe)
+    m_shift[port] = m_buttons[port];
+  uint8_t bit = m_shift[port] & 1;
+  // official controllers shift in 1s after the eighth button.
+  m_shift[port] = (m_shift[port] >> 1) | 0x80;
+  // upper bits are open bus, usually the high byte of the address.
+  return 0x40 | bit;
+}
+
+void Io::write(uint16_t address, uint8_t data) {
+  switch (address) {
+  case 0x4014:
+    dma(data);
+    break;
+  case 0x4016:
+    m_strobe = data & 1;
+    if (m_strobe) {
+      m_shift[0] = m_buttons[0];
+      m_shift[1] = m_buttons[1];
+    }
+    break;
+  default:
+    if (address <= 0x4017)
+      m_apu->write(address, data);
+    break;
+  }
+}
+
+void Io::dma(uint8_t page) {
+  const uint8_t *memory = m_bus->memory(page);
+  uint8_t data[256];
+  if (!memory) {
+    for (size_t i = 0; i < sizeof(data); i++)
+      data[i] = m_bus->read((page << 8) | i);
+    memory = data;
+  }
+  m_ppu->write_oam(memory);
+  m_cpu->stall(dma_cycles + (m_cpu->clock() & 1));
+}
@@ -0,0 +1,1214 @@
+#include "Jit.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/mman.h>
+
+using Op = Cpu::Operation;
+using Mode = Cpu::Addressing;
+
+namespace {
+
+/// x86-64 general purpose registers.
+enum Reg {
+  rax,
+  rcx,
+  rdx,
+  rbx,
+  rsp,
+  rbp,
+  rsi,
+  rdi,
+  r8,
+  r9,
+  r10,
+  r11,
+  r12,
+  r13,
+  r14,
+  r15
+};
+
+/// x86-64 condition codes.
+enum Cond { cond_e = 0x4, cond_ne = 0x5 };
+
+// Register allocation of translated code. All of them are callee saved, so
+// they survive calls into Bus.
+constexpr Reg reg_state = rbx;
+constexpr Reg reg_read_pages = rbp;
+constexpr Reg reg_a = r12;
+constexpr Reg reg_x = r13;
+constexpr Reg reg_y = r14;
+constexpr Reg reg_p = r15;
+
+/// Bytes reserved on stack for temporaries, keeps stack 16 byte aligned.
+constexpr int32_t stack_size = 24;
+
+constexpr uint8_t flag_c = Cpu::carry;
+constexpr uint8_t flag_z = Cpu::zero;
+constexpr uint8_t flag_v = Cpu::overflow;
+constexpr uint8_t flag_n = Cpu::negative;
+
+/**
+ * Minimal x86-64 assembler emitting the instructions used by the recompiler.
+ * All arithmetic is 32 bit unless stated otherwise.
+ */
+class Assembler {
+public:
+  Assembler(uint8_t *code, size_t size) : m_code(code), m_size(size) {}
+
+  /// @return Number of bytes emitted.
+  size_t size() const { return m_used; }
+
+  /// @return false if code did not fit in the buffer.
+  bool ok() const { return m_used <= m_size; }
+
+  void mov(Reg dst, Reg src) { rr(0x89, dst, src); }
+  void add(Reg dst, Reg src) { rr(0x01, dst, src); }
+  void or_(Reg dst, Reg src) { rr(0x09, dst, src); }
+  void and_(Reg dst, Reg src) { rr(0x21, dst, src); }
+  void sub(Reg dst, Reg src) { rr(0x29, dst, src); }
+  void xor_(Reg dst, Reg src) { rr(0x31, dst, src); }
+  void cmp(Reg dst, Reg src) { rr(0x39, dst, src); }
+
+  void add(Reg dst, uint32_t imm) { ri(0, dst, imm); }
+  void or_(Reg dst, uint32_t imm) { ri(1, dst, imm); }
+  void and_(Reg dst, uint32_t imm) { ri(4, dst, imm); }
+  void sub(Reg dst, uint32_t imm) { ri(5, dst, imm); }
+  void xor_(Reg dst, uint32_t imm) { ri(6, dst, imm); }
+
+  void mov(Reg dst, uint32_t imm) {
+    rex(false, 0, 0, dst);
+    byte(0xb8 + (dst & 7));
+    dword(imm);
+  }
+
+  void mov64(Reg dst, uint64_t imm) {
+    rex(true, 0, 0, dst);
+    byte(0xb8 + (dst & 7));
+    dword(imm & 0xffffffff);
+    dword(imm >> 32);
+  }
+
+  void mov64(Reg dst, Reg src) {
+    rex(true, src, 0, dst);
+    byte(0x89);
+    modrm(3, src, dst);
+  }
+
+  void test64(Reg dst, Reg src) {
+    rex(true, src, 0, dst);
+    byte(0x85);
+    modrm(3, src, dst);
+  }
+
+  void test(Reg dst, uint32_t imm) {
+    rex(false, 0, 0, dst);
+    byte(0xf7);
+    modrm(3, 0, dst);
+    dword(imm);
+  }
+
+  void shl(Reg dst, uint8_t imm) { shift(4, dst, imm); }
+  void shr(Reg dst, uint8_t imm) { shift(5, dst, imm); }
+
+  /// movzx dst, src8
+  void movzx8(Reg dst, Reg src) {
+    rex(false, dst, 0, src, true);
+    byte(0x0f);
+    byte(0xb6);
+    modrm(3, dst, src);
+  }
+
+  /// mov dst, qword [base + disp]
+  void load64(Reg dst, Reg base, int32_t disp) {
+    rex(true, dst, 0, base);
+    byte(0x8b);
+    mem(dst, base, disp);
+  }
+
+  /// mov dst, qword [base + index * 8 + disp]
+  void load64(Reg dst, Reg base, Reg index, int32_t disp) {
+    rex(true, dst, index, base);
+    byte(0x8b);
+    mem(dst, base, index, 3, disp);
+  }
+
+  /// mov dst, dword [base + disp]
+  void load32(Reg dst, Reg base, int32_t disp) {
+    rex(false, dst, 0, base);
+    byte(0x8b);
+    mem(dst, base, disp);
+  }
+
+  /// mov dword [base + disp], src
+  void store32(Reg base, int32_t disp, Reg src) {
+    rex(false, src, 0, base);
+    byte(0x89);
+    mem(src, base, disp);
+  }
+
+  /// movzx dst, byte [base + disp]
+  void load8(Reg dst, Reg base, int32_t disp) {
+    rex(false, dst, 0, base);
+    byte(0x0f);
+    byte(0xb6);
+    mem(dst, base, disp);
+  }
+
+  /// movzx dst, byte [base + index + disp]
+  void load8(Reg dst, Reg base, Reg index, int32_t disp) {
+    rex(false, dst, index, base);
+    byte(0x0f);
+    byte(0xb6);
+    mem(dst, base, index, 0, disp);
+  }
+
+  /// mov byte [base + disp], src8
+  void store8(Reg base, int32_t disp, Reg src) {
+    rex(false, src, 0, base, true);
+    byte(0x88);
+    mem(src, base, disp);
+  }
+
+  /// mov byte [base + index + disp], src8
+  void store8(Reg base, Reg index, int32_t disp, Reg src) {
+    rex(false, src, index, base, true);
+    byte(0x88);
+    mem(src, base, index, 0, disp);
+  }
+
+  /// mov byte [base + disp], imm
+  void store8(Reg base, int32_t disp, uint8_t imm) {
+    rex(false, 0, 0, base);
+    byte(0xc6);
+    mem(0, base, disp);
+    byte(imm);
+  }
+
+  /// mov word [base + disp], imm
+  void store16(Reg base, int32_t disp, uint16_t imm) {
+    byte(0x66);
+    rex(false, 0, 0, base);
+    byte(0xc7);
+    mem(0, base, disp);
+    byte(imm & 0xff);
+    byte(imm >> 8);
+  }
+
+  /// add dword [base + disp], imm
+  void add32(Reg base, int32_t disp, uint32_t imm) {
+    rex(false, 0, 0, base);
+    byte(0x81);
+    mem(0, base, disp);
+    dword(imm);
+  }
+
+  /// add dword [base + disp], src
+  void add32(Reg base, int32_t disp, Reg src) {
+    rex(false, src, 0, base);
+    byte(0x01);
+    mem(src, base, disp);
+  }
+
+  /// cmp dword [base + disp], imm
+  void cmp32(Reg base, int32_t disp, uint32_t imm) {
+    rex(false, 0, 0, base);
+    byte(0x81);
+    mem(7, base, disp);
+    dword(imm);
+  }
+
+  /// or dst, dword [base + disp]
+  void or32(Reg dst, Reg base, int32_t disp) {
+    rex(false, dst, 0, base);
+    byte(0x0b);
+    mem(dst, base, disp);
+  }
+
+  void push(Reg reg) {
+    rex(false, 0, 0, reg);
+    byte(0x50 + (reg & 7));
+  }
+
+  void pop(Reg reg) {
+    rex(false, 0, 0, reg);
+    byte(0x58 + (reg & 7));
+  }
+
+  /// Adds imm to rsp.
+  void add_rsp(int32_t imm) {
+    rex(true, 0, 0, rsp);
+    byte(0x81);
+    modrm(3, 0, rsp);
+    dword(imm);
+  }
+
+  /// Calls function at absolute address, clobbers rax.
+  void call(const void *function) {
+    mov64(rax, (uint64_t)function);
+    byte(0xff);
+    modrm(3, 2, rax);
+  }
+
+  void ret() { byte(0xc3); }
+
+  /**
+   * Emits conditional jump to a label bound later.
+   * @return Fixup to pass to bind().
+   */
+  size_t jcc(Cond cond) {
+    byte(0x0f);
+    byte(0x80 + cond);
+    dword(0);
+    return m_used - 4;
+  }
+
+  /**
+   * Emits jump to a label bound later.
+   * @return Fixup to pass to bind().
+   */
+  size_t jmp() {
+    byte(0xe9);
+    dword(0);
+    return m_used - 4;
+  }
+
+  /// Points jump emitted at fixup to the current position.
+  void bind(size_t fixup) {
+    if (fixup + 4 > m_size)
+      return;
+    uint32_t rel = m_used - (fixup + 4);
+    std::memcpy(m_code + fixup, &rel, sizeof(rel));
+  }
+
+private:
+  void byte(uint8_t data) {
+    if (m_used < m_size)
+      m_code[m_used] = data;
+    m_used++;
+  }
+
+  void dword(uint32_t data) {
+    for (int i = 0; i < 4; i++)
+      byte(data >> (i * 8));
+  }
+
+  void rex(bool wide, int reg, int index, int base, bool force = false) {
+    uint8_t prefix = 0x40 | (wide << 3) | ((reg >> 3) << 2) |
+                     ((index >> 3) << 1) | (base >> 3);
+    if (prefix != 0x40 || force)
+      byte(prefix);
+  }
+
+  void modrm(int mod, int reg, int rm) {
+    byte((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+  }
+
+  /// [base + disp32]
+  void mem(int reg, Reg base, int32_t disp) {
+    modrm(2, reg, base);
+    if ((base & 7) == rsp)
+      byte(0x24);
+    dword(disp);
+  }
+
+  /// [base + index << scale + disp32]
+  void mem(int reg, Reg base, Reg index, int scale, int32_t disp) {
+    modrm(2, reg, rsp);
+    byte((scale << 6) | ((index & 7) << 3) | (base & 7));
+    dword(disp);
+  }
+
+  void rr(uint8_t opcode, Reg dst, Reg src) {
+    rex(false, src, 0, dst);
+    byte(opcode);
+    modrm(3, src, dst);
+  }
+
+  void ri(int extension, Reg dst, uint32_t imm) {
+    rex(false, 0, 0, dst);
+    byte(0x81);
+    modrm(3, extension, dst);
+    dword(imm);
+  }
+
+  void shift(int extension, Reg dst, uint8_t imm) {
+    rex(false, 0, 0, dst);
+    byte(0xc1);
+    modrm(3, extension, dst);
+    byte(imm);
+  }
+
+  uint8_t *m_code;
+  size_t m_size;
+  size_t m_used = 0;
+};
+
+// devices see the master clock at the start of the accessing instruction,
+// like in the interpreter.
+
+/// Slow path of memory reads, used for device and unmapped pages.
+uint8_t read_slow(Jit::State *state, uint16_t address) {
+  *state->cpu_clock = state->clock + state->start;
+  return state->bus->read(address);
+}
+
+/**
+ * Slow path of memory writes, used for device, watched and read only pages.
+ * @return true if the device stalled the cpu, e.g. by OAM DMA, or lowered
+ * its deadline, e.g. by scheduling an event or raising an interrupt.
+ */
+bool write_slow(Jit::State *state, uint16_t address, uint8_t data) {
+  uint64_t clock = state->clock + state->start;
+  uint64_t deadline = *state->deadline;
+  *state->cpu_clock = clock;
+  state->bus->write(address, data);
+  uint64_t stalled = *state->cpu_clock - clock;
+  state->cycles += stalled;
+  return stalled || *state->deadline < deadline;
+}
+
+/// Instruction of a block being translated.
+struct Source {
+  uint16_t pc;
+  uint8_t opcode;
+  Cpu::Instruction instruction;
+  /// Operand bytes, sign extended for relative addressing.
+  uint16_t operand;
+  /// Length of instruction including opcode.
+  uint8_t length;
+};
+
+/**
+ * @return true if instruction may access a device. Accesses which always stay
+ * in internal RAM at $0000-$1FFF, e.g. zero page, are not counted.
+ */
+bool accesses_device(const Source &source) {
+  const Cpu::Instruction &instruction = source.instruction;
+  if (instruction.operation == Op::JMP)
+    return false;
+  switch (instruction.addressing) {
+  case Mode::implicit:
+  case Mode::immediate:
+  case Mode::relative:
+  case Mode::zero_page:
+  case Mode::zero_page_x:
+  case Mode::zero_page_y:
+    return false;
+  case Mode::absolute:
+    return source.operand >= 0x2000;
+  case Mode::absolute_x:
+  case Mode::absolute_y:
+    return source.operand + 0xFF >= 0x2000;
+  default:
+    return true;
+  }
+}
+
+/// Where the operand of an instruction lives after address computation.
+enum class Operand { none, value, constant, dynamic };
+
+/**
+ * Translates one block. Operand of read instructions is loaded into eax,
+ * dynamic effective addresses are computed into esi.
+ */
+class Translator {
+public:
+  Translator(Assembler &assembler, uint8_t page, uint32_t version)
+      : a(assembler), m_page(page), m_version(version) {}
+
+  void prologue() {
+    a.push(rbx);
+    a.push(rbp);
+    a.push(r12);
+    a.push(r13);
+    a.push(r14);
+    a.push(r15);
+    a.add_rsp(-stack_size);
+
+    a.mov64(reg_state, rdi);
+    a.load64(reg_read_pages, reg_state, offsetof(Jit::State, read_pages));
+    a.load8(reg_a, reg_state, offsetof(Jit::State, a));
+    a.load8(reg_x, reg_state, offsetof(Jit::State, x));
+    a.load8(reg_y, reg_state, offsetof(Jit::State, y));
+    a.load8(reg_p, reg_state, offsetof(Jit::State, p));
+  }
+
+  void epilogue() {
+    for (size_t fixup : m_exits)
+      a.bind(fixup);
+
+    a.store8(reg_state, offsetof(Jit::State, a), reg_a);
+    a.store8(reg_state, offsetof(Jit::State, x), reg_x);
+    a.store8(reg_state, offsetof(Jit::State, y), reg_y);
+    a.store8(reg_state, offsetof(Jit::State, p), reg_p);
+
+    a.add_rsp(stack_size);
+    a.pop(r15);
+    a.pop(r14);
+    a.pop(r13);
+    a.pop(r12);
+    a.pop(rbp);
+    a.pop(rbx);
+    a.ret();
+  }
+
+  /**
+   * Leaves the block continuing at pc after instruction source.
+   */
+  void exit(const Source &source, uint16_t pc) {
+    a.store16(reg_state, offsetof(Jit::State, pc), pc);
+    a.store8(reg_state, offsetof(Jit::State, opcode), source.opcode);
+    m_exits.push_back(a.jmp());
+  }
+
+  /**
+   * Translates one instruction.
+   * @return Worst case number of cycles taken by the instruction.
+   */
+  uint32_t translate(const Source &source) {
+    const Cpu::Instruction &instruction = source.instruction;
+    uint32_t cycles = instruction.cycles;
+
+    if (accesses_device(source)) {
+      a.load32(rax, reg_state, offsetof(Jit::State, cycles));
+      a.store32(reg_state, offsetof(Jit::State, start), rax);
+    }
+    a.add32(reg_state, offsetof(Jit::State, cycles), instruction.cycles);
+
+    if (instruction.addressing == Mode::relative)
+      return cycles + branch(source);
+    if (instruction.operation == Op::JMP) {
+      exit(source, source.operand);
+      return cycles;
+    }
+
+    Operand operand = address(source);
+    if (instruction.addressing == Mode::absolute_x ||
+        instruction.addressing == Mode::absolute_y ||
+        instruction.addressing == Mode::indirect_indexed)
+      cycles++;
+
+    operation(source, operand);
+    return cycles;
+  }
+
+private:
+  /// Updates zero flag from low byte of reg, clobbers ecx.
+  void zero_flag(Reg reg) {
+    // ((reg & 0xff) - 1) has bit 31 set only if low byte is zero.
+    a.mov(rcx, reg);
+    a.and_(rcx, 0xff);
+    a.sub(rcx, 1);
+    a.shr(rcx, 30);
+    a.and_(rcx, flag_z);
+    a.or_(reg_p, rcx);
+  }
+
+  /// Updates negative flag from bit 7 of reg, clobbers ecx.
+  void negative_flag(Reg reg) {
+    a.mov(rcx, reg);
+    a.and_(rcx, flag_n);
+    a.or_(reg_p, rcx);
+  }
+
+  /// Updates zero and negative flags from reg, clobbers ecx.
+  void zero_negative_flags(Reg reg) {
+    a.and_(reg_p, (uint8_t)~(flag_z | flag_n));
+    zero_flag(reg);
+    negative_flag(reg);
+  }
+
+  /// Adds 1 cycle if high byte of esi differs from page.
+  void page_penalty(Reg page) {
+    a.mov(rax, rsi);
+    a.shr(rax, 8);
+    a.cmp(rax, page);
+    size_t same = a.jcc(cond_e);
+    a.add32(reg_state, offsetof(Jit::State, cycles), 1);
+    a.bind(same);
+  }
+
+  /// Reads byte at constant address into eax.
+  void read(uint16_t address) {
+    a.load64(rax, reg_read_pages, (address >> 8) * 8);
+    a.test64(rax, rax);
+    size_t slow = a.jcc(cond_e);
+    a.load8(rax, rax, address & 0xff);
+    size_t done = a.jmp();
+    a.bind(slow);
+    a.mov64(rdi, reg_state);
+    a.mov(rsi, (uint32_t)address);
+    a.call((const void *)&read_slow);
+    a.movzx8(rax, rax);
+    a.bind(done);
+  }
+
+  /// Reads byte at address in esi into eax, clobbers esi.
+  void read() {
+    a.mov(rax, rsi);
+    a.shr(rax, 8);
+    a.load64(rax, reg_read_pages, rax, 0);
+    a.test64(rax, rax);
+    size_t slow = a.jcc(cond_e);
+    a.movzx8(rcx, rsi);
+    a.load8(rax, rax, rcx, 0);
+    size_t done = a.jmp();
+    a.bind(slow);
+    a.mov64(rdi, reg_state);
+    a.call((const void *)&read_slow);
+    a.movzx8(rax, rax);
+    a.bind(done);
+  }
+
+  /**
+   * Leaves the block after a write through the slow path changed version of
+   * the page holding the block, e.g. self modifying code or bank switch,
+   * stalled the cpu, which may pass the deadline the block was entered with,
+   * or lowered that deadline.
+   */
+  void check_version(const Source &source) {
+    a.movzx8(rax, rax);
+    a.test64(rax, rax);
+    size_t stalled = a.jcc(cond_ne);
+    a.load64(rax, reg_state, offsetof(Jit::State, versions));
+    a.cmp32(rax, m_page * 4, m_version);
+    size_t same = a.jcc(cond_e);
+    a.bind(stalled);
+    exit(source, source.pc + source.length);
+    a.bind(same);
+  }
+
+  /// Writes edx to constant address.
+  void write(const Source &source, uint16_t address) {
+    a.load64(rax, reg_state, offsetof(Jit::State, write_pages));
+    a.load64(rax, rax, (address >> 8) * 8);
+    a.test64(rax, rax);
+    size_t slow = a.jcc(cond_e);
+    a.store8(rax, address & 0xff, rdx);
+    size_t done = a.jmp();
+    a.bind(slow);
+    a.mov64(rdi, reg_state);
+    a.mov(rsi, (uint32_t)address);
+    a.call((const void *)&write_slow);
+    check_version(source);
+    a.bind(done);
+  }
+
+  /// Writes edx to address in esi.
+  void write(const Source &source) {
+    a.mov(rax, rsi);
+    a.shr(rax, 8);
+    a.load64(rcx, reg_state, offsetof(Jit::State, write_pages));
+    a.load64(rax, rcx, rax, 0);
+    a.test64(rax, rax);
+    size_t slow = a.jcc(cond_e);
+    a.movzx8(rcx, rsi);
+    a.store8(rax, rcx, 0, rdx);
+    size_t done = a.jmp();
+    a.bind(slow);
+    a.mov64(rdi, reg_state);
+    a.call((const void *)&write_slow);
+    check_version(source);
+    a.bind(done);
+  }
+
+  /// Computes effective address of the instruction.
+  Operand address(const Source &source) {
+    uint16_t operand = source.operand;
+
+    switch (source.instruction.addressing) {
+    case Mode::immediate:
+      return Operand::value;
+    case Mode::zero_page:
+    case Mode::absolute:
+      return Operand::constant;
+    case Mode::zero_page_x:
+    case Mode::zero_page_y:
+      a.mov(rsi, source.instruction.addressing == Mode::zero_page_x ? reg_x
+                                                                    : reg_y);
+      a.add(rsi, operand);
+      a.and_(rsi, 0xff);
+      return Operand::dynamic;
+    case Mode::absolute_x:
+    case Mode::absolute_y:
+      a.mov(rsi, source.instruction.addressing == Mode::absolute_x ? reg_x
+                                                                   : reg_y);
+      a.add(rsi, operand);
+      a.and_(rsi, 0xffff);
+      a.mov(rdx, (uint32_t)(operand >> 8));
+      page_penalty(rdx);
+      return Operand::dynamic;
+    case Mode::indexed_indirect:
+      // pointer at (operand + X) % 256.
+      a.mov(rsi, reg_x);
+      a.add(rsi, operand);
+      a.and_(rsi, 0xff);
+      read();
+      a.store32(rsp, 0, rax);
+      a.mov(rsi, reg_x);
+      a.add(rsi, operand + 1);
+      a.and_(rsi, 0xff);
+      read();
+      a.shl(rax, 8);
+      a.or32(rax, rsp, 0);
+      a.mov(rsi, rax);
+      return Operand::dynamic;
+    case Mode::indirect_indexed:
+      // pointer at operand, indexed with Y.
+      read(operand);
+      a.store32(rsp, 0, rax);
+      read((operand + 1) % 256);
+      a.shl(rax, 8);
+      a.or32(rax, rsp, 0);
+      a.store32(rsp, 0, rax);
+      a.mov(rsi, rax);
+      a.add(rsi, reg_y);
+      a.and_(rsi, 0xffff);
+      a.load32(rdx, rsp, 0);
+      a.shr(rdx, 8);
+      page_penalty(rdx);
+      return Operand::dynamic;
+    default:
+      return Operand::none;
+    }
+  }
+
+  /// Loads operand into eax, keeps dynamic address on stack for write back.
+  void load(const Source &source, Operand operand) {
+    switch (operand) {
+    case Operand::value:
+      a.mov(rax, (uint32_t)(source.operand & 0xff));
+      break;
+    case Operand::constant:
+      read(source.operand);
+      break;
+    case Operand::dynamic:
+      a.store32(rsp, 8, rsi);
+      read();
+      break;
+    default:
+      a.mov(rax, reg_a);
+      break;
+    }
+  }
+
+  /// Stores edx to operand loaded by load().
+  void store(const Source &source, Operand operand) {
+    switch (operand) {
+    case Operand::constant:
+      write(source, source.operand);
+      break;
+    case Operand::dynamic:
+      a.load32(rsi, rsp, 8);
+      write(source);
+      break;
+    default:
+      a.mov(reg_a, rdx);
+      break;
+    }
+  }
+
+  /// Stores reg to effective address.
+  void store_register(const Source &source, Operand operand, Reg reg) {
+    a.mov(rdx, reg);
+    if (operand == Operand::constant)
+      write(source, source.operand);
+    else
+      write(source);
+  }
+
+  void load_register(const Source &source, Operand operand, Reg reg) {
+    load(source, operand);
+    a.mov(reg, rax);
+    zero_negative_flags(reg);
+  }
+
+  void transfer(Reg dst, Reg src) {
+    a.mov(dst, src);
+    zero_negative_flags(dst);
+  }
+
+  void compare(const Source &source, Operand operand, Reg reg) {
+    load(source, operand);
+    a.mov(rdx, reg);
+    a.sub(rdx, rax);
+    a.and_(reg_p, (uint8_t)~(flag_c | flag_z | flag_n));
+    zero_flag(rdx);
+    negative_flag(rdx);
+    // carry is set if operand <= reg, i.e. difference is not negative.
+    a.mov(rcx, rdx);
+    a.shr(rcx, 31);
+    a.xor_(rcx, 1);
+    a.or_(reg_p, rcx);
+  }
+
+  /// Overflow flag of ADC and SBC, updated only if signs of A and operand are
+  /// equal (ADC) or differ (SBC).
+  void overflow_flag(Cond skip) {
+    a.mov(rcx, reg_a);
+    a.xor_(rcx, rax);
+    a.test(rcx, 0x80);
+    size_t done = a.jcc(skip);
+    a.and_(reg_p, (uint8_t)~flag_v);
+    a.mov(rcx, reg_a);
+    a.xor_(rcx, rdx);
+    a.and_(rcx, 0x80);
+    a.shr(rcx, 1);
+    a.or_(reg_p, rcx);
+    a.bind(done);
+  }
+
+  void shift(const Source &source, Operand operand) {
+    Op operation = source.instruction.operation;
+    load(source, operand);
+
+    if (operation == Op::ASL || operation == Op::ASL_A ||
+        operation == Op::ROL || operation == Op::ROL_A) {
+      a.mov(rdx, rax);
+      a.shl(rdx, 1);
+      if (operation == Op::ROL || operation == Op::ROL_A) {
+        a.mov(rcx, reg_p);
+        a.and_(rcx, flag_c);
+        a.or_(rdx, rcx);
+      }
+      a.and_(rdx, 0xff);
+      a.and_(reg_p, (uint8_t)~(flag_c | flag_z | flag_n));
+      a.mov(rcx, rax);
+      a.shr(rcx, 7);
+      a.or_(reg_p, rcx);
+    } else {
+      a.mov(rdx, rax);
+      a.shr(rdx, 1);
+      if (operation == Op::ROR || operation == Op::ROR_A) {
+        a.mov(rcx, reg_p);
+        a.and_(rcx, flag_c);
+        a.shl(rcx, 7);
+        a.or_(rdx, rcx);
+      }
+      a.and_(reg_p, (uint8_t)~(flag_c | flag_z | flag_n));
+      a.mov(rcx, rax);
+      a.and_(rcx, flag_c);
+      a.or_(reg_p, rcx);
+    }
+
+    zero_flag(rdx);
+    negative_flag(rdx);
+    store(source, operand);
+  }
+
+  void operation(const Source &source, Operand operand) {
+    switch (source.instruction.operation) {
+    case Op::LDA:
+      load_register(source, operand, reg_a);
+      break;
+    case Op::LDX:
+      load_register(source, operand, reg_x);
+      break;
+    case Op::LDY:
+      load_register(source, operand, reg_y);
+      break;
+    case Op::STA:
+      store_register(source, operand, reg_a);
+      break;
+    case Op::STX:
+      store_register(source, operand, reg_x);
+      break;
+    case Op::STY:
+      store_register(source, operand, reg_y);
+      break;
+    case Op::AND:
+      load(source, operand);
+      a.and_(reg_a, rax);
+      zero_negative_flags(reg_a);
+      break;
+    case Op::ORA:
+      load(source, operand);
+      a.or_(reg_a, rax);
+      zero_negative_flags(reg_a);
+      break;
+    case Op::EOR:
+      load(source, operand);
+      a.xor_(reg_a, rax);
+      zero_negative_flags(reg_a);
+      break;
+    case Op::ADC:
+      // result = A + M + C
+      load(source, operand);
+      a.mov(rcx, reg_p);
+      a.and_(rcx, flag_c);
+      a.mov(rdx, reg_a);
+      a.add(rdx, rax);
+      a.add(rdx, rcx);
+      a.and_(reg_p, (uint8_t)~(flag_c | flag_z | flag_n));
+      a.mov(rcx, rdx);
+      a.shr(rcx, 8);
+      a.or_(reg_p, rcx);
+      zero_flag(rdx);
+      negative_flag(rdx);
+      overflow_flag(cond_ne);
+      a.mov(reg_a, rdx);
+      a.and_(reg_a, 0xff);
+      break;
+    case Op::SBC:
+      // result = A - M - C, carry is set if bit 7 of result is clear.
+      load(source, operand);
+      a.mov(rcx, reg_p);
+      a.and_(rcx, flag_c);
+      a.mov(rdx, reg_a);
+      a.sub(rdx, rax);
+      a.sub(rdx, rcx);
+      a.and_(reg_p, (uint8_t)~(flag_c | flag_z | flag_n));
+      a.mov(rcx, rdx);
+      a.and_(rcx, 0x80);
+      a.xor_(rcx, 0x80);
+      a.shr(rcx, 7);
+      a.or_(reg_p, rcx);
+      zero_flag(rdx);
+      negative_flag(rdx);
+      overflow_flag(cond_e);
+      a.mov(reg_a, rdx);
+      a.and_(reg_a, 0xff);
+      break;
+    case Op::CMP:
+      compare(source, operand, reg_a);
+      break;
+    case Op::CPX:
+      compare(source, operand, reg_x);
+      break;
+    case Op::CPY:
+      compare(source, operand, reg_y);
+      break;
+    case Op::BIT:
+      // Z is taken from M & A, N and V from M.
+      load(source, operand);
+      a.mov(rdx, rax);
+      a.and_(rdx, reg_a);
+      a.and_(reg_p, (uint8_t)~(flag_z | flag_v | flag_n));
+      zero_flag(rdx);
+      a.mov(rcx, rax);
+      a.and_(rcx, flag_v | flag_n);
+      a.or_(reg_p, rcx);
+      break;
+    case Op::INC:
+    case Op::DEC:
+      load(source, operand);
+      a.mov(rdx, rax);
+      if (source.instruction.operation == Op::INC)
+        a.add(rdx, 1);
+      else
+        a.sub(rdx, 1);
+      a.and_(rdx, 0xff);
+      zero_negative_flags(rdx);
+      store(source, operand);
+      break;
+    case Op::INX:
+    case Op::INY:
+    case Op::DEX:
+    case Op::DEY: {
+      Op op = source.instruction.operation;
+      Reg reg = (op == Op::INX || op == Op::DEX) ? reg_x : reg_y;
+      if (op == Op::INX || op == Op::INY)
+        a.add(reg, 1);
+      else
+        a.sub(reg, 1);
+      a.and_(reg, 0xff);
+      zero_negative_flags(reg);
+      break;
+    }
+    case Op::ASL:
+    case Op::ROL:
+    case Op::LSR:
+    case Op::ROR:
+      shift(source, operand);
+      break;
+    case Op::ASL_A:
+    case Op::ROL_A:
+    case Op::LSR_A:
+    case Op::ROR_A:
+      shift(source, Operand::none);
+      break;
+    case Op::TAX:
+      transfer(reg_x, reg_a);
+      break;
+    case Op::TXA:
+      transfer(reg_a, reg_x);
+      break;
+    case Op::TAY:
+      transfer(reg_y, reg_a);
+      break;
+    case Op::TYA:
+      transfer(reg_a, reg_y);
+      break;
+    case Op::TSX:
+      a.load8(reg_x, reg_state, offsetof(Jit::State, s));
+      zero_negative_flags(reg_x);
+      break;
+    case Op::TXS:
+      // TXS updates flags like the other transfers.
+      a.store8(reg_state, offsetof(Jit::State, s), reg_x);
+      zero_negative_flags(reg_x);
+      break;
+    case Op::CLC:
+      a.and_(reg_p, (uint8_t)~Cpu::carry);
+      break;
+    case Op::SEC:
+      a.or_(reg_p, Cpu::carry);
+      break;
+    case Op::CLD:
+      a.and_(reg_p, (uint8_t)~Cpu::decimal_mode);
+      break;
+    case Op::SED:
+      a.or_(reg_p, Cpu::decimal_mode);
+      break;
+    case Op::SEI:
+      a.or_(reg_p, Cpu::interrupt_disable);
+      break;
+    case Op::CLV:
+      a.and_(reg_p, (uint8_t)~Cpu::overflow);
+      break;
+    default:
+      // NOP, only the addressing mode has effect.
+      break;
+    }
+  }
+
+  /**
+   * Translates conditional branch, always leaves the block.
+   * @return Worst case number of extra cycles.
+   */
+  uint32_t branch(const Source &source) {
+    uint8_t flag = 0;
+    bool taken_if_set = false;
+    switch (source.instruction.operation) {
+    case Op::BPL:
+      flag = Cpu::negative;
+      break;
+    case Op::BMI:
+      flag = Cpu::negative;
+      taken_if_set = true;
+      break;
+    case Op::BVC:
+      flag = Cpu::overflow;
+      break;
+    case Op::BVS:
+      flag = Cpu::overflow;
+      taken_if_set = true;
+      break;
+    case Op::BCC:
+      flag = Cpu::carry;
+      break;
+    case Op::BCS:
+      flag = Cpu::carry;
+      taken_if_set = true;
+      break;
+    case Op::BNE:
+      flag = Cpu::zero;
+      break;
+    default:
+      flag = Cpu::zero;
+      taken_if_set = true;
+      break;
+    }
+
+    uint16_t next = source.pc + source.length;
+    uint16_t target = next + source.operand;
+    uint32_t penalty = (next >> 8) != (target >> 8) ? 2 : 1;
+
+    a.test(reg_p, flag);
+    size_t not_taken = a.jcc(taken_if_set ? cond_e : cond_ne);
+    a.add32(reg_state, offsetof(Jit::State, cycles), penalty);
+    exit(source, target);
+    a.bind(not_taken);
+    exit(source, next);
+    return 2;
+  }
+
+  Assembler &a;
+
+  /// Page holding the block.
+  uint8_t m_page;
+
+  /// Version of the page when block was translated.
+  uint32_t m_version;
+
+  /// Fixups of jumps to the epilogue.
+  std::vector<size_t> m_exits;
+};
+
+/**
+ * @return true if the recompiler can translate instruction.
+ */
+bool supported(const Cpu::Instruction &instruction) {
+  switch (instruction.operation) {
+  case Op::KIL:
+  case Op::BRK:
+  case Op::RTI:
+  case Op::JSR:
+  case Op::RTS:
+  case Op::PHA:
+  case Op::PLA:
+  case Op::PHP:
+  case Op::PLP:
+  // may unmask a pending interrupt request, which the interpreter reports to
+  // Cpu::run_to().
+  case Op::CLI:
+    return false;
+  case Op::JMP:
+    return instruction.addressing == Mode::absolute;
+  default:
+    return true;
+  }
+}
+
+/**
+ * @return true if instruction always leaves the block.
+ */
+bool ends_block(const Cpu::Instruction &instruction) {
+  return instruction.addressing == Mode::relative ||
+         instruction.operation == Op::JMP;
+}
+
+/// Number of operand bytes following the opcode, indexed by Cpu::Addressing.
+constexpr uint8_t s_operand_length[] = {0, 1, 2, 1, 1, 2, 2, 1, 1, 1, 1, 1};
+
+static_assert(sizeof(s_operand_length) == (size_t)Mode::count,
+              "every addressing mode needs operand length");
+
+/// Blocks invalidated this many times are left to the interpreter.
+constexpr uint8_t max_invalidations = 4;
+
+/// Translation is skipped if less than this many bytes of code are free.
+constexpr size_t max_translation_size = 32 * 1024;
+
+} // namespace
+
+Jit::Jit(Bus *bus) : m_bus(bus), m_code_used(0), m_blocks() {
+  void *code = mmap(nullptr, code_size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED)
+    throw std::runtime_error("Jit: can not allocate executable memory");
+  m_code = (uint8_t *)code;
+}
+
+Jit::~Jit() { munmap(m_code, code_size); }
+
+uint64_t Jit::execute(Cpu &cpu, uint64_t cycles) {
+  Block &block = m_blocks[cpu.m_pc % block_count];
+  if (block.pc != cpu.m_pc || !block.version ||
+      block.version != m_bus->version(block.page)) {
+    if (block.pc == cpu.m_pc && block.version) {
+      // count writes to code, remapping of ROM is expected.
+      if (m_bus->writable(block.page) &&
+          block.invalidations < max_invalidations)
+        block.invalidations++;
+    } else {
+      block.invalidations = 0;
+    }
+    translate(block, cpu.m_pc);
+  }
+
+  if (!block.code || block.cycles > cycles)
+    return 0;
+
+  State state = {cpu.m_a,
+                 cpu.m_x,
+                 cpu.m_y,
+                 cpu.m_s,
+                 cpu.status(),
+                 cpu.m_opcode,
+                 cpu.m_pc,
+                 0,
+                 0,
+                 cpu.m_clock,
+                 &cpu.m_clock,
+                 m_bus->read_pages(),
+                 m_bus->write_pages(),
+                 m_bus->versions(),
+                 m_bus,
+                 &cpu.m_deadline};
+  block.code(&state);
+  cpu.m_clock = state.clock;
+
+  cpu.m_a = state.a;
+  cpu.m_x = state.x;
+  cpu.m_y = state.y;
+  cpu.m_s = state.s;
+  cpu.set_status(state.p);
+  cpu.m_opcode = state.opcode;
+  cpu.m_pc = state.pc;
+  return state.cycles;
+}
+
+void Jit::translate(Block &block, uint16_t pc) {
+  uint8_t page = pc >> 8;
+  const uint8_t *memory = m_bus->memory(page);
+
+  block.pc = pc;
+  block.page = page;
+  block.code = nullptr;
+  block.cycles = 0;
+  block.version = m_bus->version(page);
+
+  // page keeps being written, leave it to the interpreter.
+  if (!memory || block.invalidations >= max_invalidations)
+    return;
+
+  std::vector<Source> sources;
+  while (sources.size() < max_block_length) {
+    uint8_t opcode = memory[pc & 0xff];
+    const Cpu::Instruction &instruction = Cpu::s_lookup[opcode];
+    uint8_t length = 1 + s_operand_length[(size_t)instruction.addressing];
+    if (!supported(instruction) || (uint16_t)(pc + length - 1) >> 8 != page)
+      break;
+
+    uint16_t operand = 0;
+    if (length == 3)
+      operand = memory[(pc + 1) & 0xff] | (memory[(pc + 2) & 0xff] << 8);
+    else if (length == 2)
+      operand = memory[(pc + 1) & 0xff];
+    if (instruction.addressing == Mode::relative && (operand & 0x80))
+      operand |= 0xFF00;
+
+    sources.push_back({pc, opcode, instruction, operand, length});
+    pc += length;
+    if (ends_block(instruction) || pc >> 8 != page)
+      break;
+  }
+  if (sources.empty())
+    return;
+
+  // writes to the page have to be seen by check_version().
+  m_bus->watch(page);
+  block.version = m_bus->version(page);
+
+  if (code_size - m_code_used < max_translation_size) {
+    // out of code memory, start over.
+    for (Block &other : m_blocks)
+      other.code = nullptr, other.version = 0;
+    block.version = m_bus->version(page);
+    m_code_used = 0;
+  }
+
+  Assembler assembler(m_code + m_code_used, code_size - m_code_used);
+  Translator translator(assembler, page, block.version);
+  translator.prologue();
+
+  uint32_t cycles = 0;
+  for (const Source &source : sources)
+    cycles += translator.translate(source);
+  if (!ends_block(sources.back().instruction))
+    translator.exit(sources.back(), pc);
+
+  translator.epilogue();
+  if (!assembler.ok())
+    return;
+
+  block.code = (void (*)(State *))(m_code + m_code_used);
+  block.cycles = cycles;
+  m_code_used += assembler.size();
+}
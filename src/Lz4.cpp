@@ -0,0 +1,193 @@
+#include "Lz4.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+constexpr size_t min_match = 4;
+
+/// The last literals of a block, a match never covers them.
+constexpr size_t last_literals = 5;
+
+/// A match never starts in the last bytes of a block.
+constexpr size_t match_limit = 12;
+
+constexpr int hash_bits = 12;
+
+uint32_t load(const uint8_t *p) {
+  uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+uint32_t hash(uint32_t value) {
+  return (value * 2654435761u) >> (32 - hash_bits);
+}
+
+/**
+ * Writes the part of length which does not fit in a nibble of the token.
+ */
+uint8_t *write_length(uint8_t *out, size_t length) {
+  for (; length >= 255; length -= 255)
+    *out++ = 255;
+  *out++ = (uint8_t)length;
+  return out;
+}
+
+/**
+ * Writes count literals from literals, then a match at offset back of length
+ * bytes, none if length is 0.
+ */
+uint8_t *write_sequence(uint8_t *out, const uint8_t *literals, size_t count,
+                        size_t offset, size_t length) {
+  uint8_t *token = out++;
+  *token = (uint8_t)(std::min<size_t>(count, 15) << 4);
+  if (count >= 15)
+    out = write_length(out, count - 15);
+  std::memcpy(out, literals, count);
+  out += count;
+  if (!length)
+    return out;
+
+  *out++ = offset & 0xFF;
+  *out++ = offset >> 8;
+  length -= min_match;
+  *token |= (uint8_t)std::min<size_t>(length, 15);
+  if (length >= 15)
+    out = write_length(out, length - 15);
+  return out;
+}
+
+/**
+ * Reads the part of a length which did not fit in a nibble of the token.
+ * @return false if in ends first.
+ */
+bool read_length(const uint8_t *&in, const uint8_t *end, size_t &length) {
+  uint8_t byte;
+  do {
+    if (in == end)
+      return false;
+    byte = *in++;
+    length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+} // namespace
+
+namespace lz4 {
+
+size_t compress(const uint8_t *in, size_t size, uint8_t *out) {
+  // positions plus one of the last 4 bytes hashing to each entry, 0 if none.
+  uint32_t table[1 << hash_bits] = {};
+  uint8_t *start = out;
+  size_t anchor = 0;
+  if (size > match_limit) {
+    for (size_t i = 0; i < size - match_limit;) {
+      uint32_t value = load(in + i);
+      uint32_t &entry = table[hash(value)];
+      size_t candidate = entry;
+      entry = (uint32_t)(i + 1);
+      if (!candidate || i + 1 - candidate > 0xFFFF ||
+          load(in + candidate - 1) != value) {
+        // steps faster through data that does not compress.
+        i += 1 + ((i - anchor) >> 6);
+        continue;
+      }
+
+      size_t match = candidate - 1;
+      while (i > anchor && match > 0 && in[i - 1] == in[match - 1]) {
+        i--;
+        match--;
+      }
+      size_t end = i + min_match;
+      while (end < size - last_literals && in[end] == in[match + end - i])
+        end++;
+      out = write_sequence(out, in + anchor, i - anchor, i - match, end - i);
+      i = anchor = end;
+    }
+  }
+  out = write_sequence(out, in + anchor, size - anchor, 0, 0);
+  return out - start;
+}
+
+size_t decompress(const uint8_t *in, size_t size, uint8_t *out,
+                  size_t capacity) {
+  const uint8_t *end = in + size;
+  size_t written = 0;
+  while (in < end) {
+    uint8_t token = *in++;
+    size_t count = token >> 4;
+    if (count == 15 && !read_length(in, end, count))
+      return capacity + 1;
+    if (count > (size_t)(end - in) || count > capacity - written)
+      return capacity + 1;
+    std::memcpy(out + written, in, count);
+    in += count;
+    written += count;
+    // the last sequence has no match.
+    if (in == end)
+      break;
+
+    if (end - in < 2)
+      return capacity + 1;
+    size_t offset = in[0] | in[1] << 8;
+    in += 2;
+    size_t length = token & 15;
+    if (length == 15 && !read_length(in, end, length))
+      return capacity + 1;
+    length += min_match;
+    if (!offset || offset > written || length > capacity - written)
+      return capacity + 1;
+    // byte by byte, the match may overlap the bytes it produces.
+    for (size_t i = 0; i < length; i++, written++)
+      out[written] = out[written - offset];
+  }
+  return written;
+}
+
+bool test() {
+  std::vector<std::vector<uint8_t>> inputs;
+  for (size_t size = 1; size <= match_limit + 1; size++)
+    inputs.emplace_back(size, 'a');
+  // xorshift noise, with nothing to match.
+  std::vector<uint8_t> noise(100000);
+  uint32_t x = 1;
+  for (uint8_t &byte : noise) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    byte = (uint8_t)x;
+  }
+  inputs.push_back(noise);
+  // matches at offset 1 and 7 overlap the bytes they produce.
+  inputs.emplace_back(70000, 0x55);
+  std::vector<uint8_t> text(5000);
+  for (size_t i = 0; i < text.size(); i++)
+    text[i] = "abcdefg"[i % 7];
+  inputs.push_back(text);
+
+  bool ok = true;
+  std::vector<uint8_t> compressed, output;
+  for (const std::vector<uint8_t> &input : inputs) {
+    compressed.resize(bound(input.size()));
+    output.resize(input.size());
+    size_t size = compress(input.data(), input.size(), compressed.data());
+    ok &= size <= bound(input.size());
+    ok &= decompress(compressed.data(), size, output.data(), output.size()) ==
+              input.size() &&
+          output == input;
+    ok &= decompress(compressed.data(), size - 1, output.data(),
+                     output.size()) != input.size();
+    // long runs compress to a few bytes per 255 of length.
+    if (input.size() >= text.size() && input != noise)
+      ok &= size < input.size() / 100;
+  }
+  std::printf("lz4 round trip %s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+} // namespace lz4
@@ -0,0 +1,412 @@
+#include "Mapper.hpp"
+#include "Cpu.hpp"
+#include "Pixels.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using Mirroring = Rom::Mirroring;
+
+namespace {
+
+/**
+ * @return Offset of bank of size bytes in memory of total bytes.
+ */
+size_t bank_offset(int bank, size_t size, size_t total) {
+  int count = std::max<size_t>(total / size, 1);
+  bank %= count;
+  if (bank < 0)
+    bank += count;
+  return bank * size;
+}
+
+/**
+ * Mapper 0, 16KB or 32KB PRG-ROM and 8KB CHR without bank switching.
+ */
+class Nrom : public Mapper {
+public:
+  Nrom(const Rom &rom, Bus *bus, Cpu *cpu, const Mapper *parent)
+      : Mapper(rom, bus, cpu, parent) {
+    map_prg(0x8000, 0x4000, 0);
+    map_prg(0xC000, 0x4000, -1);
+    map_chr(0x0000, 0x2000, 0);
+  }
+};
+
+/**
+ * Mapper 1, MMC1. Registers are loaded serially through a 5 bit shift
+ * register.
+ */
+class Mmc1 : public Mapper {
+public:
+  Mmc1(const Rom &rom, Bus *bus, Cpu *cpu, const Mapper *parent)
+      : Mapper(rom, bus, cpu, parent), m_shift(0x10), m_control(0x0C),
+        m_chr_banks(), m_prg_bank(0) {
+    update();
+  }
+
+  void write(uint16_t address, uint8_t data) override {
+    if (data & 0x80) {
+      m_shift = 0x10;
+      m_control |= 0x0C;
+      update();
+      return;
+    }
+
+    // a 1 shifted out of bit 0 marks the fifth write.
+    bool full = m_shift & 1;
+    m_shift = (m_shift >> 1) | ((data & 1) << 4);
+    if (!full)
+      return;
+
+    switch (address & 0x6000) {
+    case 0x0000:
+      m_control = m_shift;
+      break;
+    case 0x2000:
+      m_chr_banks[0] = m_shift;
+      break;
+    case 0x4000:
+      m_chr_banks[1] = m_shift;
+      break;
+    case 0x6000:
+      m_prg_bank = m_shift & 0x0F;
+      break;
+    }
+    m_shift = 0x10;
+    update();
+  }
+
+  void save(state::Writer &state) const override {
+    Mapper::save(state);
+    state.write(m_shift);
+    state.write(m_control);
+    state.write(m_chr_banks);
+    state.write(m_prg_bank);
+  }
+
+  void load(state::Reader &state) override {
+    Mapper::load(state);
+    state.read(m_shift);
+    state.read(m_control);
+    state.read(m_chr_banks);
+    state.read(m_prg_bank);
+  }
+
+private:
+  void update() {
+    static constexpr Mirroring mirroring[] = {
+        Mirroring::single_screen_lower, Mirroring::single_screen_upper,
+        Mirroring::vertical, Mirroring::horizontal};
+    set_mirroring(mirroring[m_control & 3]);
+
+    // 512KB boards select the 256KB half with bit 4 of the CHR bank.
+    int outer = m_rom.prg_size() > 0x40000 ? m_chr_banks[0] & 0x10 : 0;
+    switch ((m_control >> 2) & 3) {
+    case 0:
+    case 1:
+      map_prg(0x8000, 0x8000, (outer | m_prg_bank) >> 1);
+      break;
+    case 2:
+      map_prg(0x8000, 0x4000, outer);
+      map_prg(0xC000, 0x4000, outer | m_prg_bank);
+      break;
+    case 3:
+      map_prg(0x8000, 0x4000, outer | m_prg_bank);
+      map_prg(0xC000, 0x4000, outer | 0x0F);
+      break;
+    }
+
+    if (m_control & 0x10) {
+      map_chr(0x0000, 0x1000, m_chr_banks[0]);
+      map_chr(0x1000, 0x1000, m_chr_banks[1]);
+    } else {
+      map_chr(0x0000, 0x2000, m_chr_banks[0] >> 1);
+    }
+  }
+
+  uint8_t m_shift;
+  uint8_t m_control;
+  uint8_t m_chr_banks[2];
+  uint8_t m_prg_bank;
+};
+
+/**
+ * Mapper 2, UxROM. Switchable 16KB bank at $8000, last bank fixed at $C000.
+ */
+class Uxrom : public Mapper {
+public:
+  Uxrom(const Rom &rom, Bus *bus, Cpu *cpu, const Mapper *parent)
+      : Mapper(rom, bus, cpu, parent) {
+    map_prg(0x8000, 0x4000, 0);
+    map_prg(0xC000, 0x4000, -1);
+    map_chr(0x0000, 0x2000, 0);
+  }
+
+  void write(uint16_t, uint8_t data) override {
+    map_prg(0x8000, 0x4000, data);
+  }
+};
+
+/**
+ * Mapper 3, CNROM. Fixed PRG-ROM and switchable 8KB CHR bank.
+ */
+class Cnrom : public Mapper {
+public:
+  Cnrom(const Rom &rom, Bus *bus, Cpu *cpu, const Mapper *parent)
+      : Mapper(rom, bus, cpu, parent) {
+    map_prg(0x8000, 0x4000, 0);
+    map_prg(0xC000, 0x4000, -1);
+    map_chr(0x0000, 0x2000, 0);
+  }
+
+  void write(uint16_t, uint8_t data) override { map_chr(0x0000, 0x2000, data); }
+};
+
+/**
+ * Mapper 4, MMC3. 8KB PRG and 1KB/2KB CHR banks and a scanline counter
+ * raising interrupt requests.
+ */
+class Mmc3 : public Mapper {
+public:
+  Mmc3(const Rom &rom, Bus *bus, Cpu *cpu, const Mapper *parent)
+      : Mapper(rom, bus, cpu, parent), m_select(0),
+        m_banks{0, 2, 4, 5, 6, 7, 0, 1}, m_latch(0), m_counter(0),
+        m_reload(false), m_enabled(false) {
+    update();
+  }
+
+  void write(uint16_t address, uint8_t data) override {
+    bool odd = address & 1;
+    switch (address & 0x6000) {
+    case 0x0000:
+      if (odd) {
+        m_banks[m_select & 7] = data;
+        map_bank(m_select & 7);
+      } else {
+        bool modes = (m_select ^ data) & 0xC0;
+        m_select = data;
+        if (modes)
+          update();
+      }
+      break;
+    case 0x2000:
+      // PRG-RAM protection is not emulated.
+      if (!odd && mirroring() != Mirroring::four_screen)
+        set_mirroring(data & 1 ? Mirroring::horizontal : Mirroring::vertical);
+      break;
+    case 0x4000:
+      if (odd) {
+        m_counter = 0;
+        m_reload = true;
+      } else {
+        m_latch = data;
+      }
+      break;
+    case 0x6000:
+      m_enabled = odd;
+      if (!odd)
+        m_cpu->irq(false, Cpu::irq_mapper);
+      break;
+    }
+  }
+
+  bool counts_scanlines() const override { return true; }
+
+  void scanline() override {
+    if (!m_counter || m_reload) {
+      m_counter = m_latch;
+      m_reload = false;
+    } else {
+      m_counter--;
+    }
+    if (!m_counter && m_enabled)
+      m_cpu->irq(true, Cpu::irq_mapper);
+  }
+
+  void save(state::Writer &state) const override {
+    Mapper::save(state);
+    state.write(m_select);
+    state.write(m_banks);
+    state.write(m_latch);
+    state.write(m_counter);
+    state.write(m_reload);
+    state.write(m_enabled);
+  }
+
+  void load(state::Reader &state) override {
+    Mapper::load(state);
+    state.read(m_select);
+    state.read(m_banks);
+    state.read(m_latch);
+    state.read(m_counter);
+    state.read(m_reload);
+    state.read(m_enabled);
+  }
+
+private:
+  /**
+   * Maps bank selected by register r.
+   */
+  void map_bank(int r) {
+    // bit 6 swaps $8000 and $C000, bit 7 swaps halves of pattern tables.
+    uint16_t swap = m_select & 0x40 ? 0x4000 : 0;
+    uint16_t invert = m_select & 0x80 ? 0x1000 : 0;
+    if (r < 2)
+      map_chr((r * 0x800) ^ invert, 0x0800, m_banks[r] >> 1);
+    else if (r < 6)
+      map_chr((0x1000 + (r - 2) * 0x400) ^ invert, 0x0400, m_banks[r]);
+    else if (r == 6)
+      map_prg(0x8000 ^ swap, 0x2000, m_banks[6]);
+    else
+      map_prg(0xA000, 0x2000, m_banks[7]);
+  }
+
+  void update() {
+    for (int r = 0; r < 8; r++)
+      map_bank(r);
+    map_prg(0xC000 ^ (m_select & 0x40 ? 0x4000 : 0), 0x2000, -2);
+    map_prg(0xE000, 0x2000, -1);
+  }
+
+  uint8_t m_select;
+  uint8_t m_banks[8];
+  uint8_t m_latch;
+  uint8_t m_counter;
+  bool m_reload;
+  bool m_enabled;
+};
+
+} // namespace
+
+std::unique_ptr<Mapper> Mapper::create(const Rom &rom, Bus *bus, Cpu *cpu,
+                                       const Mapper *parent) {
+  switch (rom.mapper()) {
+  case 0:
+    return std::make_unique<Nrom>(rom, bus, cpu, parent);
+  case 1:
+    return std::make_unique<Mmc1>(rom, bus, cpu, parent);
+  case 2:
+    return std::make_unique<Uxrom>(rom, bus, cpu, parent);
+  case 3:
+    return std::make_unique<Cnrom>(rom, bus, cpu, parent);
+  case 4:
+    return std::make_unique<Mmc3>(rom, bus, cpu, parent);
+  default:
+    return nullptr;
+  }
+}
+
+Mapper::Mapper(const Rom &rom, Bus *bus, Cpu *cpu, const Mapper *parent)
+    : m_rom(rom), m_bus(bus), m_cpu(cpu), m_chr_version(0),
+      m_mirroring(rom.mirroring()) {
+  // the bus maps whole pages.
+  size_t prg_ram_size = rom.prg_ram_size() & ~(Bus::page_size - 1);
+  if (parent) {
+    m_prg_ram = parent->m_prg_ram;
+  } else if (prg_ram_size) {
+    m_prg_ram = Memory(prg_ram_size);
+    if (rom.trainer() && prg_ram_size >= 0x2000) {
+      for (size_t i = 0; i < Rom::trainer_size; i += Memory::page_size)
+        std::memcpy(m_prg_ram.own((0x1000 + i) / Memory::page_size),
+                    rom.trainer() + i, Memory::page_size);
+    }
+  }
+  if (m_prg_ram.size())
+    m_bus->map(0x6000, 0x7FFF, &m_prg_ram);
+
+  if (rom.chr()) {
+    // CHR-ROM is never written through m_chr.
+    m_chr = const_cast<uint8_t *>(rom.chr());
+    m_chr_size = rom.chr_size();
+  } else {
+    m_chr_ram.resize(std::max<size_t>(rom.chr_ram_size(), 0x2000));
+    m_chr = m_chr_ram.data();
+    m_chr_size = m_chr_ram.size();
+  }
+  std::fill(std::begin(m_chr_pages), std::end(m_chr_pages), m_chr);
+
+  if (parent && rom.chr()) {
+    m_chr_rows = parent->m_chr_rows;
+  } else {
+    // CHR-RAM starts zeroed, so are its rows.
+    m_chr_rows = std::make_shared<std::vector<uint64_t>>(m_chr_size / 2);
+    if (rom.chr())
+      pixels::decode(m_chr, m_chr_size / 16, m_chr_rows->data());
+  }
+  std::fill(std::begin(m_chr_row_pages), std::end(m_chr_row_pages),
+            m_chr_rows->data());
+}
+
+Mapper::~Mapper() { m_bus->unmap(0x6000, 0xFFFF); }
+
+uint8_t Mapper::read(uint16_t) { return 0; }
+
+void Mapper::write(uint16_t, uint8_t) {}
+
+void Mapper::write_chr(uint16_t address, uint8_t data) {
+  if (m_chr_ram.empty())
+    return;
+  size_t offset = m_chr_pages[(address >> 10) & 7] - m_chr + (address & 0x3FF);
+  m_chr[offset] = data;
+  // decode the tile again, 16 bytes make 8 rows.
+  offset &= ~size_t(15);
+  pixels::decode(m_chr + offset, 1, &(*m_chr_rows)[offset / 2]);
+  m_chr_version++;
+}
+
+void Mapper::save(state::Writer &state) const {
+  state.write(m_chr_ram.data(), m_chr_ram.size());
+
+  uint32_t prg_banks[0x80];
+  for (size_t page = 0x80; page < Bus::page_count; page++)
+    prg_banks[page - 0x80] = m_bus->memory(page) - m_rom.prg();
+  state.write(prg_banks);
+  uint32_t chr_banks[8];
+  for (size_t page = 0; page < 8; page++)
+    chr_banks[page] = m_chr_pages[page] - m_chr;
+  state.write(chr_banks);
+  state.write(m_mirroring);
+}
+
+void Mapper::load(state::Reader &state) {
+  state.read(m_chr_ram.data(), m_chr_ram.size());
+  if (!m_chr_ram.empty())
+    pixels::decode(m_chr, m_chr_size / 16, m_chr_rows->data());
+
+  uint32_t prg_banks[0x80];
+  state.read(prg_banks);
+  for (size_t page = 0x80; page < Bus::page_count; page++) {
+    uint8_t *memory = const_cast<uint8_t *>(m_rom.prg()) +
+                      prg_banks[page - 0x80] % m_rom.prg_size();
+    m_bus->map(page << 8, (page << 8) | 0xFF, memory, Bus::page_size, false,
+               this);
+  }
+  uint32_t chr_banks[8];
+  state.read(chr_banks);
+  for (size_t page = 0; page < 8; page++) {
+    m_chr_pages[page] = m_chr + chr_banks[page] % m_chr_size;
+    m_chr_row_pages[page] = &(*m_chr_rows)[(m_chr_pages[page] - m_chr) / 2];
+  }
+  m_chr_version++;
+  state.read(m_mirroring);
+}
+
+void Mapper::map_prg(uint16_t address, size_t size, int bank) {
+  size_t prg_size = m_rom.prg_size();
+  // PRG-ROM is mapped read only, so it is never written through the bus.
+  uint8_t *memory = const_cast<uint8_t *>(m_rom.prg()) +
+                    bank_offset(bank, size, prg_size);
+  m_bus->map(address, address + size - 1, memory, std::min(size, prg_size),
+             false, this);
+}
+
+void Mapper::map_chr(uint16_t address, size_t size, int bank) {
+  uint8_t *memory = m_chr + bank_offset(bank, size, m_chr_size);
+  for (size_t offset = 0; offset < size; offset += chr_page_size) {
+    size_t page = ((address + offset) >> 10) & 7;
+    m_chr_pages[page] = memory + offset % m_chr_size;
+    m_chr_row_pages[page] = &(*m_chr_rows)[(m_chr_pages[page] - m_chr) / 2];
+  }
+  m_chr_version++;
+}
@@ -0,0 +1,32 @@
+#include "Memory.hpp"
+
+#include <atomic>
+
+Memory::Memory(size_t size) : m_pages(size / page_size) {
+  for (auto &page : m_pages)
+    page = std::make_shared<Page>(Page{});
+}
+
+uint8_t *Memory::own(size_t index) {
+  std::shared_ptr<Page> &page = m_pages[index];
+  if (page.use_count() > 1)
+    page = std::make_shared<Page>(*page);
+  else
+    // a fork on another thread may have just dropped its copy of the page.
+    std::atomic_thread_fence(std::memory_order_acquire);
+  return page->data();
+}
+
+void Memory::save(state::Writer &state) const {
+  for (const auto &page : m_pages)
+    state.write(*page);
+}
+
+void Memory::load(state::Reader &state) {
+  for (auto &page : m_pages) {
+    // shared pages are replaced, not copied before being overwritten.
+    if (page.use_count() > 1)
+      page = std::make_shared<Page>();
+    state.read(*page);
+  }
+}
@@ -0,0 +1,447 @@
+#include "Nes.hpp"
+#include "Rewind.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+namespace {
+
+/**
+ * @return FNV-1a hash of size bytes at data, continuing from hash.
+ */
+uint64_t hash(const uint8_t *data, size_t size, uint64_t hash) {
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ data[i]) * 0x100000001B3;
+  return hash;
+}
+
+/**
+ * Device the images of open_test() report to: a write to even addresses
+ * marks rendering switched on, a write to odd addresses the interrupt
+ * taken.
+ */
+class Probe : public Device {
+public:
+  explicit Probe(Nes *nes) : m_nes(nes), m_frame(0), m_on(0), m_irq(0) {}
+
+  uint8_t read(uint16_t) override { return 0; }
+
+  void write(uint16_t address, uint8_t) override {
+    if (address & 1) {
+      m_irq = m_nes->cpu().clock() * Ppu::dots_per_cycle;
+    } else {
+      // dot 0 of scanline 0 of the frame rendered.
+      m_nes->ppu().catch_up();
+      m_on = m_nes->cpu().clock() * Ppu::dots_per_cycle;
+      m_frame = m_nes->ppu().next_vblank() * Ppu::dots_per_cycle -
+                (241 * Ppu::dots_per_scanline + 1);
+    }
+  }
+
+  /// @return Dot of the master clock the frame rendered starts at.
+  uint64_t frame() const { return m_frame; }
+
+  /// @return Dot of the master clock rendering was turned on at.
+  uint64_t on() const { return m_on; }
+
+  /// @return Dot of the master clock the interrupt was taken at, 0 if none.
+  uint64_t irq() const { return m_irq; }
+
+private:
+  Nes *m_nes;
+  uint64_t m_frame;
+  uint64_t m_on;
+  uint64_t m_irq;
+};
+
+/**
+ * Opens an MMC3 image with 32KB of PRG-ROM and CHR-RAM, written to a
+ * temporary file. Its code in the fixed bank at $E000 turns rendering on mid
+ * frame with the scanline counter set to latch, reporting to a Probe at
+ * $5000, then adds button A to $21 and counts $20 up to a multiple of 64
+ * every frame.
+ * @return nullptr if the image can not be written or opened.
+ */
+std::unique_ptr<Nes> open_test(uint8_t latch) {
+  std::vector<uint8_t> image(16 + 0x8000);
+  const uint8_t header[] = {'N', 'E', 'S', 0x1A, 2, 0, 0x40};
+  std::memcpy(image.data(), header, sizeof(header));
+  const uint8_t code[] = {
+      0x78,             // $E000 SEI
+      0xA2, 0xFF,       // LDX #$FF
+      0x9A,             // TXS
+      0xA2, 0xC0,       // LDX #$C0
+      0x8E, 0x17, 0x40, // STX $4017, 5 steps, no frame counter interrupts
+      0x2C, 0x02, 0x20, // $E009 BIT $2002, A is 0
+      0x10, 0xFB,       // BPL $E009
+      0xA0, 0x04,       // LDY #$04, wait for scanline 24 or so
+      0xA2, 0x00,       // $E010 LDX #$00
+      0xCA,             // $E012 DEX
+      0xD0, 0xFD,       // BNE $E012
+      0x88,             // DEY
+      0xD0, 0xF8,       // BNE $E010
+      0xA9, latch,      // LDA #latch
+      0x8D, 0x00, 0xC0, // STA $C000, latch
+      0x8D, 0x01, 0xC0, // STA $C001, reload
+      0x8D, 0x01, 0xE0, // STA $E001, enable interrupts
+      0xA9, 0x00,       // LDA #$00
+      0x85, 0x10,       // STA $10
+      0xA9, 0x18,       // LDA #$18
+      0x8D, 0x01, 0x20, // STA $2001, rendering on
+      0x8D, 0x00, 0x50, // STA $5000
+      0x58,             // CLI
+      0xA5, 0x10,       // $E030 LDA $10, idle until the interrupt
+      0xF0, 0xFC,       // BEQ $E030
+      0xAD, 0x02, 0x20, // $E034 LDA $2002, idle until vertical blank
+      0x10, 0xFB,       // BPL $E034
+      0xA9, 0x01,       // LDA #$01
+      0x8D, 0x16, 0x40, // STA $4016, latch buttons
+      0xA9, 0x00,       // LDA #$00
+      0x8D, 0x16, 0x40, // STA $4016
+      0xAD, 0x16, 0x40, // LDA $4016, button A
+      0x29, 0x01,       // AND #$01
+      0x65, 0x21,       // ADC $21
+      0x85, 0x21,       // STA $21
+      0xE6, 0x20,       // $E04C INC $20, not idle, it writes what it waits on
+      0xA5, 0x20,       // LDA $20
+      0x29, 0x3F,       // AND #$3F
+      0xD0, 0xF8,       // BNE $E04C
+      0x4C, 0x34, 0xE0, // JMP $E034
+      0x8D, 0x00, 0xE0, // $E057 STA $E000, acknowledge
+      0x8D, 0x01, 0x50, // STA $5001
+      0xE6, 0x10,       // INC $10
+      0x40,             // $E05F RTI
+  };
+  uint8_t *prg = image.data() + 16;
+  std::memcpy(prg + 0x6000, code, sizeof(code));
+  const uint8_t vectors[] = {0x5F, 0xE0, 0x00, 0xE0, 0x57, 0xE0};
+  std::memcpy(prg + 0x7FFA, vectors, sizeof(vectors));
+
+  char path[] = "/tmp/nes_testXXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    return nullptr;
+  bool written =
+      ::write(fd, image.data(), image.size()) == (ssize_t)image.size();
+  ::close(fd);
+  auto nes = written ? Nes::open(path) : nullptr;
+  unlink(path);
+  return nes;
+}
+
+/// Latch of the scanline counter set by images of open_test().
+constexpr uint8_t test_latch = 10;
+
+/**
+ * Checks that the MMC3 scanline counter interrupts the cpu on the scanline
+ * set by its latch.
+ */
+bool test_mmc3() {
+  auto nes = open_test(test_latch);
+  if (!nes)
+    return false;
+  Probe probe(nes.get());
+  nes->bus().map(0x5000, 0x50FF, &probe);
+  for (int i = 0; i < 3; i++)
+    nes->run_frame();
+  nes->bus().unmap(0x5000, 0x50FF);
+
+  // rendering is turned on mid frame, so the interrupt comes due before any
+  // other event. The counter reloads at dot 260 of the next scanline, counts
+  // down latch scanlines and the cpu takes the interrupt before the one after.
+  long on = (long)(probe.on() - probe.frame()) - 260;
+  on = (on + Ppu::dots_per_scanline - 1) / Ppu::dots_per_scanline;
+  long scanline = -1;
+  if (probe.irq() >= probe.frame() + 260)
+    scanline = (probe.irq() - probe.frame() - 260) / Ppu::dots_per_scanline;
+  bool ok = probe.on() > probe.frame() && scanline == on + test_latch;
+  std::printf("mmc3 irq latch %d: after scanline %ld %s\n", test_latch,
+              scanline, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+/**
+ * Runs frames of nes from frame, pressing button A every third one.
+ */
+void run_frames(Nes &nes, int frame, int frames) {
+  for (int i = frame; i < frame + frames; i++) {
+    nes.set_buttons(0, i % 3 ? 0 : Io::Button::a);
+    nes.run_frame();
+  }
+}
+
+/**
+ * Checks that a state saved and loaded again runs on exactly as the console
+ * it was saved from, and that states of another image or a newer version are
+ * rejected.
+ */
+bool test_state() {
+  auto nes = open_test(test_latch);
+  auto other = open_test(test_latch + 1);
+  if (!nes || !other)
+    return false;
+  std::vector<uint8_t> saved, first, second;
+  run_frames(*nes, 0, 5);
+  nes->save_state(saved);
+  run_frames(*nes, 5, 10);
+  nes->save_state(first);
+
+  bool ok = nes->load_state(saved.data(), saved.size());
+  nes->save_state(second);
+  ok &= second == saved;
+  run_frames(*nes, 5, 10);
+  nes->save_state(second);
+  ok &= second == first && first != saved;
+
+  // the image hashes PRG-ROM, which differs in the latch.
+  ok &= !other->load_state(saved.data(), saved.size());
+  // the version follows the 4 byte magic, see state::Writer.
+  uint32_t newer = state::version + 1;
+  std::memcpy(saved.data() + 4, &newer, sizeof(newer));
+  ok &= !nes->load_state(saved.data(), saved.size());
+  nes->save_state(second);
+  ok &= second == first;
+  std::printf("save state round trip %s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+/**
+ * Frame sink of palette indices with its own double buffer.
+ */
+class TestSink {
+public:
+  TestSink()
+      : m_memory(2 * size), m_buffers{m_memory.data(), m_memory.data() + size},
+        m_sink(FrameSink::Format::index, m_buffers, 2) {}
+
+  FrameSink *sink() { return &m_sink; }
+
+  /// @return Latest frame completed, size bytes.
+  const uint8_t *frame() { return m_sink.acquire(); }
+
+  static constexpr size_t size = FrameSink::width * FrameSink::height;
+
+private:
+  std::vector<uint8_t> m_memory;
+  uint8_t *m_buffers[2];
+  FrameSink m_sink;
+};
+
+/**
+ * Checks that stepping back through a history small enough to wrap several
+ * times restores exactly the states recorded, across keyframes.
+ */
+bool test_rewind() {
+  auto nes = open_test(test_latch);
+  if (!nes)
+    return false;
+  // keyframes of the image take about 750 bytes and deltas 100, so the ring
+  // holds a dozen snapshots and wraps about five times.
+  constexpr size_t keyframe_interval = 4;
+  Rewind rewind(nes.get(), 1, 3 << 10, keyframe_interval);
+  std::vector<std::vector<uint8_t>> states(60);
+  for (int i = 0; i < (int)states.size(); i++) {
+    run_frames(*nes, i, 1);
+    nes->save_state(states[i]);
+    rewind.record();
+  }
+
+  // the oldest snapshots were dropped, the newest are kept in order.
+  size_t size = rewind.size();
+  bool ok = size > keyframe_interval + 1 && size < states.size();
+  std::vector<uint8_t> state;
+  for (size_t i = 0; i < size && ok; i++) {
+    ok &= rewind.step_back();
+    nes->save_state(state);
+    ok &= state == states[states.size() - 1 - i];
+  }
+  ok &= !rewind.step_back() && !rewind.size() && !rewind.bytes();
+  std::printf("rewind %s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+/**
+ * Checks that a fork and its parent given the same input run to the same
+ * frames and states, and that writes of either side after the fork do not
+ * reach the other through the pages they share.
+ */
+bool test_fork() {
+  auto nes = open_test(test_latch);
+  if (!nes)
+    return false;
+  TestSink sinks[2];
+  nes->set_frame_sink(sinks[0].sink());
+  run_frames(*nes, 0, 5);
+  auto fork = nes->fork();
+  if (!fork)
+    return false;
+  fork->set_frame_sink(sinks[1].sink());
+
+  bool ok = true;
+  std::vector<uint8_t> states[2];
+  for (int i = 5; i < 15; i++) {
+    run_frames(*nes, i, 1);
+    run_frames(*fork, i, 1);
+    nes->save_state(states[0]);
+    fork->save_state(states[1]);
+    ok &= states[0] == states[1];
+    ok &= !std::memcmp(sinks[0].frame(), sinks[1].frame(), TestSink::size);
+  }
+
+  // either side writes RAM and PRG-RAM the other still shares.
+  nes->bus().write(0x0300, 0x55);
+  fork->bus().write(0x0301, 0xAA);
+  nes->bus().write(0x6000, 0x55);
+  fork->bus().write(0x6001, 0xAA);
+  ok &= nes->bus().read(0x0300) == 0x55 && fork->bus().read(0x0300) == 0;
+  ok &= fork->bus().read(0x0301) == 0xAA && nes->bus().read(0x0301) == 0;
+  ok &= nes->bus().read(0x6000) == 0x55 && fork->bus().read(0x6000) == 0;
+  ok &= fork->bus().read(0x6001) == 0xAA && nes->bus().read(0x6001) == 0;
+  nes->set_frame_sink(nullptr);
+  std::printf("fork %s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+/**
+ * Checks that skipping idle loops leaves frames, memory and the clock as
+ * running them does. The image waits for vertical blank with LDA $2002 /
+ * BPL, which is skipped, and counts $20 in a loop which must not be.
+ */
+bool test_idle_loops() {
+  std::unique_ptr<Nes> consoles[] = {open_test(test_latch),
+                                     open_test(test_latch)};
+  if (!consoles[0] || !consoles[1])
+    return false;
+  consoles[1]->cpu().set_idle_loops(false);
+  TestSink sinks[2];
+  for (int i = 0; i < 2; i++)
+    consoles[i]->set_frame_sink(sinks[i].sink());
+
+  bool ok = true;
+  std::vector<uint8_t> states[2];
+  for (int i = 0; i < 10; i++) {
+    for (int j = 0; j < 2; j++) {
+      run_frames(*consoles[j], i, 1);
+      consoles[j]->save_state(states[j]);
+    }
+    ok &= consoles[0]->cpu().clock() == consoles[1]->cpu().clock();
+    ok &= states[0] == states[1];
+    ok &= !std::memcmp(sinks[0].frame(), sinks[1].frame(), TestSink::size);
+  }
+  for (auto &nes : consoles)
+    nes->set_frame_sink(nullptr);
+  std::printf("idle loops %s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+} // namespace
+
+bool Nes::test() {
+  bool ok = test_mmc3();
+  ok = test_state() && ok;
+  ok = test_rewind() && ok;
+  ok = test_fork() && ok;
+  ok = test_idle_loops() && ok;
+  return ok;
+}
+
+Nes::Nes() : m_cpu(&m_bus), m_image(0) {}
+
+std::unique_ptr<Nes> Nes::open(const char *path, uint32_t sample_rate) {
+  auto rom = std::make_shared<Rom>();
+  if (!rom->open(path))
+    return nullptr;
+  return open(std::move(rom), sample_rate);
+}
+
+std::unique_ptr<Nes> Nes::open(std::shared_ptr<Rom> rom,
+                               uint32_t sample_rate) {
+  std::unique_ptr<Nes> nes(new Nes());
+  nes->m_rom = std::move(rom);
+  if (!nes->create(sample_rate, nullptr))
+    return nullptr;
+  uint64_t image = hash(nes->m_rom->prg(), nes->m_rom->prg_size(),
+                        0xCBF29CE484222325 ^ nes->m_rom->mapper());
+  nes->m_image = hash(nes->m_rom->chr(), nes->m_rom->chr_size(), image);
+  nes->reset();
+  return nes;
+}
+
+bool Nes::create(uint32_t sample_rate, const Mapper *parent) {
+  m_mapper = Mapper::create(*m_rom, &m_bus, &m_cpu, parent);
+  if (!m_mapper)
+    return false;
+  m_ppu = std::make_unique<Ppu>(&m_bus, &m_cpu, m_mapper.get());
+  m_apu = std::make_unique<Apu>(&m_bus, &m_cpu, sample_rate);
+  m_io = std::make_unique<Io>(&m_bus, &m_cpu, m_ppu.get(), m_apu.get());
+  return true;
+}
+
+std::unique_ptr<Nes> Nes::fork() {
+  std::unique_ptr<Nes> nes(new Nes());
+  nes->m_rom = m_rom;
+  nes->m_image = m_image;
+  if (!nes->create(m_apu->sample_rate(), m_mapper.get()))
+    return nullptr;
+
+  std::vector<uint8_t> state;
+  state::Writer writer(state, m_image);
+  save_components(writer);
+  writer.finish();
+  state::Reader reader(state.data(), state.size(), m_image);
+  nes->load_components(reader);
+
+  // both sides write shared pages through the slow path from now on.
+  nes->m_bus.ram() = m_bus.ram();
+  nes->m_bus.remap();
+  m_bus.remap();
+  return nes;
+}
+
+void Nes::reset() { m_cpu.reset(); }
+
+void Nes::run_frame() {
+  uint64_t frame = m_ppu->frame_count();
+  while (m_ppu->frame_count() == frame && !m_cpu.halted())
+    m_cpu.run_to(m_ppu->next_vblank());
+  m_apu->end_batch();
+}
+
+void Nes::save_state(std::vector<uint8_t> &state) const {
+  state::Writer writer(state, m_image);
+  save_components(writer);
+  m_bus.ram().save(writer);
+  m_mapper->prg_ram().save(writer);
+  writer.finish();
+}
+
+bool Nes::load_state(const uint8_t *state, size_t size) {
+  state::Reader reader(state, size, m_image);
+  if (!reader.valid())
+    return false;
+  load_components(reader);
+  m_bus.ram().load(reader);
+  m_mapper->prg_ram().load(reader);
+  // pages were replaced, code decoded from them is stale.
+  m_bus.remap();
+  return true;
+}
+
+void Nes::save_components(state::Writer &state) const {
+  m_cpu.save(state);
+  m_mapper->save(state);
+  m_ppu->save(state);
+  m_apu->save(state);
+  m_io->save(state);
+}
+
+void Nes::load_components(state::Reader &state) {
+  m_cpu.load(state);
+  m_mapper->load(state);
+  m_ppu->load(state);
+  m_apu->load(state);
+  m_io->load(state);
+}
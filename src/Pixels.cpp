@@ -0,0 +1,226 @@
+#include "Pixels.hpp"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXELS_X86
+#include <immintrin.h>
+#endif
+
+namespace pixels {
+
+namespace {
+
+void decode_scalar(const uint8_t *tiles, size_t count, uint64_t *rows) {
+  for (size_t i = 0; i < count * 8; i++) {
+    const uint8_t *tile = tiles + (i >> 3) * 16 + (i & 7);
+    uint8_t *row = reinterpret_cast<uint8_t *>(rows + i);
+    for (int n = 0; n < 8; n++)
+      row[n] = ((tile[0] >> (7 - n)) & 1) | (((tile[8] >> (7 - n)) & 1) << 1);
+  }
+}
+
+void compose_scalar(const uint8_t *background, const uint8_t *sprites,
+                    const uint8_t *palette, uint8_t mask, uint8_t *out,
+                    size_t count) {
+  for (size_t x = 0; x < count; x++) {
+    uint8_t pixel = background[x];
+    uint8_t sprite = sprites[x];
+    if ((sprite & 0x1F) && (!pixel || !(sprite & 0x80)))
+      pixel = sprite & 0x1F;
+    out[x] = palette[pixel] & mask;
+  }
+}
+
+#ifdef PIXELS_X86
+
+/**
+ * @return Byte n of bytes 0 or 1, if bit 7 - n of byte n of planes is set.
+ */
+__attribute__((target("sse2"))) __m128i plane(__m128i planes, __m128i bits,
+                                              __m128i color) {
+  __m128i set = _mm_cmpeq_epi8(_mm_and_si128(planes, bits), bits);
+  return _mm_and_si128(set, color);
+}
+
+__attribute__((target("sse2"))) void
+decode_sse2(const uint8_t *tiles, size_t count, uint64_t *rows) {
+  const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8,
+                                    16, 32, 64, -128);
+  const __m128i one = _mm_set1_epi8(1), two = _mm_set1_epi8(2);
+  for (size_t i = 0; i < count; i++, tiles += 16, rows += 8) {
+    __m128i low = _mm_loadl_epi64((const __m128i *)tiles);
+    __m128i high = _mm_loadl_epi64((const __m128i *)(tiles + 8));
+    // repeat each byte 8 times, 2 rows in each register.
+    low = _mm_unpacklo_epi8(low, low);
+    high = _mm_unpacklo_epi8(high, high);
+    for (int half = 0; half < 2; half++) {
+      __m128i l = half ? _mm_unpackhi_epi16(low, low)
+                       : _mm_unpacklo_epi16(low, low);
+      __m128i h = half ? _mm_unpackhi_epi16(high, high)
+                       : _mm_unpacklo_epi16(high, high);
+      __m128i first = _mm_or_si128(
+          plane(_mm_unpacklo_epi32(l, l), bits, one),
+          plane(_mm_unpacklo_epi32(h, h), bits, two));
+      __m128i second = _mm_or_si128(
+          plane(_mm_unpackhi_epi32(l, l), bits, one),
+          plane(_mm_unpackhi_epi32(h, h), bits, two));
+      _mm_storeu_si128((__m128i *)(rows + half * 4), first);
+      _mm_storeu_si128((__m128i *)(rows + half * 4 + 2), second);
+    }
+  }
+}
+
+/**
+ * @return Palette entries selected by merging sprites over background.
+ */
+__attribute__((target("sse2"))) __m128i merge(__m128i background,
+                                              __m128i sprites) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sprite = _mm_and_si128(sprites, _mm_set1_epi8(0x1F));
+  __m128i front = _mm_cmpeq_epi8(_mm_and_si128(sprites, _mm_set1_epi8(-128)),
+                                 zero);
+  __m128i visible = _mm_or_si128(_mm_cmpeq_epi8(background, zero), front);
+  // sprite pixels which are opaque and not hidden by background.
+  __m128i take =
+      _mm_andnot_si128(_mm_cmpeq_epi8(sprite, zero), visible);
+  return _mm_or_si128(_mm_and_si128(take, sprite),
+                      _mm_andnot_si128(take, background));
+}
+
+__attribute__((target("sse2"))) void
+compose_sse2(const uint8_t *background, const uint8_t *sprites,
+             const uint8_t *palette, uint8_t mask, uint8_t *out, size_t count) {
+  size_t x = 0;
+  for (; x + 16 <= count; x += 16) {
+    __m128i entries =
+        merge(_mm_loadu_si128((const __m128i *)(background + x)),
+              _mm_loadu_si128((const __m128i *)(sprites + x)));
+    // SSE2 has no byte shuffle to look the palette up with.
+    alignas(16) uint8_t index[16];
+    _mm_store_si128((__m128i *)index, entries);
+    for (int i = 0; i < 16; i++)
+      out[x + i] = palette[index[i]] & mask;
+  }
+  compose_scalar(background + x, sprites + x, palette, mask, out + x,
+                 count - x);
+}
+
+__attribute__((target("avx2"))) void
+decode_avx2(const uint8_t *tiles, size_t count, uint64_t *rows) {
+  const __m256i bits = _mm256_set1_epi64x(0x0102040810204080);
+  // each byte repeated 8 times, rows 0-3 and rows 4-7.
+  const __m256i repeat[2] = {
+      _mm256_set_epi64x(0x0303030303030303, 0x0202020202020202,
+                        0x0101010101010101, 0x0000000000000000),
+      _mm256_set_epi64x(0x0707070707070707, 0x0606060606060606,
+                        0x0505050505050505, 0x0404040404040404)};
+  const __m256i one = _mm256_set1_epi8(1), two = _mm256_set1_epi8(2);
+  for (size_t i = 0; i < count; i++, tiles += 16, rows += 8) {
+    uint64_t planes[2];
+    std::memcpy(planes, tiles, sizeof(planes));
+    __m256i low = _mm256_set1_epi64x(planes[0]);
+    __m256i high = _mm256_set1_epi64x(planes[1]);
+    for (int half = 0; half < 2; half++) {
+      __m256i l = _mm256_shuffle_epi8(low, repeat[half]);
+      __m256i h = _mm256_shuffle_epi8(high, repeat[half]);
+      l = _mm256_and_si256(
+          _mm256_cmpeq_epi8(_mm256_and_si256(l, bits), bits), one);
+      h = _mm256_and_si256(
+          _mm256_cmpeq_epi8(_mm256_and_si256(h, bits), bits), two);
+      _mm256_storeu_si256((__m256i *)(rows + half * 4),
+                          _mm256_or_si256(l, h));
+    }
+  }
+}
+
+__attribute__((target("avx2"))) void
+compose_avx2(const uint8_t *background, const uint8_t *sprites,
+             const uint8_t *palette, uint8_t mask, uint8_t *out, size_t count) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i low_entries =
+      _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)palette));
+  const __m256i high_entries = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)(palette + 16)));
+  const __m256i colors = _mm256_set1_epi8(mask);
+  size_t x = 0;
+  for (; x + 32 <= count; x += 32) {
+    __m256i pixel = _mm256_loadu_si256((const __m256i *)(background + x));
+    __m256i sprite_pixel = _mm256_loadu_si256((const __m256i *)(sprites + x));
+    __m256i sprite =
+        _mm256_and_si256(sprite_pixel, _mm256_set1_epi8(0x1F));
+    __m256i front = _mm256_cmpeq_epi8(
+        _mm256_and_si256(sprite_pixel, _mm256_set1_epi8(-128)), zero);
+    __m256i visible = _mm256_or_si256(_mm256_cmpeq_epi8(pixel, zero), front);
+    __m256i take =
+        _mm256_andnot_si256(_mm256_cmpeq_epi8(sprite, zero), visible);
+    __m256i entry = _mm256_blendv_epi8(pixel, sprite, take);
+
+    // shuffles use the low 4 bits, bit 4 picks the sprite half.
+    __m256i upper = _mm256_cmpeq_epi8(
+        _mm256_and_si256(entry, _mm256_set1_epi8(0x10)),
+        _mm256_set1_epi8(0x10));
+    __m256i color =
+        _mm256_blendv_epi8(_mm256_shuffle_epi8(low_entries, entry),
+                           _mm256_shuffle_epi8(high_entries, entry), upper);
+    _mm256_storeu_si256((__m256i *)(out + x), _mm256_and_si256(color, colors));
+  }
+  compose_scalar(background + x, sprites + x, palette, mask, out + x,
+                 count - x);
+}
+
+#endif
+
+void decode_first(const uint8_t *tiles, size_t count, uint64_t *rows) {
+  select(best());
+  decode(tiles, count, rows);
+}
+
+void compose_first(const uint8_t *background, const uint8_t *sprites,
+                   const uint8_t *palette, uint8_t mask, uint8_t *out,
+                   size_t count) {
+  select(best());
+  compose(background, sprites, palette, mask, out, count);
+}
+
+} // namespace
+
+// the first call selects kernels, so they work before static initialization.
+void (*decode)(const uint8_t *, size_t, uint64_t *) = decode_first;
+void (*compose)(const uint8_t *, const uint8_t *, const uint8_t *, uint8_t,
+                uint8_t *, size_t) = compose_first;
+
+Isa best() {
+#ifdef PIXELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return Isa::avx2;
+  if (__builtin_cpu_supports("sse2"))
+    return Isa::sse2;
+#endif
+  return Isa::scalar;
+}
+
+Isa select(Isa isa) {
+  if (isa > best())
+    isa = best();
+  switch (isa) {
+#ifdef PIXELS_X86
+  case Isa::avx2:
+    decode = decode_avx2;
+    compose = compose_avx2;
+    break;
+  case Isa::sse2:
+    decode = decode_sse2;
+    compose = compose_sse2;
+    break;
+#endif
+  default:
+    decode = decode_scalar;
+    compose = compose_scalar;
+    break;
+  }
+  return isa;
+}
+
+} // namespace pixels
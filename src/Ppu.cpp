@@ -0,0 +1,489 @@
+#include "Ppu.hpp"
+#include "Pixels.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using Event = Scheduler::Event;
+
+Ppu::Ppu(Bus *bus, Cpu *cpu, Mapper *mapper)
+    : m_bus(bus), m_cpu(cpu), m_mapper(mapper),
+      m_dot(cpu->clock() * dots_per_cycle),
+      m_sprite_zero_dot(Scheduler::never), m_frame_count(0), m_scanline(0),
+      m_cycle(0), m_odd(false), m_ctrl(0), m_mask(0), m_status(0),
+      m_oam_address(0), m_latch(0), m_read_buffer(0), m_v(0), m_t(0), m_x(0),
+      m_w(false), m_oam(), m_vram(), m_palette(), m_sink(nullptr) {
+  m_bus->map(0x2000, 0x3FFF, this);
+  m_cpu->scheduler().set_handler(Event::ppu, this);
+  schedule();
+}
+
+Ppu::~Ppu() {
+  m_cpu->scheduler().cancel(Event::ppu);
+  m_cpu->scheduler().set_handler(Event::ppu, nullptr);
+  m_bus->unmap(0x2000, 0x3FFF);
+}
+
+void Ppu::save(state::Writer &state) const {
+  state.write(m_dot);
+  state.write(m_sprite_zero_dot);
+  state.write(m_frame_count);
+  state.write(m_scanline);
+  state.write(m_cycle);
+  state.write(m_odd);
+  state.write(m_ctrl);
+  state.write(m_mask);
+  state.write(m_status);
+  state.write(m_oam_address);
+  state.write(m_latch);
+  state.write(m_read_buffer);
+  state.write(m_v);
+  state.write(m_t);
+  state.write(m_x);
+  state.write(m_w);
+  state.write(m_oam);
+  state.write(m_vram);
+  state.write(m_palette);
+}
+
+void Ppu::load(state::Reader &state) {
+  state.read(m_dot);
+  state.read(m_sprite_zero_dot);
+  state.read(m_frame_count);
+  state.read(m_scanline);
+  state.read(m_cycle);
+  state.read(m_odd);
+  state.read(m_ctrl);
+  state.read(m_mask);
+  state.read(m_status);
+  state.read(m_oam_address);
+  state.read(m_latch);
+  state.read(m_read_buffer);
+  state.read(m_v);
+  state.read(m_t);
+  state.read(m_x);
+  state.read(m_w);
+  state.read(m_oam);
+  state.read(m_vram);
+  state.read(m_palette);
+}
+
+uint8_t Ppu::read(uint16_t address) {
+  catch_up();
+
+  switch (address & 7) {
+  case 2:
+    if (m_dot >= m_sprite_zero_dot) {
+      m_status |= 0x40;
+      m_sprite_zero_dot = Scheduler::never;
+    }
+    // lower bits are open bus.
+    m_latch = (m_status & 0xE0) | (m_latch & 0x1F);
+    m_status &= ~0x80;
+    m_w = false;
+    break;
+  case 4:
+    m_latch = m_oam[m_oam_address];
+    break;
+  case 7: {
+    uint16_t address = m_v & 0x3FFF;
+    if (address >= 0x3F00) {
+      // palette is not buffered, the buffer gets the nametable below it.
+      m_latch = (palette(address) & 0x3F) | (m_latch & 0xC0);
+      m_read_buffer = read_vram(address - 0x1000);
+    } else {
+      m_latch = m_read_buffer;
+      m_read_buffer = read_vram(address);
+    }
+    m_v = (m_v + (m_ctrl & 0x04 ? 32 : 1)) & 0x7FFF;
+    break;
+  }
+  }
+  return m_latch;
+}
+
+uint64_t Ppu::stable_until(uint16_t address) {
+  if ((address & 7) != 2)
+    return 0;
+  catch_up();
+  // a read now would clear vertical blank or the write toggle, set sprite 0
+  // hit or change the latch.
+  if ((m_status & 0x80) || m_w || m_dot >= m_sprite_zero_dot ||
+      (m_latch & 0xE0) != (m_status & 0xE0))
+    return 0;
+
+  // dots until the next start or end of vertical blank and, while rendering,
+  // the next visible scanline evaluating sprite overflow and sprite 0.
+  uint64_t line = m_scanline * dots_per_scanline + m_cycle;
+  uint64_t frame = (uint64_t)scanlines * dots_per_scanline;
+  auto until = [&](uint64_t point) {
+    return (point + frame - line - 1) % frame + 1;
+  };
+  uint64_t dots = std::min(until(241 * dots_per_scanline + 1),
+                           until((scanlines - 1) * dots_per_scanline + 1));
+  if (rendering()) {
+    uint64_t scanline = m_scanline + (m_cycle >= 256);
+    if (scanline < height)
+      dots = std::min(dots, until(scanline * dots_per_scanline + 256));
+  }
+  if (m_sprite_zero_dot != Scheduler::never)
+    dots = std::min(dots, m_sprite_zero_dot - m_dot);
+
+  // reads see the status at the dot of their clock, the change may come a
+  // dot early when the odd frame is shortened.
+  if (dots < 2)
+    return 0;
+  return (m_dot + dots - 2) / dots_per_cycle + 1;
+}
+
+void Ppu::write(uint16_t address, uint8_t data) {
+  catch_up();
+  m_latch = data;
+
+  switch (address & 7) {
+  case 0:
+    // enabling NMI during vertical blank raises it immediately.
+    if (!(m_ctrl & 0x80) && (data & 0x80) && (m_status & 0x80))
+      m_cpu->nmi();
+    m_ctrl = data;
+    m_t = (m_t & ~0x0C00) | ((data & 0x03) << 10);
+    break;
+  case 1:
+    m_mask = data;
+    break;
+  case 3:
+    m_oam_address = data;
+    break;
+  case 4:
+    m_oam[m_oam_address++] = data;
+    break;
+  case 5:
+    if (!m_w) {
+      m_t = (m_t & ~0x001F) | (data >> 3);
+      m_x = data & 7;
+    } else {
+      m_t = (m_t & ~0x73E0) | ((data & 0x07) << 12) | ((data & 0xF8) << 2);
+    }
+    m_w = !m_w;
+    break;
+  case 6:
+    if (!m_w) {
+      m_t = (m_t & 0x00FF) | ((data & 0x3F) << 8);
+    } else {
+      m_t = (m_t & 0xFF00) | data;
+      m_v = m_t;
+    }
+    m_w = !m_w;
+    break;
+  case 7:
+    write_vram(m_v & 0x3FFF, data);
+    m_v = (m_v + (m_ctrl & 0x04 ? 32 : 1)) & 0x7FFF;
+    break;
+  }
+
+  // rendering or NMI may have been switched.
+  schedule();
+}
+
+void Ppu::write_oam(const uint8_t *data) {
+  catch_up();
+  for (size_t i = 0; i < sizeof(m_oam); i++)
+    m_oam[(m_oam_address + i) & 0xFF] = data[i];
+}
+
+void Ppu::catch_up() { advance(m_cpu->clock() * dots_per_cycle); }
+
+void Ppu::handle(Scheduler::Event, uint64_t) {
+  catch_up();
+  schedule();
+}
+
+void Ppu::advance(uint64_t target) {
+  while (m_dot < target) {
+    uint16_t next = next_point();
+    uint64_t reach = m_dot + (next - m_cycle);
+    if (reach > target) {
+      m_cycle += target - m_dot;
+      m_dot = target;
+      return;
+    }
+    m_dot = reach;
+    m_cycle = next;
+
+    if (m_cycle == scanline_length()) {
+      m_cycle = 0;
+      if (++m_scanline == scanlines) {
+        m_scanline = 0;
+        m_odd = !m_odd;
+      }
+    } else {
+      point();
+    }
+  }
+}
+
+uint16_t Ppu::next_point() const {
+  if (m_scanline < height) {
+    if (m_cycle < 256)
+      return 256;
+    if (m_cycle < 260)
+      return 260;
+  } else if (m_scanline == 241) {
+    if (m_cycle < 1)
+      return 1;
+  } else if (m_scanline == scanlines - 1) {
+    if (m_cycle < 1)
+      return 1;
+    if (m_cycle < 260)
+      return 260;
+    if (m_cycle < 304)
+      return 304;
+  }
+  return scanline_length();
+}
+
+uint16_t Ppu::scanline_length() const {
+  // pre-render line of odd frames is one dot shorter while rendering.
+  if (m_scanline == scanlines - 1 && m_odd && rendering())
+    return dots_per_scanline - 1;
+  return dots_per_scanline;
+}
+
+void Ppu::point() {
+  switch (m_cycle) {
+  case 1:
+    if (m_scanline == 241) {
+      m_status |= 0x80;
+      if (m_sink)
+        m_sink->end_frame();
+      m_frame_count++;
+      if (m_ctrl & 0x80)
+        m_cpu->nmi();
+    } else {
+      m_status &= ~0xE0;
+      m_sprite_zero_dot = Scheduler::never;
+    }
+    break;
+  case 256:
+    render_scanline();
+    if (rendering()) {
+      increment_y();
+      // copy horizontal position from t, done at dot 257.
+      m_v = (m_v & ~0x041F) | (m_t & 0x041F);
+    }
+    break;
+  case 260:
+    if (rendering())
+      m_mapper->scanline();
+    break;
+  case 304:
+    // copy vertical position from t, done during dots 280-304.
+    if (rendering())
+      m_v = (m_v & ~0x7BE0) | (m_t & 0x7BE0);
+    break;
+  }
+}
+
+uint64_t Ppu::next_vblank() const {
+  uint64_t line = m_scanline * dots_per_scanline + m_cycle;
+  uint64_t frame = (uint64_t)scanlines * dots_per_scanline;
+  uint64_t vblank = 241 * dots_per_scanline + 1;
+  uint64_t dots = (vblank + frame - line - 1) % frame + 1;
+  // the odd frame may end a dot early, rounding up only delays the event.
+  return (m_dot + dots + dots_per_cycle - 1) / dots_per_cycle;
+}
+
+void Ppu::schedule() {
+  // start of vertical blank, then the dot the mapper is clocked at.
+  uint64_t time = next_vblank();
+
+  if (rendering() && m_mapper->counts_scanlines()) {
+    // dot 260 of the next visible or pre-render line, line 262 is line 0 of
+    // the next frame.
+    uint64_t line = m_scanline * dots_per_scanline + m_cycle;
+    uint64_t scanline = m_scanline + (m_cycle >= 260);
+    if (scanline >= height && scanline < scanlines - 1)
+      scanline = scanlines - 1;
+    uint64_t dots = scanline * dots_per_scanline + 260 - line;
+    time = std::min(time, (m_dot + dots + dots_per_cycle - 1) / dots_per_cycle);
+  }
+
+  m_cpu->scheduler().schedule(Event::ppu, time);
+}
+
+void Ppu::render_scanline() {
+  uint8_t *line = m_sink ? m_sink->begin_line(m_scanline) : nullptr;
+  if (!rendering()) {
+    if (!line)
+      return;
+    // backdrop color, or palette entry addressed by v while it points there.
+    uint16_t address = m_v & 0x3FFF;
+    uint8_t color = palette(address >= 0x3F00 ? address : 0x3F00);
+    std::fill(line, line + width, color & (m_mask & 0x01 ? 0x30 : 0x3F));
+    m_sink->end_line(m_scanline);
+    return;
+  }
+
+  alignas(32) uint8_t sprites[width + 8] = {};
+  bool sprite_zero = (m_mask & 0x10) && render_sprites(sprites);
+  if (!(m_mask & 0x04))
+    std::fill(sprites, sprites + 8, 0);
+  bool hit = sprite_zero && m_sprite_zero_dot == Scheduler::never &&
+             !(m_status & 0x40);
+  // without a sink background only matters for sprite 0 hit.
+  if (!line && !hit)
+    return;
+
+  // 33 tiles cover the line for any fine X scroll.
+  alignas(32) uint8_t background[33 * 8] = {};
+  if (m_mask & 0x08) {
+    uint16_t v = m_v;
+    uint16_t table = m_ctrl & 0x10 ? 0x1000 : 0x0000;
+    uint16_t fine_y = (v >> 12) & 7;
+    for (int tile = 0; tile < 33; tile++) {
+      uint8_t index = nametable(0x2000 | (v & 0x0FFF));
+      uint8_t attribute = nametable(0x23C0 | (v & 0x0C00) |
+                                    ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+      attribute = (attribute >> (((v >> 4) & 4) | (v & 2))) & 3;
+      uint64_t row = m_mapper->chr_row(table + index * 16 + fine_y);
+      // attribute goes to opaque pixels only.
+      uint64_t opaque = (row | row >> 1) & 0x0101010101010101;
+      row |= opaque * (attribute << 2);
+      std::memcpy(background + tile * 8, &row, sizeof(row));
+
+      if ((v & 0x001F) == 31)
+        v = (v & ~0x001F) ^ 0x0400;
+      else
+        v++;
+    }
+  }
+  // fine X scroll shifts the fetched tiles.
+  uint8_t *pixels = background + m_x;
+  if (!(m_mask & 0x02))
+    std::fill(pixels, pixels + 8, 0);
+
+  if (hit) {
+    for (size_t x = 0; x < width - 1; x++) {
+      if ((sprites[x] & 0x40) && pixels[x]) {
+        m_sprite_zero_dot = m_dot - m_cycle + x + 1;
+        break;
+      }
+    }
+  }
+  if (!line)
+    return;
+
+  // backdrop and sprite entries are never looked up through their mirrors.
+  pixels::compose(pixels, sprites, m_palette, m_mask & 0x01 ? 0x30 : 0x3F,
+                  line, width);
+  m_sink->end_line(m_scanline);
+}
+
+bool Ppu::render_sprites(uint8_t *sprites) {
+  int size = m_ctrl & 0x20 ? 16 : 8;
+  int count = 0;
+  bool sprite_zero = false;
+  for (int i = 0; i < 64; i++) {
+    const uint8_t *sprite = &m_oam[i * 4];
+    // sprites are delayed by one scanline.
+    int row = m_scanline - sprite[0] - 1;
+    if (row < 0 || row >= size)
+      continue;
+    if (count++ == 8) {
+      m_status |= 0x20;
+      break;
+    }
+
+    uint8_t attributes = sprite[2];
+    if (attributes & 0x80)
+      row = size - 1 - row;
+    uint16_t pattern;
+    if (size == 16)
+      pattern = ((sprite[1] & 1) << 12) |
+                ((sprite[1] & 0xFE) + (row >> 3)) * 16 | (row & 7);
+    else
+      pattern = (m_ctrl & 0x08 ? 0x1000 : 0) | sprite[1] * 16 | row;
+    uint64_t colors = m_mapper->chr_row(pattern);
+    if (attributes & 0x40)
+      colors = __builtin_bswap64(colors);
+
+    uint64_t flags = (attributes & 0x20 ? 0x80 : 0) | (i ? 0 : 0x40) | 0x10 |
+                     ((attributes & 3) << 2);
+    sprite_zero |= !i;
+
+    // lower sprites have priority, opaque pixels go where no sprite is yet.
+    // Pixels past the right edge land in the padding of sprites.
+    constexpr uint64_t ones = 0x0101010101010101;
+    uint64_t line;
+    std::memcpy(&line, sprites + sprite[3], sizeof(line));
+    uint64_t taken = (((line & ones * 0x7F) + ones * 0x7F) >> 7) & ones;
+    uint64_t opaque = (colors | colors >> 1) & ones;
+    line |= (colors | flags * ones) & ((opaque & ~taken) * 0xFF);
+    std::memcpy(sprites + sprite[3], &line, sizeof(line));
+  }
+  return sprite_zero;
+}
+
+void Ppu::increment_y() {
+  if ((m_v & 0x7000) != 0x7000) {
+    m_v += 0x1000;
+    return;
+  }
+  m_v &= ~0x7000;
+  uint16_t y = (m_v >> 5) & 0x1F;
+  if (y == 29) {
+    y = 0;
+    m_v ^= 0x0800;
+  } else if (y == 31) {
+    y = 0;
+  } else {
+    y++;
+  }
+  m_v = (m_v & ~0x03E0) | (y << 5);
+}
+
+uint8_t Ppu::read_vram(uint16_t address) {
+  if (address < 0x2000)
+    return m_mapper->read_chr(address);
+  if (address < 0x3F00)
+    return nametable(address);
+  return palette(address);
+}
+
+void Ppu::write_vram(uint16_t address, uint8_t data) {
+  if (address < 0x2000)
+    m_mapper->write_chr(address, data);
+  else if (address < 0x3F00)
+    nametable(address) = data;
+  else
+    palette(address) = data & 0x3F;
+}
+
+uint8_t &Ppu::nametable(uint16_t address) {
+  uint16_t table = (address >> 10) & 3;
+  switch (m_mapper->mirroring()) {
+  case Rom::Mirroring::horizontal:
+    table >>= 1;
+    break;
+  case Rom::Mirroring::vertical:
+    table &= 1;
+    break;
+  case Rom::Mirroring::single_screen_lower:
+    table = 0;
+    break;
+  case Rom::Mirroring::single_screen_upper:
+    table = 1;
+    break;
+  case Rom::Mirroring::four_screen:
+    break;
+  }
+  return m_vram[(table << 10) | (address & 0x03FF)];
+}
+
+uint8_t &Ppu::palette(uint16_t address) {
+  // backdrop entries of sprite palettes mirror those of background.
+  uint16_t index = address & 0x1F;
+  if ((index & 0x13) == 0x10)
+    index &= ~0x10;
+  return m_palette[index];
+}
@@ -0,0 +1,117 @@
+#include "Profiler.hpp"
+
+#include "Cpu.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace {
+
+/// Counters of opcodes sharing a label.
+struct Row {
+  const char *mnemonic;
+  const char *addressing;
+  int opcode;
+  uint64_t count;
+  uint64_t cycles;
+  uint64_t penalty;
+  double nanoseconds;
+};
+
+/**
+ * @return Host time of entry, its executions at the mean time of its samples.
+ */
+double estimate(const Profiler::Entry &entry) {
+  return entry.samples ? (double)entry.nanoseconds / entry.samples * entry.count
+                       : 0;
+}
+
+void print(std::FILE *out, const char *title, std::vector<Row> rows) {
+  uint64_t count = 0;
+  double nanoseconds = 0;
+  for (const Row &row : rows) {
+    count += row.count;
+    nanoseconds += row.nanoseconds;
+  }
+  std::stable_sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+    return a.nanoseconds != b.nanoseconds ? a.nanoseconds > b.nanoseconds
+                                          : a.count > b.count;
+  });
+
+  std::fprintf(out, "%-24s %12s %7s %12s %10s %8s %10s %7s\n", title,
+               "count", "count%", "cycles", "penalty", "ns/inst", "host ms",
+               "host%");
+  for (const Row &row : rows) {
+    char label[32];
+    if (row.opcode < 0)
+      std::snprintf(label, sizeof(label), "%s", row.addressing);
+    else
+      std::snprintf(label, sizeof(label), "$%02X %s %s", row.opcode,
+                    row.mnemonic, row.addressing);
+    std::fprintf(out,
+                 "%-24s %12llu %6.2f%% %12llu %10llu %8.2f %10.3f %6.2f%%\n",
+                 label, (unsigned long long)row.count,
+                 100.0 * row.count / count, (unsigned long long)row.cycles,
+                 (unsigned long long)row.penalty,
+                 row.nanoseconds / row.count, row.nanoseconds / 1e6,
+                 nanoseconds ? 100 * row.nanoseconds / nanoseconds : 0);
+  }
+  std::fprintf(out, "%-24s %12llu %7s %12s %10s %8.2f %10.3f\n\n", "total",
+               (unsigned long long)count, "", "", "",
+               count ? nanoseconds / count : 0, nanoseconds / 1e6);
+}
+
+} // namespace
+
+void Profiler::clear() {
+  std::memset(m_entries, 0, sizeof(m_entries));
+  m_countdown = sample_interval;
+  m_random = 0x2545F491;
+
+  m_overhead = std::numeric_limits<int64_t>::max();
+  for (int i = 0; i < 64; i++) {
+    Clock::time_point start = Clock::now();
+    m_overhead = std::min<int64_t>(
+        m_overhead, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        Clock::now() - start)
+                        .count());
+  }
+}
+
+void Profiler::report(std::FILE *out) const {
+  std::vector<Row> opcodes;
+  Row modes[(size_t)Cpu::Addressing::count] = {};
+  for (size_t i = 0; i < (size_t)Cpu::Addressing::count; i++) {
+    modes[i].addressing = Cpu::addressing_name((Cpu::Addressing)i);
+    modes[i].opcode = -1;
+  }
+
+  for (int opcode = 0; opcode < 256; opcode++) {
+    const Entry &entry = m_entries[opcode];
+    if (!entry.count)
+      continue;
+    const Cpu::Instruction &instruction = Cpu::s_lookup[opcode];
+    Row row = {Cpu::mnemonic(opcode),
+               Cpu::addressing_name(instruction.addressing),
+               opcode,
+               entry.count,
+               entry.cycles,
+               entry.cycles - entry.count * instruction.cycles,
+               estimate(entry)};
+    opcodes.push_back(row);
+
+    Row &mode = modes[(size_t)instruction.addressing];
+    mode.count += row.count;
+    mode.cycles += row.cycles;
+    mode.penalty += row.penalty;
+    mode.nanoseconds += row.nanoseconds;
+  }
+
+  print(out, "opcode", opcodes);
+  std::vector<Row> used;
+  std::copy_if(std::begin(modes), std::end(modes), std::back_inserter(used),
+               [](const Row &row) { return row.count; });
+  print(out, "addressing", used);
+}
@@ -0,0 +1,201 @@
+#include "Rewind.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+/// Base of keyframes.
+const std::vector<uint8_t> empty;
+
+/// Zeros ending a run of literals, shorter runs are cheaper as literals.
+constexpr size_t min_zeros = 4;
+
+void write_varint(std::vector<uint8_t> &out, size_t value) {
+  for (; value >= 0x80; value >>= 7)
+    out.push_back(value | 0x80);
+  out.push_back(value);
+}
+
+size_t read_varint(const uint8_t *&data) {
+  size_t value = 0;
+  for (unsigned shift = 0;; shift += 7) {
+    uint8_t byte = *data++;
+    value |= (size_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return value;
+  }
+}
+
+/**
+ * @return Length of the run of equal bytes of a and b starting at i, up to
+ * end. Bytes of b past base_size are zero.
+ */
+size_t equal_run(const uint8_t *a, const uint8_t *b, size_t base_size,
+                 size_t i, size_t end) {
+  size_t start = i;
+  size_t common = std::min(end, base_size);
+  // compare 8 bytes at a time while both have them.
+  for (; i + 8 <= common; i += 8) {
+    uint64_t x, y;
+    std::memcpy(&x, a + i, 8);
+    std::memcpy(&y, b + i, 8);
+    if (x != y)
+      break;
+  }
+  for (; i < common && a[i] == b[i]; i++)
+    ;
+  if (i >= common)
+    for (; i < end && !a[i]; i++)
+      ;
+  return i - start;
+}
+
+} // namespace
+
+Rewind::Rewind(Nes *nes, size_t interval, size_t capacity,
+               size_t keyframe_interval)
+    : m_nes(nes), m_interval(std::max<size_t>(interval, 1)),
+      m_keyframe_interval(keyframe_interval), m_frames(0),
+      m_deltas(keyframe_interval), m_buffer(capacity), m_head(0), m_bytes(0) {}
+
+void Rewind::record() {
+  if (++m_frames < m_interval)
+    return;
+  m_frames = 0;
+
+  m_nes->save_state(m_state);
+  if (m_deltas < m_keyframe_interval) {
+    encode(m_state, m_keyframe, m_encoded);
+    if (push(m_encoded, false)) {
+      m_deltas++;
+      return;
+    }
+  }
+
+  // a keyframe is due, or the last one was dropped to make room.
+  encode(m_state, empty, m_encoded);
+  if (push(m_encoded, true)) {
+    m_keyframe.swap(m_state);
+    m_deltas = 0;
+  }
+}
+
+bool Rewind::step_back() {
+  if (m_entries.empty())
+    return false;
+
+  Entry entry = m_entries.back();
+  decode(&m_buffer[entry.offset], entry.keyframe ? empty : m_keyframe,
+         m_state);
+  m_nes->load_state(m_state.data(), m_state.size());
+
+  m_entries.pop_back();
+  m_bytes -= entry.size;
+  m_head = entry.offset;
+  m_frames = 0;
+  if (!entry.keyframe) {
+    m_deltas--;
+    return true;
+  }
+
+  // deltas left are encoded against the previous keyframe.
+  auto keyframe = std::find_if(m_entries.rbegin(), m_entries.rend(),
+                               [](const Entry &e) { return e.keyframe; });
+  if (keyframe == m_entries.rend()) {
+    m_deltas = m_keyframe_interval;
+    return true;
+  }
+  decode(&m_buffer[keyframe->offset], empty, m_keyframe);
+  m_deltas = keyframe - m_entries.rbegin();
+  return true;
+}
+
+void Rewind::clear() {
+  m_entries.clear();
+  m_bytes = 0;
+  m_head = 0;
+  m_frames = 0;
+  m_deltas = m_keyframe_interval;
+}
+
+void Rewind::encode(const std::vector<uint8_t> &state,
+                    const std::vector<uint8_t> &base,
+                    std::vector<uint8_t> &out) {
+  out.clear();
+  write_varint(out, state.size());
+
+  // pairs of a run of unchanged bytes and a run of XORed literals.
+  size_t size = state.size();
+  size_t i = 0;
+  while (i < size) {
+    size_t zeros = equal_run(state.data(), base.data(), base.size(), i, size);
+    i += zeros;
+    size_t start = i;
+    while (i < size) {
+      size_t run =
+          equal_run(state.data(), base.data(), base.size(), i,
+                    std::min(size, i + min_zeros));
+      if (run == min_zeros || i + run == size)
+        break;
+      i += run + 1;
+    }
+    write_varint(out, zeros);
+    write_varint(out, i - start);
+    for (size_t n = start; n < i; n++)
+      out.push_back(state[n] ^ (n < base.size() ? base[n] : 0));
+  }
+}
+
+void Rewind::decode(const uint8_t *data, const std::vector<uint8_t> &base,
+                    std::vector<uint8_t> &state) {
+  size_t size = read_varint(data);
+  state.resize(size);
+  size_t common = std::min(size, base.size());
+  std::copy(base.begin(), base.begin() + common, state.begin());
+  std::fill(state.begin() + common, state.end(), 0);
+
+  for (size_t i = 0; i < size;) {
+    i += read_varint(data);
+    size_t count = read_varint(data);
+    for (size_t n = 0; n < count; n++)
+      state[i + n] ^= data[n];
+    data += count;
+    i += count;
+  }
+}
+
+bool Rewind::push(const std::vector<uint8_t> &encoded, bool keyframe) {
+  size_t size = encoded.size();
+  if (size > m_buffer.size()) {
+    clear();
+    return false;
+  }
+
+  size_t offset = m_head;
+  if (offset + size > m_buffer.size()) {
+    // snapshots past the head are the oldest, left from the previous lap.
+    while (!m_entries.empty() && m_entries.front().offset >= m_head)
+      pop_front();
+    offset = 0;
+  }
+  while (!m_entries.empty() && m_entries.front().offset >= offset &&
+         m_entries.front().offset < offset + size)
+    pop_front();
+  // a delta is useless once its keyframe is dropped.
+  if (!keyframe && m_entries.empty())
+    return false;
+
+  std::memcpy(&m_buffer[offset], encoded.data(), size);
+  m_entries.push_back({offset, size, keyframe});
+  m_bytes += size;
+  m_head = offset + size;
+  return true;
+}
+
+void Rewind::pop_front() {
+  do {
+    m_bytes -= m_entries.front().size;
+    m_entries.pop_front();
+  } while (!m_entries.empty() && !m_entries.front().keyframe);
+}
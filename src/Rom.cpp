@@ -0,0 +1,129 @@
+#include "Rom.hpp"
+#include "Bus.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+/**
+ * @return Size of ROM in NES 2.0 header given its size bytes, exponent
+ * multiplier notation is used if most significant nibble is $F.
+ */
+uint64_t rom_size(uint8_t lsb, uint8_t msb, size_t unit) {
+  if (msb == 0xF) {
+    unsigned exponent = lsb >> 2;
+    if (exponent > 32)
+      return UINT64_MAX;
+    return ((uint64_t)1 << exponent) * ((lsb & 3) * 2 + 1);
+  }
+  return (uint64_t)(msb << 8 | lsb) * unit;
+}
+
+/**
+ * @return Size of RAM given its shift count in NES 2.0 header.
+ */
+size_t ram_size(uint8_t shift) { return shift ? 64 << shift : 0; }
+
+} // namespace
+
+Rom::Rom() : m_data(nullptr), m_size(0) { close(); }
+
+Rom::~Rom() { close(); }
+
+bool Rom::open(const char *path) {
+  close();
+
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  void *data = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && info.st_size > 0)
+    data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps the file alive.
+  ::close(fd);
+  if (data == MAP_FAILED)
+    return false;
+
+  m_data = static_cast<uint8_t *>(data);
+  m_size = info.st_size;
+  if (!parse()) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void Rom::close() {
+  if (m_data)
+    munmap(m_data, m_size);
+  m_data = nullptr;
+  m_size = 0;
+  m_nes2 = false;
+  m_mapper = 0;
+  m_submapper = 0;
+  m_mirroring = Mirroring::horizontal;
+  m_battery = false;
+  m_prg = m_chr = m_trainer = nullptr;
+  m_prg_size = m_chr_size = 0;
+  m_prg_ram_size = m_chr_ram_size = 0;
+}
+
+bool Rom::parse() {
+  const uint8_t *header = m_data;
+  if (m_size < header_size || std::memcmp(header, "NES\x1A", 4))
+    return false;
+
+  m_nes2 = (header[7] & 0x0C) == 0x08;
+  m_mapper = header[6] >> 4 | (header[7] & 0xF0);
+  m_battery = header[6] & 0x02;
+  if (header[6] & 0x08)
+    m_mirroring = Mirroring::four_screen;
+  else if (header[6] & 0x01)
+    m_mirroring = Mirroring::vertical;
+
+  uint64_t prg_size, chr_size;
+  if (m_nes2) {
+    m_mapper |= (header[8] & 0x0F) << 8;
+    m_submapper = header[8] >> 4;
+    prg_size = rom_size(header[4], header[9] & 0x0F, 0x4000);
+    chr_size = rom_size(header[5], header[9] >> 4, 0x2000);
+    m_prg_ram_size = ram_size(header[10] & 0x0F) + ram_size(header[10] >> 4);
+    m_chr_ram_size = ram_size(header[11] & 0x0F) + ram_size(header[11] >> 4);
+  } else {
+    // old dumpers wrote their name into bytes 7-15, the upper mapper nibble
+    // is only valid if the padding is clear.
+    if ((header[7] & 0x0C) || std::any_of(header + 12, header + 16,
+                                          [](uint8_t byte) { return byte; }))
+      m_mapper &= 0x0F;
+    prg_size = (uint64_t)header[4] * 0x4000;
+    chr_size = (uint64_t)header[5] * 0x2000;
+    m_prg_ram_size = (header[8] ? header[8] : 1) * 0x2000;
+    m_chr_ram_size = chr_size ? 0 : 0x2000;
+  }
+
+  size_t offset = header_size;
+  if (header[6] & 0x04) {
+    m_trainer = m_data + offset;
+    offset += trainer_size;
+  }
+
+  // banks are mapped in whole pages.
+  if (!prg_size || prg_size % Bus::page_size || chr_size % Bus::page_size ||
+      offset > m_size || prg_size + chr_size > m_size - offset)
+    return false;
+
+  m_prg = m_data + offset;
+  m_prg_size = prg_size;
+  if (chr_size)
+    m_chr = m_prg + prg_size;
+  m_chr_size = chr_size;
+  return true;
+}
@@ -0,0 +1,37 @@
+#include "SampleRing.hpp"
+
+#include <algorithm>
+
+namespace {
+
+size_t round_up(size_t capacity) {
+  size_t size = 1;
+  while (size < capacity)
+    size <<= 1;
+  return size;
+}
+
+} // namespace
+
+SampleRing::SampleRing(size_t capacity)
+    : m_samples(round_up(capacity)), m_write(0), m_read(0) {}
+
+size_t SampleRing::write(const int16_t *samples, size_t count) {
+  size_t write = m_write.load(std::memory_order_relaxed);
+  size_t read = m_read.load(std::memory_order_acquire);
+  count = std::min(count, capacity() - (write - read));
+  for (size_t i = 0; i < count; i++)
+    m_samples[(write + i) & (capacity() - 1)] = samples[i];
+  m_write.store(write + count, std::memory_order_release);
+  return count;
+}
+
+size_t SampleRing::read(int16_t *out, size_t count) {
+  size_t read = m_read.load(std::memory_order_relaxed);
+  size_t write = m_write.load(std::memory_order_acquire);
+  count = std::min(count, write - read);
+  for (size_t i = 0; i < count; i++)
+    out[i] = m_samples[(read + i) & (capacity() - 1)];
+  m_read.store(read + count, std::memory_order_release);
+  return count;
+}
@@ -0,0 +1,41 @@
+#include "Scheduler.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+Scheduler::Scheduler() : m_next(never), m_deadline(nullptr) {
+  std::fill(std::begin(m_deadlines), std::end(m_deadlines), never);
+  std::fill(std::begin(m_handlers), std::end(m_handlers), nullptr);
+}
+
+void Scheduler::set_handler(Event event, Handler *handler) {
+  m_handlers[(size_t)event] = handler;
+}
+
+void Scheduler::schedule(Event event, uint64_t time) {
+  m_deadlines[(size_t)event] = time;
+  m_next = *std::min_element(std::begin(m_deadlines), std::end(m_deadlines));
+  if (m_deadline && m_next < *m_deadline)
+    *m_deadline = m_next;
+}
+
+void Scheduler::dispatch(uint64_t time) {
+  while (m_next <= time) {
+    size_t event = std::min_element(std::begin(m_deadlines),
+                                    std::end(m_deadlines)) -
+                   std::begin(m_deadlines);
+    uint64_t deadline = m_deadlines[event];
+    cancel((Event)event);
+    if (m_handlers[event])
+      m_handlers[event]->handle((Event)event, deadline);
+  }
+}
+
+void Scheduler::save(state::Writer &state) const {
+  state.write(m_deadlines, sizeof(*m_deadlines) * (size_t)Event::sample);
+}
+
+void Scheduler::load(state::Reader &state) {
+  state.read(m_deadlines, sizeof(*m_deadlines) * (size_t)Event::sample);
+  m_next = *std::min_element(std::begin(m_deadlines), std::end(m_deadlines));
+}
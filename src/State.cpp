@@ -0,0 +1,45 @@
+#include "State.hpp"
+
+namespace state {
+
+namespace {
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  /// Identifies the image the state was saved with.
+  uint64_t image;
+  /// Size of the whole state including the header.
+  uint64_t size;
+};
+
+constexpr char magic[4] = {'N', 'E', 'S', 'S'};
+
+} // namespace
+
+Writer::Writer(std::vector<uint8_t> &data, uint64_t image) : m_data(data) {
+  Header header = {};
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.version = version;
+  header.image = image;
+  m_data.clear();
+  write(header);
+}
+
+void Writer::finish() {
+  uint64_t size = m_data.size();
+  std::memcpy(m_data.data() + offsetof(Header, size), &size, sizeof(size));
+}
+
+Reader::Reader(const uint8_t *data, size_t size, uint64_t image)
+    : m_data(data), m_size(size), m_offset(0), m_valid(false) {
+  Header header;
+  if (size < sizeof(header))
+    return;
+  read(header);
+  m_valid = !std::memcmp(header.magic, magic, sizeof(magic)) &&
+            header.version == version && header.image == image &&
+            header.size == size;
+}
+
+} // namespace state
@@ -0,0 +1,291 @@
+#include "Trace.hpp"
+
+#include "Lz4.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+namespace {
+
+const char magic[8] = {'N', 'E', 'S', 'T', 'R', 'A', 'C', 'E'};
+
+/// Bytes of a record in a chunk, the fields of Record without padding.
+constexpr size_t record_size = 18;
+
+/// Compressed chunks larger than this are malformed, the writer never
+/// stores more than Trace::block_records records in one.
+constexpr size_t max_chunk_size =
+    lz4::bound(Trace::block_records * record_size);
+
+/// Records converted at once, so that each plane is written in runs.
+constexpr size_t tile = 64;
+
+/**
+ * Stores count records into planes of their fields, each byte of a field
+ * in its own plane, so the compressor sees runs of similar bytes.
+ * @param clock Clock of the record before, updated to the last one.
+ */
+void encode(const Trace::Record *records, size_t count, uint64_t &clock,
+            uint8_t *planes) {
+  uint8_t fields[tile][record_size];
+  for (size_t start = 0; start < count; start += tile) {
+    size_t size = std::min(tile, count - start);
+    for (size_t i = 0; i < size; i++) {
+      const Trace::Record &record = records[start + i];
+      uint64_t delta = record.clock - clock;
+      clock = record.clock;
+      std::memcpy(fields[i], &delta, sizeof(delta));
+      std::memcpy(fields[i] + 8, &record.pc, sizeof(record.pc));
+      std::memcpy(fields[i] + 10, record.bytes, sizeof(record.bytes));
+      fields[i][13] = record.a;
+      fields[i][14] = record.x;
+      fields[i][15] = record.y;
+      fields[i][16] = record.s;
+      fields[i][17] = record.p;
+    }
+    for (size_t j = 0; j < record_size; j++)
+      for (size_t i = 0; i < size; i++)
+        planes[j * count + start + i] = fields[i][j];
+  }
+}
+
+/**
+ * Inverse of encode().
+ */
+void decode(const uint8_t *planes, size_t count, uint64_t &clock,
+            Trace::Record *records) {
+  uint8_t fields[tile][record_size];
+  for (size_t start = 0; start < count; start += tile) {
+    size_t size = std::min(tile, count - start);
+    for (size_t j = 0; j < record_size; j++)
+      for (size_t i = 0; i < size; i++)
+        fields[i][j] = planes[j * count + start + i];
+    for (size_t i = 0; i < size; i++) {
+      Trace::Record &record = records[start + i];
+      uint64_t delta;
+      std::memcpy(&delta, fields[i], sizeof(delta));
+      clock += delta;
+      record.clock = clock;
+      std::memcpy(&record.pc, fields[i] + 8, sizeof(record.pc));
+      std::memcpy(record.bytes, fields[i] + 10, sizeof(record.bytes));
+      record.a = fields[i][13];
+      record.x = fields[i][14];
+      record.y = fields[i][15];
+      record.s = fields[i][16];
+      record.p = fields[i][17];
+    }
+  }
+}
+
+bool same(const Trace::Record &a, const Trace::Record &b) {
+  return a.clock == b.clock && a.pc == b.pc &&
+         !std::memcmp(a.bytes, b.bytes, sizeof(a.bytes)) && a.a == b.a &&
+         a.x == b.x && a.y == b.y && a.s == b.s && a.p == b.p;
+}
+
+} // namespace
+
+std::unique_ptr<Trace> Trace::open(const char *path) {
+  std::FILE *file = std::fopen(path, "wb");
+  if (!file)
+    return nullptr;
+  if (std::fwrite(magic, sizeof(magic), 1, file) != 1 ||
+      std::fwrite(&version, sizeof(version), 1, file) != 1) {
+    std::fclose(file);
+    return nullptr;
+  }
+  return std::unique_ptr<Trace>(new Trace(file));
+}
+
+Trace::Trace(std::FILE *file)
+    : m_file(file),
+      m_blocks(block_count, std::vector<Record>(block_records)),
+      m_records(m_blocks[0].data()), m_block(0), m_count(0), m_submitted(0),
+      m_closing(false), m_failed(false) {
+  for (size_t i = 1; i < block_count; i++)
+    m_free.push_back(i);
+  m_writer = std::thread(&Trace::drain, this);
+}
+
+Trace::~Trace() { close(); }
+
+bool Trace::close() {
+  if (m_writer.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_count)
+        m_full.emplace_back(m_block, m_count);
+      m_submitted += m_count;
+      m_closing = true;
+    }
+    m_changed.notify_all();
+    m_writer.join();
+    m_failed |= std::fclose(m_file) != 0;
+  }
+  m_count = 0;
+  return !m_failed;
+}
+
+void Trace::submit() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_closing) {
+    m_count = 0;
+    return;
+  }
+  m_full.emplace_back(m_block, m_count);
+  m_submitted += m_count;
+  m_count = 0;
+  m_changed.notify_all();
+  m_changed.wait(lock, [this] { return !m_free.empty(); });
+  m_block = m_free.back();
+  m_free.pop_back();
+  m_records = m_blocks[m_block].data();
+}
+
+void Trace::drain() {
+  std::vector<uint8_t> planes, compressed;
+  uint64_t clock = 0;
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for (;;) {
+    m_changed.wait(lock, [this] { return m_closing || !m_full.empty(); });
+    if (m_full.empty())
+      return;
+    std::pair<size_t, size_t> block = m_full.front();
+    m_full.pop_front();
+    lock.unlock();
+
+    size_t size = block.second * record_size;
+    planes.resize(size);
+    compressed.resize(lz4::bound(size));
+    encode(m_blocks[block.first].data(), block.second, clock, planes.data());
+    uint32_t header[] = {
+        (uint32_t)block.second,
+        (uint32_t)lz4::compress(planes.data(), size, compressed.data())};
+    bool written =
+        std::fwrite(header, sizeof(header), 1, m_file) == 1 &&
+        std::fwrite(compressed.data(), header[1], 1, m_file) == 1;
+
+    lock.lock();
+    m_failed |= !written;
+    m_free.push_back(block.first);
+    m_changed.notify_all();
+  }
+}
+
+std::unique_ptr<Trace::Reader> Trace::Reader::open(const char *path) {
+  std::FILE *file = std::fopen(path, "rb");
+  if (!file)
+    return nullptr;
+  char header[sizeof(magic)];
+  uint32_t format;
+  if (std::fread(header, sizeof(header), 1, file) != 1 ||
+      std::fread(&format, sizeof(format), 1, file) != 1 ||
+      std::memcmp(header, magic, sizeof(magic)) || format != version) {
+    std::fclose(file);
+    return nullptr;
+  }
+  return std::unique_ptr<Reader>(new Reader(file));
+}
+
+Trace::Reader::Reader(std::FILE *file)
+    : m_file(file), m_clock(0), m_failed(false) {}
+
+Trace::Reader::~Reader() { std::fclose(m_file); }
+
+bool Trace::Reader::read(std::vector<Record> &records) {
+  uint32_t header[2];
+  size_t size = std::fread(header, 1, sizeof(header), m_file);
+  if (!size && std::feof(m_file))
+    return false;
+  if (size != sizeof(header) || header[0] > block_records ||
+      header[1] > max_chunk_size) {
+    m_failed = true;
+    return false;
+  }
+
+  size_t count = header[0];
+  m_compressed.resize(header[1]);
+  m_planes.resize(count * record_size);
+  if (std::fread(m_compressed.data(), 1, header[1], m_file) != header[1] ||
+      lz4::decompress(m_compressed.data(), header[1], m_planes.data(),
+                      m_planes.size()) != m_planes.size()) {
+    m_failed = true;
+    return false;
+  }
+  records.resize(count);
+  decode(m_planes.data(), count, m_clock, records.data());
+  return true;
+}
+
+bool Trace::test() {
+  char path[] = "/tmp/nes_traceXXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    return false;
+  ::close(fd);
+
+  // more records than two blocks, the last chunk is partial.
+  std::vector<Record> records(2 * block_records + 1000);
+  uint64_t clock = 7;
+  for (size_t i = 0; i < records.size(); i++) {
+    Record &record = records[i];
+    clock += 2 + i % 5;
+    record = {clock, (uint16_t)(i * 3), {(uint8_t)i, (uint8_t)(i >> 8), 0},
+              (uint8_t)(i >> 2), (uint8_t)(i >> 4), 0, 0xFD, (uint8_t)(i * 7)};
+  }
+  auto trace = open(path);
+  bool ok = trace != nullptr;
+  if (trace) {
+    for (const Record &record : records)
+      trace->write(record);
+    ok &= trace->close() && trace->records() == records.size();
+  }
+
+  std::vector<Record> read, chunk;
+  auto reader = Reader::open(path);
+  ok &= reader != nullptr;
+  while (reader && reader->read(chunk))
+    read.insert(read.end(), chunk.begin(), chunk.end());
+  ok &= reader && !reader->failed() && read.size() == records.size() &&
+        std::equal(read.begin(), read.end(), records.begin(), same);
+  reader.reset();
+
+  // a complete chunk of one record more than a block, and a chunk claiming
+  // more compressed bytes than a block compresses to, are rejected before
+  // anything is allocated for them.
+  std::vector<uint8_t> planes((block_records + 1) * record_size);
+  uint32_t header[2] = {block_records + 1};
+  std::vector<uint8_t> oversized(sizeof(header) + lz4::bound(planes.size()));
+  header[1] = (uint32_t)lz4::compress(planes.data(), planes.size(),
+                                      &oversized[sizeof(header)]);
+  std::memcpy(oversized.data(), header, sizeof(header));
+  oversized.resize(sizeof(header) + header[1]);
+  header[0] = 16;
+  header[1] = max_chunk_size + 1;
+  const uint8_t *bytes = (const uint8_t *)header;
+  std::vector<uint8_t> malformed[] = {
+      oversized, std::vector<uint8_t>(bytes, bytes + sizeof(header))};
+
+  std::FILE *file = std::fopen(path, "r+b");
+  ok &= file && !std::fseek(file, 0, SEEK_END);
+  long end = file ? std::ftell(file) : 0;
+  for (const std::vector<uint8_t> &bad : malformed) {
+    // each replaces the last one after the valid chunks.
+    ok &= file && !std::fseek(file, end, SEEK_SET) &&
+          std::fwrite(bad.data(), bad.size(), 1, file) == 1 &&
+          !std::fflush(file);
+    auto reader = Reader::open(path);
+    size_t chunks = 0;
+    while (reader && reader->read(chunk))
+      chunks++;
+    ok &= reader && reader->failed() && chunks == 3;
+  }
+  if (file)
+    std::fclose(file);
+  unlink(path);
+  std::printf("trace round trip %s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
@@ -0,0 +1,173 @@
+#include "Cpu.hpp"
+#include "Nes.hpp"
+#include "Trace.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using Mode = Cpu::Addressing;
+
+/**
+ * Runs the image at path headless for frames, recording every instruction
+ * to a trace at out.
+ */
+static int record(const char *path, unsigned long frames, const char *out) {
+  auto nes = Nes::open(path);
+  if (!nes) {
+    std::fprintf(stderr, "can not load %s\n", path);
+    return 1;
+  }
+  auto trace = Trace::open(out);
+  if (!trace) {
+    std::fprintf(stderr, "can not write %s\n", out);
+    return 1;
+  }
+
+  nes->cpu().set_trace(trace.get());
+  for (unsigned long i = 0; i < frames && !nes->cpu().halted(); i++)
+    nes->run_frame();
+  nes->cpu().set_trace(nullptr);
+  if (!trace->close()) {
+    std::fprintf(stderr, "can not write %s\n", out);
+    return 1;
+  }
+  std::printf("instructions %llu cycles %llu\n",
+              (unsigned long long)trace->records(),
+              (unsigned long long)nes->cpu().clock());
+  return 0;
+}
+
+/**
+ * @return Length in bytes of instructions using addressing.
+ */
+static size_t length(Mode addressing) {
+  switch (addressing) {
+  case Mode::implicit:
+    return 1;
+  case Mode::absolute:
+  case Mode::absolute_x:
+  case Mode::absolute_y:
+  case Mode::indirect:
+    return 3;
+  default:
+    return 2;
+  }
+}
+
+/**
+ * Writes the instruction of record as assembly into text.
+ */
+static void disassemble(const Trace::Record &record, char *text,
+                        size_t size) {
+  const Cpu::Instruction &instruction = Cpu::s_lookup[record.bytes[0]];
+  const char *mnemonic = Cpu::mnemonic(record.bytes[0]);
+  uint8_t low = record.bytes[1];
+  uint16_t word = low | record.bytes[2] << 8;
+  switch (instruction.addressing) {
+  case Mode::implicit:
+    switch (instruction.operation) {
+    case Cpu::Operation::ASL_A:
+    case Cpu::Operation::ROL_A:
+    case Cpu::Operation::LSR_A:
+    case Cpu::Operation::ROR_A:
+      std::snprintf(text, size, "%s A", mnemonic);
+      break;
+    default:
+      std::snprintf(text, size, "%s", mnemonic);
+    }
+    break;
+  case Mode::immediate:
+    std::snprintf(text, size, "%s #$%02X", mnemonic, low);
+    break;
+  case Mode::absolute:
+    std::snprintf(text, size, "%s $%04X", mnemonic, word);
+    break;
+  case Mode::zero_page:
+    std::snprintf(text, size, "%s $%02X", mnemonic, low);
+    break;
+  case Mode::relative:
+    std::snprintf(text, size, "%s $%04X", mnemonic,
+                  (uint16_t)(record.pc + 2 + (int8_t)low));
+    break;
+  case Mode::absolute_x:
+    std::snprintf(text, size, "%s $%04X,X", mnemonic, word);
+    break;
+  case Mode::absolute_y:
+    std::snprintf(text, size, "%s $%04X,Y", mnemonic, word);
+    break;
+  case Mode::zero_page_x:
+    std::snprintf(text, size, "%s $%02X,X", mnemonic, low);
+    break;
+  case Mode::zero_page_y:
+    std::snprintf(text, size, "%s $%02X,Y", mnemonic, low);
+    break;
+  case Mode::indirect:
+    std::snprintf(text, size, "%s ($%04X)", mnemonic, word);
+    break;
+  case Mode::indexed_indirect:
+    std::snprintf(text, size, "%s ($%02X,X)", mnemonic, low);
+    break;
+  default:
+    std::snprintf(text, size, "%s ($%02X),Y", mnemonic, low);
+  }
+}
+
+/**
+ * Converts the trace at path to text at out, stdout if nullptr, one line
+ * per instruction as in the nestest log: address, instruction bytes,
+ * assembly, registers and cycles, without the PPU position.
+ */
+static int text(const char *path, const char *out) {
+  auto reader = Trace::Reader::open(path);
+  if (!reader) {
+    std::fprintf(stderr, "can not read trace %s\n", path);
+    return 1;
+  }
+  std::FILE *file = out ? std::fopen(out, "w") : stdout;
+  if (!file) {
+    std::fprintf(stderr, "can not write %s\n", out);
+    return 1;
+  }
+
+  std::vector<Trace::Record> records;
+  while (reader->read(records)) {
+    for (const Trace::Record &record : records) {
+      char bytes[16] = "", assembly[32];
+      size_t count = length(Cpu::s_lookup[record.bytes[0]].addressing);
+      for (size_t i = 0; i < count; i++)
+        std::snprintf(bytes + 3 * i, sizeof(bytes) - 3 * i, "%02X ",
+                      record.bytes[i]);
+      disassemble(record, assembly, sizeof(assembly));
+      std::fprintf(file,
+                   "%04X  %-9s %-31s A:%02X X:%02X Y:%02X P:%02X SP:%02X "
+                   "CYC:%llu\n",
+                   record.pc, bytes, assembly, record.a, record.x, record.y,
+                   record.p, record.s, (unsigned long long)record.clock);
+    }
+  }
+  bool written = !std::ferror(file);
+  if (out)
+    written &= std::fclose(file) == 0;
+  if (reader->failed()) {
+    std::fprintf(stderr, "trace %s is truncated or malformed\n", path);
+    return 1;
+  }
+  if (!written) {
+    std::fprintf(stderr, "can not write %s\n", out ? out : "stdout");
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 5 && !std::strcmp(argv[1], "record"))
+    return record(argv[2], std::strtoul(argv[3], nullptr, 10), argv[4]);
+  if ((argc == 3 || argc == 4) && !std::strcmp(argv[1], "text"))
+    return text(argv[2], argc == 4 ? argv[3] : nullptr);
+
+  std::fprintf(stderr, "usage: nes_trace record rom.nes frames out.trace\n"
+                       "       nes_trace text in.trace [out.txt]\n");
+  return 1;
+}